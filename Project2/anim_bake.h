@@ -0,0 +1,190 @@
+#ifndef ANIM_BAKE_H
+#define ANIM_BAKE_H
+
+#include "cpu_skinning.h"
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Bakes a clip into a float texture for background crowds: every row is one frame sampled at a fixed rate
+// through getPose(), so playback is a couple of texelFetch calls in baked_crowd.vs and costs no CPU time.
+//  - bone mode: a bone takes three RGBA32F texels holding the first three rows of its (affine) palette matrix,
+//    row f is frame f. the vertex shader skins with the usual 4 bone blend
+//  - vertex mode: the skinned vertices themselves, two rows per frame (positions, then normals) and one
+//    column per vertex. costs more memory but the shader does no skinning at all
+
+struct BakedAnimation {
+	unsigned int texture = 0;
+	unsigned int frameCount = 0;
+	unsigned int width = 0;			// texels per row
+	float frameRate = 30.0f;		// frames per second of the bake
+	bool vertices = false;			// vertex mode instead of bone mode
+};
+
+// number of frames needed to cover the clip at frameRate, at least one
+inline unsigned int bakedFrameCount(const Animation& animation, float frameRate)
+{
+	float seconds = animation.duration / animation.ticksPerSecond;
+	return std::max(1u, (unsigned int)std::ceil(seconds * frameRate));
+}
+
+// samples the clip frameCount times and writes the affine part of every palette matrix, 3 texels per bone
+inline std::vector<glm::vec4> bakeBoneMatrices(AnimatedModel& rig, float frameRate, unsigned int& frameCount)
+{
+	frameCount = bakedFrameCount(rig.animation, frameRate);
+	unsigned int bones = std::max(rig.boneCount, 1u);
+	std::vector<glm::vec4> texels((size_t)frameCount * bones * 3);
+	std::vector<glm::mat4> palette(bones);
+	glm::mat4 identity(1.0f);
+	for (unsigned int f = 0; f < frameCount; f++)
+	{
+		std::fill(palette.begin(), palette.end(), glm::mat4(1.0f));
+		float ticks = (float)f / frameRate * rig.animation.ticksPerSecond;
+		getPose(rig.animation, rig.skeleton, ticks, palette, identity, rig.globalInverseTransform);
+		glm::vec4* row = &texels[(size_t)f * bones * 3];
+		for (unsigned int b = 0; b < bones; b++)
+		{
+			const glm::mat4& m = palette[b];
+			for (int r = 0; r < 3; r++)
+				row[b * 3 + r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+		}
+	}
+	return texels;
+}
+
+// samples the clip frameCount times and skins every vertex on the CPU, positions and normals in rows 2f and 2f+1
+inline std::vector<glm::vec4> bakeVertexPositions(AnimatedModel& rig, float frameRate, unsigned int& frameCount)
+{
+	frameCount = bakedFrameCount(rig.animation, frameRate);
+	unsigned int count = (unsigned int)rig.vertices.size();
+	std::vector<glm::vec4> texels((size_t)frameCount * count * 2);
+	std::vector<glm::mat4> palette(std::max(rig.boneCount, 1u));
+	std::vector<SkinnedOutput> skinned(count);
+	glm::mat4 identity(1.0f);
+	for (unsigned int f = 0; f < frameCount; f++)
+	{
+		std::fill(palette.begin(), palette.end(), glm::mat4(1.0f));
+		float ticks = (float)f / frameRate * rig.animation.ticksPerSecond;
+		getPose(rig.animation, rig.skeleton, ticks, palette, identity, rig.globalInverseTransform);
+		skinVerticesReference(rig.vertices.data(), 0, count, palette.data(), skinned.data());
+		glm::vec4* positions = &texels[(size_t)f * 2 * count];
+		glm::vec4* normals = positions + count;
+		for (unsigned int v = 0; v < count; v++)
+		{
+			positions[v] = glm::vec4(skinned[v].position, 1.0f);
+			normals[v] = glm::vec4(skinned[v].normal, 0.0f);
+		}
+	}
+	return texels;
+}
+
+// bakes the rig's first clip and uploads it. the texture is sampled with texelFetch only, so it has no mipmaps
+inline BakedAnimation bakeAnimation(AnimatedModel& rig, float frameRate, bool vertices)
+{
+	BakedAnimation baked;
+	baked.frameRate = frameRate;
+	baked.vertices = vertices;
+	std::vector<glm::vec4> texels = vertices ? bakeVertexPositions(rig, frameRate, baked.frameCount) : bakeBoneMatrices(rig, frameRate, baked.frameCount);
+	unsigned int height = vertices ? baked.frameCount * 2 : baked.frameCount;
+	baked.width = (unsigned int)(texels.size() / height);
+
+	int maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if ((int)baked.width > maxSize || (int)height > maxSize)
+		std::cout << "ERROR::BAKE:: baked animation is " << baked.width << "x" << height << ", larger than GL_MAX_TEXTURE_SIZE " << maxSize << std::endl;
+
+	glGenTextures(1, &baked.texture);
+	glBindTexture(GL_TEXTURE_2D, baked.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, baked.width, height, 0, GL_RGBA, GL_FLOAT, texels.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	std::cout << "bakeAnimation() frames=" << baked.frameCount << " size=" << baked.width << "x" << height
+		<< " bytes=" << texels.size() * sizeof(glm::vec4) << std::endl;
+	return baked;
+}
+
+// per instance data of a baked crowd
+struct BakedInstance {
+	glm::mat4 model;
+	float timeOffset;				// seconds added to the global time, so the crowd doesn't move in lockstep
+};
+
+// instance buffer for drawing a baked crowd with one instanced draw call. attaches to a VAO made by
+// createVertexArray(), which uses locations 0-4, so the instance model matrix goes to 5-8 and the offset to 9
+class BakedCrowd
+{
+public:
+	unsigned int VAO = 0;
+	unsigned int instanceVBO = 0;
+	unsigned int indexCount = 0;
+	unsigned int instanceCount = 0;
+
+	BakedCrowd(unsigned int vao, unsigned int indexCount) : VAO(vao), indexCount(indexCount)
+	{
+		glGenBuffers(1, &instanceVBO);
+		// no mesh to attach to, e.g. the model didn't load. setInstances still works, Draw has nothing to draw
+		if (!VAO)
+			return;
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		for (int i = 0; i < 4; i++)
+		{
+			glEnableVertexAttribArray(5 + i);
+			glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(BakedInstance), (void*)(offsetof(BakedInstance, model) + i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(5 + i, 1);
+		}
+		glEnableVertexAttribArray(9);
+		glVertexAttribPointer(9, 1, GL_FLOAT, GL_FALSE, sizeof(BakedInstance), (void*)offsetof(BakedInstance, timeOffset));
+		glVertexAttribDivisor(9, 1);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	BakedCrowd(const BakedCrowd&) = delete;
+	BakedCrowd& operator=(const BakedCrowd&) = delete;
+
+	~BakedCrowd()
+	{
+		release();
+	}
+
+	// deletes the instance buffer while the context is alive, the VAO belongs to whoever made it
+	void release()
+	{
+		if (instanceVBO)
+			glDeleteBuffers(1, &instanceVBO);
+		instanceVBO = 0;
+	}
+
+	void setInstances(const std::vector<BakedInstance>& instances)
+	{
+		instanceCount = (unsigned int)instances.size();
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(BakedInstance), instances.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// draws every instance, shader is expected to be baked_crowd.vs with its projection/view already set
+	void Draw(Shader& shader, const BakedAnimation& baked, float time, unsigned int unit = 1)
+	{
+		if (!VAO || instanceCount == 0)
+			return;
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, baked.texture);
+		shader.setInt("bakedAnimation", unit);
+		shader.setBool("bakedVertices", baked.vertices);
+		shader.setInt("frameCount", (int)baked.frameCount);
+		shader.setFloat("frameRate", baked.frameRate);
+		shader.setFloat("time", time);
+
+		glBindVertexArray(VAO);
+		glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, instanceCount);
+		glBindVertexArray(0);
+		glActiveTexture(GL_TEXTURE0);
+	}
+};
+#endif
@@ -0,0 +1,102 @@
+#ifndef ANIM_LOD_H
+#define ANIM_LOD_H
+
+#include "pose.h"
+
+#include <string>
+#include <vector>
+
+// Update-rate LOD for animated characters. Characters that are small on screen are re-sampled every few
+// frames instead of every frame and skip the finger and face bones; the frames they update on are staggered
+// so the work of one LOD level is spread evenly instead of spiking every Nth frame.
+
+struct AnimLodLevel {
+	float minScreenSize;			// smallest projected height (fraction of the viewport) that uses this level
+	unsigned int updateInterval;	// sample a new pose every updateInterval frames
+	bool detailBones;				// evaluate finger and face bones
+	bool interpolate;				// blend towards the next sampled pose on the frames in between
+};
+
+// decision for one character for the current frame
+struct AnimLodState {
+	unsigned char level = 0;
+	bool update = true;				// a new pose has to be sampled this frame
+};
+
+// true for bones that are too small to notice on a distant character (mixamo naming, e.g. mixamorig:LeftHandIndex1)
+inline bool isDetailBone(const std::string& name)
+{
+	static const char* detailNames[] = { "Thumb", "Index", "Middle", "Ring", "Pinky", "Eye", "Jaw", "Tongue", "HeadTop" };
+	for (const char* detail : detailNames)
+	{
+		if (name.find(detail) != std::string::npos)
+			return true;
+	}
+	return false;
+}
+
+// flags every detail bone, the result is indexed like FlatSkeleton::bones
+inline std::vector<unsigned char> findDetailBones(const FlatSkeleton& skeleton)
+{
+	std::vector<unsigned char> detail(skeleton.bones.size(), 0);
+	for (unsigned int i = 0; i < skeleton.bones.size(); i++)
+		detail[i] = isDetailBone(skeleton.bones[i].name) ? 1 : 0;
+	return detail;
+}
+
+class AnimLodScheduler
+{
+public:
+	// ordered from the most to the least detailed level
+	std::vector<AnimLodLevel> levels = {
+		{ 0.25f, 1, true, false },
+		{ 0.10f, 2, true, true },
+		{ 0.04f, 4, false, true },
+		{ 0.00f, 8, false, false },
+	};
+	unsigned int frame = 0;
+
+	// projected height of a bounding sphere as a fraction of the viewport height
+	static float screenSize(const glm::vec3& center, float radius, const glm::vec3& cameraPosition, const glm::mat4& projection)
+	{
+		float distance = glm::length(center - cameraPosition);
+		if (distance <= radius)
+			return 1.0f;
+		return radius * projection[1][1] / distance;
+	}
+
+	unsigned int selectLevel(float size) const
+	{
+		for (unsigned int i = 0; i < levels.size(); i++)
+		{
+			if (size >= levels[i].minScreenSize)
+				return i;
+		}
+		return (unsigned int)levels.size() - 1;
+	}
+
+	// picks the level of every character and whether it updates this frame. the instance index is
+	// used as the phase, so characters on the same level update on different frames
+	void schedule(const std::vector<glm::vec3>& positions, float radius, const glm::vec3& cameraPosition, const glm::mat4& projection, std::vector<AnimLodState>& states)
+	{
+		states.resize(positions.size());
+		for (unsigned int i = 0; i < positions.size(); i++)
+		{
+			unsigned int level = selectLevel(screenSize(positions[i], radius, cameraPosition, projection));
+			unsigned int interval = levels[level].updateInterval > 0 ? levels[level].updateInterval : 1;
+			states[i].level = (unsigned char)level;
+			states[i].update = (frame + i) % interval == 0;
+		}
+		frame++;
+	}
+
+	// how many characters are on every level, for the stats overlay
+	std::vector<unsigned int> histogram(const std::vector<AnimLodState>& states) const
+	{
+		std::vector<unsigned int> counts(levels.size(), 0);
+		for (const AnimLodState& state : states)
+			counts[state.level]++;
+		return counts;
+	}
+};
+#endif
@@ -0,0 +1,440 @@
+#ifndef ASSET_BENCHMARKS_H
+#define ASSET_BENCHMARKS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <assimp/Exporter.hpp>
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <stb_image.h>
+
+#include "microbench.h"
+#include "mipgen.h"
+#include "model.h"
+#include "pose.h"
+#include "profiler.h"
+#include "jobsystem.h"
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of loading and preparing assets, run with --bench-micro [filter] [--bench-json file]:
+// assimp import of every model against loading it back from assimp's binary format (the "cooked" file), stbi_load
+// of every image, full mip chains on the CPU (scalar and SIMD box filter) and with glGenerateMipmap, getTimeFraction
+// by key count, getPose and samplePose by bone count, Mesh construction by vertex count, and whole Model loads with
+// and without a JobSystem.
+// GL cases run in an invisible window's context and are skipped when there is none, e.g. without a display.
+
+#define ASSET_BENCHMARK_RESOURCES "../Project2/resources/"
+
+// deterministic noise so the filters see real data
+inline std::vector<unsigned char> benchmarkImage(int width, int height)
+{
+	std::vector<unsigned char> pixels((size_t)width * height * 4);
+	unsigned int seed = 12345u;
+	for (unsigned char& p : pixels)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		p = (unsigned char)(seed >> 24);
+	}
+	return pixels;
+}
+
+// a skeleton of boneCount bones as a binary tree, every bone with its own track of keyCount keys
+inline void benchmarkSkeleton(unsigned int boneCount, unsigned int keyCount, Bone& root, Animation& animation)
+{
+	std::vector<Bone> bones(boneCount);
+	animation.duration = (float)(keyCount - 1);
+	animation.ticksPerSecond = 30.0f;
+	animation.boneTransforms.clear();
+	for (unsigned int i = 0; i < boneCount; i++)
+	{
+		bones[i].id = (int)i;
+		bones[i].name = "bone" + std::to_string(i);
+		bones[i].offset = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.1f * i, 0.0f));
+		BoneTransformTrack& track = animation.boneTransforms[bones[i].name];
+		for (unsigned int k = 0; k < keyCount; k++)
+		{
+			float t = (float)k;
+			track.positionTimestamps.push_back(t);
+			track.rotationTimestamps.push_back(t);
+			track.scaleTimestamps.push_back(t);
+			track.positions.push_back(glm::vec3(0.0f, 0.1f, 0.01f * k));
+			track.rotations.push_back(glm::angleAxis(3.0f * k, glm::vec3(0.0f, 0.0f, 1.0f)));
+			track.scales.push_back(glm::vec3(1.0f));
+		}
+	}
+	// children are copied into their parents, so the tree is put together from the leaves up
+	for (int i = (int)boneCount - 1; i > 0; i--)
+		bones[(i - 1) / 2].children.insert(bones[(i - 1) / 2].children.begin(), bones[i]);
+	root = bones[0];
+}
+
+inline void addImportBenchmarks(MicroBenchmarkSuite& suite, const std::vector<std::string>& models)
+{
+	// the flags Model::loadModel() imports with
+	const unsigned int flags = aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+	for (const std::string& model : models)
+	{
+		std::string path = ASSET_BENCHMARK_RESOURCES + model;
+		suite.add("import/assimp/" + model, [path, flags](MicroBenchmarkState& state) {
+			unsigned int vertices = 0;
+			while (state.keepRunning())
+			{
+				Assimp::Importer importer;
+				const aiScene* scene = importer.ReadFile(path, flags);
+				if (!scene)
+				{
+					state.skip(importer.GetErrorString());
+					return;
+				}
+				vertices = 0;
+				for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+					vertices += scene->mMeshes[i]->mNumVertices;
+			}
+			state.setLabel(std::to_string(vertices) + " vertices");
+		});
+		// the imported and post processed scene written as assbin once, then only that file is read
+		suite.add("import/cooked/" + model, [path, flags](MicroBenchmarkState& state) {
+			std::string cooked = path + ".bench.assbin";
+			{
+				Assimp::Importer importer;
+				const aiScene* scene = importer.ReadFile(path, flags);
+				Assimp::Exporter exporter;
+				if (!scene || exporter.Export(scene, "assbin", cooked) != AI_SUCCESS)
+				{
+					state.skip("can't write " + cooked);
+					return;
+				}
+			}
+			FILE* file = fopen(cooked.c_str(), "rb");
+			long size = 0;
+			if (file)
+			{
+				fseek(file, 0, SEEK_END);
+				size = ftell(file);
+				fclose(file);
+			}
+			while (state.keepRunning())
+			{
+				Assimp::Importer importer;
+				doNotOptimize(importer.ReadFile(cooked, 0));
+			}
+			std::remove(cooked.c_str());
+			state.setLabel(std::to_string(size / 1024) + " KB assbin");
+		});
+	}
+}
+
+inline void addImageBenchmarks(MicroBenchmarkSuite& suite, const std::vector<std::string>& images)
+{
+	for (const std::string& image : images)
+	{
+		std::string path = ASSET_BENCHMARK_RESOURCES + image;
+		suite.add("stbi_load/" + image, [path](MicroBenchmarkState& state) {
+			int width = 0, height = 0, components = 0;
+			while (state.keepRunning())
+			{
+				unsigned char* data = stbi_load(path.c_str(), &width, &height, &components, 0);
+				if (!data)
+				{
+					state.skip(stbi_failure_reason());
+					return;
+				}
+				stbi_image_free(data);
+			}
+			state.setLabel(std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(components));
+			state.setItemsPerIteration((double)width * height);
+		});
+	}
+}
+
+inline void addMipBenchmarks(MicroBenchmarkSuite& suite, bool gl)
+{
+	const int sizes[] = { 512, 2048 };
+	for (int size : sizes)
+	{
+		std::string suffix = std::to_string(size);
+		// a full chain down to 1x1, every level from the one before it like the bakers do
+		for (int simd = 0; simd < 2; simd++)
+		{
+			suite.add(std::string("mips/") + (simd ? "simd/" : "scalar/") + suffix, [size, simd](MicroBenchmarkState& state) {
+				std::vector<unsigned char> level0 = benchmarkImage(size, size);
+				std::vector<unsigned char> a(level0.size() / 4), b(level0.size() / 16 + 4);
+				while (state.keepRunning())
+				{
+					const unsigned char* src = level0.data();
+					unsigned char* dst = a.data();
+					for (int w = size; w > 1; w /= 2)
+					{
+						if (simd)
+							downsampleBox(src, w, w, dst);
+						else
+							downsampleBoxScalar(src, w, w, dst);
+						src = dst;
+						dst = dst == a.data() ? b.data() : a.data();
+					}
+					doNotOptimize(*src);
+				}
+#ifndef MIPGEN_SSE2
+				if (simd)
+					state.setLabel("no SSE2, scalar fallback");
+#endif
+				state.setItemsPerIteration((double)size * size);
+			});
+		}
+		suite.add("mips/glGenerateMipmap/" + suffix, [size, gl](MicroBenchmarkState& state) {
+			if (!gl)
+			{
+				state.skip("no GL context");
+				return;
+			}
+			std::vector<unsigned char> level0 = benchmarkImage(size, size);
+			unsigned int texture;
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, level0.data());
+			glFinish();
+			while (state.keepRunning())
+			{
+				glGenerateMipmap(GL_TEXTURE_2D);
+				glFinish();
+			}
+			glDeleteTextures(1, &texture);
+			state.setLabel((const char*)glGetString(GL_RENDERER));
+			state.setItemsPerIteration((double)size * size);
+		});
+	}
+}
+
+inline void addPoseBenchmarks(MicroBenchmarkSuite& suite)
+{
+	const unsigned int keyCounts[] = { 8, 64, 512 };
+	for (unsigned int keys : keyCounts)
+	{
+		suite.add("getTimeFraction/" + std::to_string(keys) + " keys", [keys](MicroBenchmarkState& state) {
+			std::vector<float> times;
+			for (unsigned int k = 0; k < keys; k++)
+				times.push_back((float)k);
+			// getTimeFraction needs dt past the first key
+			float t = 0.5f;
+			while (state.keepRunning())
+			{
+				float dt = t;
+				doNotOptimize(getTimeFraction(times, dt));
+				t += 0.37f;
+				if (t >= keys - 1)
+					t -= keys - 1.5f;
+			}
+		});
+	}
+
+	const unsigned int boneCounts[] = { 16, 64, 256 };
+	for (unsigned int bones : boneCounts)
+	{
+		std::shared_ptr<AnimatedModel> rig(new AnimatedModel());
+		benchmarkSkeleton(bones, 30, rig->skeleton, rig->animation);
+		rig->boneCount = bones;
+		std::string name = std::to_string(bones) + " bones";
+		suite.add("getPose/" + name, [rig](MicroBenchmarkState& state) {
+			std::vector<glm::mat4> palette(rig->boneCount, glm::mat4(1.0f));
+			glm::mat4 identity(1.0f);
+			float t = 0.5f;
+			while (state.keepRunning())
+			{
+				getPose(rig->animation, rig->skeleton, t, palette, identity, rig->globalInverseTransform);
+				t = t + 0.37f >= rig->animation.duration ? 0.5f : t + 0.37f;
+			}
+			doNotOptimize(palette[0]);
+			state.setItemsPerIteration(rig->boneCount);
+		});
+		suite.add("samplePose/" + name, [rig](MicroBenchmarkState& state) {
+			FlatSkeleton skeleton;
+			flattenSkeleton(rig->skeleton, skeleton);
+			ClipBinding clip;
+			bindClip(rig->animation, skeleton, clip);
+			std::vector<BoneLocal> local;
+			std::vector<glm::mat4> palette(skeleton.paletteSize, glm::mat4(1.0f)), globals;
+			float t = 0.5f;
+			while (state.keepRunning())
+			{
+				samplePose(clip, t, local);
+				buildPalette(skeleton, clip, local, rig->globalInverseTransform, palette.data(), globals);
+				t = t + 0.37f >= clip.duration ? 0.5f : t + 0.37f;
+			}
+			doNotOptimize(palette[0]);
+			state.setItemsPerIteration(rig->boneCount);
+		});
+	}
+
+	// the shipped rig, loaded once when the benchmark first runs
+	std::shared_ptr<AnimatedModel> man(new AnimatedModel());
+	std::shared_ptr<bool> loaded(new bool(false));
+	suite.add("getPose/man", [man, loaded](MicroBenchmarkState& state) {
+		if (!*loaded && !loadAnimatedModel(ASSET_BENCHMARK_RESOURCES "man/model.dae", *man))
+		{
+			state.skip("can't load man/model.dae");
+			return;
+		}
+		*loaded = true;
+		std::vector<glm::mat4> palette(man->boneCount > 0 ? man->boneCount : 1, glm::mat4(1.0f));
+		glm::mat4 identity(1.0f);
+		float t = man->animation.duration * 0.25f;
+		while (state.keepRunning())
+		{
+			getPose(man->animation, man->skeleton, t, palette, identity, man->globalInverseTransform);
+			t = t + 0.37f >= man->animation.duration ? man->animation.duration * 0.25f : t + 0.37f;
+		}
+		doNotOptimize(palette[0]);
+		state.setLabel(std::to_string(man->boneCount) + " bones");
+		state.setItemsPerIteration(man->boneCount);
+	});
+}
+
+// a grid of side x side vertices, two triangles per cell
+inline void addMeshBenchmarks(MicroBenchmarkSuite& suite, bool gl)
+{
+	const unsigned int sides[] = { 16, 128, 512 };
+	for (unsigned int side : sides)
+	{
+		suite.add("Mesh/" + std::to_string(side * side) + " vertices", [side, gl](MicroBenchmarkState& state) {
+			if (!gl)
+			{
+				state.skip("no GL context");
+				return;
+			}
+			vector<Vertex> vertices(side * side);
+			for (unsigned int y = 0; y < side; y++)
+				for (unsigned int x = 0; x < side; x++)
+				{
+					Vertex& vertex = vertices[y * side + x];
+					vertex = Vertex();
+					vertex.Position = glm::vec3((float)x, 0.0f, (float)y);
+					vertex.Normal = glm::vec3(0.0f, 1.0f, 0.0f);
+					vertex.TexCoords = glm::vec2((float)x / side, (float)y / side);
+				}
+			vector<unsigned int> indices;
+			for (unsigned int y = 0; y + 1 < side; y++)
+				for (unsigned int x = 0; x + 1 < side; x++)
+				{
+					unsigned int i = y * side + x;
+					unsigned int quad[] = { i, i + side, i + 1, i + 1, i + side, i + side + 1 };
+					indices.insert(indices.end(), quad, quad + 6);
+				}
+			while (state.keepRunning())
+			{
+				Mesh mesh(vertices, indices, vector<Texture>());
+				// the upload is part of the construction, the driver may defer it until here
+				glFinish();
+				state.pauseTiming();
+				mesh.deleteBuffers();
+				state.resumeTiming();
+			}
+			state.setItemsPerIteration(side * side);
+		});
+	}
+}
+
+// Model loading end to end on the calling thread only and with the meshes converted on a JobSystem
+inline void addModelBenchmarks(MicroBenchmarkSuite& suite, bool gl, const std::vector<std::string>& models)
+{
+	std::shared_ptr<JobSystem> jobs(new JobSystem());
+	for (const std::string& model : models)
+	{
+		std::string path = ASSET_BENCHMARK_RESOURCES + model;
+		for (int parallel = 0; parallel < 2; parallel++)
+		{
+			std::string name = "Model/" + model + (parallel ? "/jobs" : "/serial");
+			suite.add(name, [path, gl, parallel, jobs](MicroBenchmarkState& state) {
+				if (!gl)
+				{
+					state.skip("no GL context");
+					return;
+				}
+				unsigned int meshCount = 0;
+				while (state.keepRunning())
+				{
+					Model loaded(path, false, true, nullptr, parallel ? jobs.get() : nullptr);
+					glFinish();
+					state.pauseTiming();
+					meshCount = (unsigned int)loaded.meshes.size();
+					for (Mesh& mesh : loaded.meshes)
+						mesh.deleteBuffers();
+					for (const Texture& texture : loaded.textures_loaded)
+						glDeleteTextures(1, &texture.id);
+					state.resumeTiming();
+				}
+				state.setLabel(std::to_string(meshCount) + " meshes" + (parallel ? ", " + std::to_string(jobs->threadCount()) + " threads" : ""));
+			});
+		}
+	}
+}
+
+// runs the benchmarks whose names contain filter, returns the process exit code
+inline int runMicroBenchmarks(const std::string& filter, const std::string& jsonPath)
+{
+	// the zones in getPose and loadModel would be timed along with them
+	Profiler& profiler = Profiler::instance();
+	bool profiling = profiler.enabled.load();
+	profiler.enabled.store(false);
+
+	// GL only for the cases that need it
+	GLFWwindow* window = nullptr;
+	if (glfwInit())
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(64, 64, "microbenchmarks", NULL, NULL);
+		if (window)
+			glfwMakeContextCurrent(window);
+		if (window && !gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+		{
+			glfwDestroyWindow(window);
+			window = nullptr;
+		}
+	}
+	bool gl = window != nullptr;
+	if (!gl)
+		std::cout << "no GL context, the GL benchmarks are skipped" << std::endl;
+
+	MicroBenchmarkSuite suite;
+	addImportBenchmarks(suite, { "ball.FBX", "crystal.FBX", "ground.FBX", "teapot.FBX", "wineglass.FBX", "roling_stone.fbx", "man/model.dae" });
+	addImageBenchmarks(suite, { "brickwall.jpg", "brickwall_normal.jpg", "checker.jpg", "metalnormal.jpg", "barrel/barrel.png", "lantern/lantern.png", "man/diffuse.png" });
+	addMipBenchmarks(suite, gl);
+	addPoseBenchmarks(suite);
+	addMeshBenchmarks(suite, gl);
+	addModelBenchmarks(suite, gl, { "ground.FBX", "snake-ground/source/snake game final 1.fbx" });
+
+	MicroBenchmarkSuite::printHeader();
+	suite.run(filter);
+
+	bool written = true;
+	if (!jsonPath.empty())
+	{
+		std::vector<std::pair<std::string, std::string>> context;
+		context.push_back(std::make_pair("renderer", gl ? (const char*)glGetString(GL_RENDERER) : "none"));
+#ifdef MIPGEN_SSE2
+		context.push_back(std::make_pair("mipgen", "sse2"));
+#else
+		context.push_back(std::make_pair("mipgen", "scalar"));
+#endif
+		context.push_back(std::make_pair("minSeconds", std::to_string(suite.minSeconds)));
+		context.push_back(std::make_pair("repetitions", std::to_string(suite.repetitions)));
+		context.push_back(std::make_pair("filter", filter));
+		written = suite.writeJson(jsonPath, context);
+	}
+
+	if (window)
+		glfwDestroyWindow(window);
+	glfwTerminate();
+	profiler.enabled.store(profiling);
+	return written ? 0 : 1;
+}
+#endif
@@ -0,0 +1,322 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Texture atlas for small textures. Images are placed with a skyline packer (bottom-left rule) and surrounded
+// by a gutter of repeated edge texels. Every rectangle starts and ends on a multiple of 2^(ATLAS_MIP_LEVELS-1)
+// texels and the gutter is that wide, so down to the last mip level of the atlas (GL_TEXTURE_MAX_LEVEL is
+// clamped to it) a texel never mixes two images and bilinear filtering at an image's border only reads gutter.
+// An atlas can have several layers (e.g. diffuse + normal) that share one layout, one GL texture per layer.
+// Atlases are packed at runtime. --build-atlas saves the ones a model ends up with as .atlas files, later runs
+// load those instead of reading the textures back and packing them again (see Model::atlasSmallTextures).
+
+#define ATLAS_MIP_LEVELS 4
+
+struct AtlasRegion {
+	int x = 0, y = 0;				// first texel of the image, gutter not included
+	int width = 0, height = 0;
+	glm::vec2 uvScale = glm::vec2(1.0f);
+	glm::vec2 uvOffset = glm::vec2(0.0f);	// atlas uv = uv * uvScale + uvOffset
+	std::string name;				// what was packed there, a loaded atlas is matched to its sources by it
+};
+
+class SkylinePacker
+{
+public:
+	SkylinePacker(int width = 0, int height = 0)
+	{
+		reset(width, height);
+	}
+
+	void reset(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+		skyline.assign(1, Segment{ 0, 0, width });
+		usedArea = 0;
+	}
+
+	// finds the lowest (then leftmost) spot for a w x h rectangle, false if it doesn't fit anymore
+	bool insert(int w, int h, int& x, int& y)
+	{
+		int bestIndex = -1, bestY = height, bestX = 0;
+		for (size_t i = 0; i < skyline.size(); i++)
+		{
+			int top = fit(i, w, h);
+			if (top >= 0 && top < bestY)
+			{
+				bestIndex = (int)i;
+				bestY = top;
+				bestX = skyline[i].x;
+			}
+		}
+		if (bestIndex < 0)
+			return false;
+		x = bestX;
+		y = bestY;
+		place(bestIndex, x, y, w, h);
+		usedArea += (long long)w * h;
+		return true;
+	}
+
+	// fraction of the area covered by rectangles (gutters included)
+	float occupancy() const
+	{
+		return width > 0 && height > 0 ? (float)usedArea / ((float)width * height) : 0.0f;
+	}
+
+private:
+	struct Segment {
+		int x, y, width;
+	};
+	int width = 0, height = 0;
+	std::vector<Segment> skyline;
+	long long usedArea = 0;
+
+	// y the rectangle would rest at when its left edge is at segment index, -1 if it sticks out
+	int fit(size_t index, int w, int h) const
+	{
+		if (skyline[index].x + w > width)
+			return -1;
+		int y = 0, left = w;
+		for (size_t i = index; left > 0; i++)
+		{
+			if (i == skyline.size())
+				return -1;
+			y = std::max(y, skyline[i].y);
+			if (y + h > height)
+				return -1;
+			left -= skyline[i].width;
+		}
+		return y;
+	}
+
+	void place(int index, int x, int y, int w, int h)
+	{
+		skyline.insert(skyline.begin() + index, Segment{ x, y + h, w });
+		// the new segment covers the start of the following ones
+		for (size_t i = index + 1; i < skyline.size(); )
+		{
+			int end = skyline[i - 1].x + skyline[i - 1].width;
+			if (skyline[i].x >= end)
+				break;
+			int shrink = end - skyline[i].x;
+			skyline[i].x += shrink;
+			skyline[i].width -= shrink;
+			if (skyline[i].width > 0)
+				break;
+			skyline.erase(skyline.begin() + i);
+		}
+		for (size_t i = 0; i + 1 < skyline.size(); )
+		{
+			if (skyline[i].y == skyline[i + 1].y)
+			{
+				skyline[i].width += skyline[i + 1].width;
+				skyline.erase(skyline.begin() + i + 1);
+			}
+			else
+				i++;
+		}
+	}
+};
+
+class TextureAtlas
+{
+public:
+	static const int GUTTER = 1 << (ATLAS_MIP_LEVELS - 1);
+
+	int width = 0, height = 0;
+	// RGBA8 level 0 of every layer, width * height * 4 bytes each
+	std::vector<std::vector<unsigned char>> pixels;
+	std::vector<AtlasRegion> regions;
+	// GL texture of every layer, 0 until upload()
+	std::vector<unsigned int> textures;
+	// file name the atlas is saved under
+	std::string name;
+
+	TextureAtlas(int width = 2048, int height = 2048, int layers = 1)
+	{
+		create(width, height, layers);
+	}
+
+	TextureAtlas(const TextureAtlas&) = delete;
+	TextureAtlas& operator=(const TextureAtlas&) = delete;
+
+	~TextureAtlas()
+	{
+		release();
+	}
+
+	// adds an image to every layer (layerPixels[i] is RGBA8, w x h), returns the region index or -1 if full
+	int add(const std::vector<const unsigned char*>& layerPixels, int w, int h, const std::string& name = "")
+	{
+		int paddedW = align(w + 2 * GUTTER), paddedH = align(h + 2 * GUTTER);
+		int x, y;
+		if (layerPixels.size() != pixels.size() || !packer.insert(paddedW, paddedH, x, y))
+			return -1;
+		for (size_t layer = 0; layer < pixels.size(); layer++)
+		{
+			// the image with clamped coordinates over the whole padded rectangle, which fills the gutter
+			// with its edge texels
+			unsigned char* target = &pixels[layer][0];
+			for (int py = 0; py < paddedH; py++)
+			{
+				int sy = std::min(std::max(py - GUTTER, 0), h - 1);
+				for (int px = 0; px < paddedW; px++)
+				{
+					int sx = std::min(std::max(px - GUTTER, 0), w - 1);
+					const unsigned char* s = layerPixels[layer] + ((size_t)sy * w + sx) * 4;
+					unsigned char* d = target + ((size_t)(y + py) * width + x + px) * 4;
+					d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3];
+				}
+			}
+		}
+		imageArea += (long long)w * h;
+		AtlasRegion region;
+		region.x = x + GUTTER;
+		region.y = y + GUTTER;
+		region.width = w;
+		region.height = h;
+		region.uvScale = glm::vec2((float)w / width, (float)h / height);
+		region.uvOffset = glm::vec2((float)region.x / width, (float)region.y / height);
+		region.name = name;
+		regions.push_back(region);
+		return (int)regions.size() - 1;
+	}
+
+	// fraction of the atlas covered by images, without the gutters and alignment
+	float occupancy() const
+	{
+		return (float)imageArea / ((float)width * height);
+	}
+
+	// fraction covered including gutters, i.e. how full the packer is
+	float packedOccupancy() const
+	{
+		return packer.occupancy();
+	}
+
+	// creates (or updates) one GL texture per layer, mips stop at ATLAS_MIP_LEVELS so they never mix images
+	void upload()
+	{
+		textures.resize(pixels.size(), 0);
+		for (size_t layer = 0; layer < pixels.size(); layer++)
+		{
+			if (!textures[layer])
+				glGenTextures(1, &textures[layer]);
+			glBindTexture(GL_TEXTURE_2D, textures[layer]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[layer][0]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ATLAS_MIP_LEVELS - 1);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// .atlas file: "ATL2", width, height, layer count, region count, the regions (x, y, width, height, name length,
+	// name), then level 0 of every layer
+	bool save(const std::string& path) const
+	{
+		std::ofstream file(path.c_str(), std::ios::binary);
+		if (!file)
+		{
+			std::cout << "ERROR::ATLAS::FILE_NOT_WRITTEN: " << path << std::endl;
+			return false;
+		}
+		int header[4] = { width, height, (int)pixels.size(), (int)regions.size() };
+		file.write("ATL2", 4);
+		file.write((const char*)header, sizeof(header));
+		for (const AtlasRegion& region : regions)
+		{
+			int r[5] = { region.x, region.y, region.width, region.height, (int)region.name.size() };
+			file.write((const char*)r, sizeof(r));
+			file.write(region.name.data(), region.name.size());
+		}
+		for (const std::vector<unsigned char>& layer : pixels)
+			file.write((const char*)&layer[0], layer.size());
+		return (bool)file;
+	}
+
+	// the packer's free space isn't saved, a loaded atlas counts as full and add() returns -1
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary);
+		char magic[4] = {};
+		int header[4] = {};
+		file.read(magic, 4);
+		file.read((char*)header, sizeof(header));
+		if (!file || std::string(magic, 4) != "ATL2" || header[0] <= 0 || header[1] <= 0 || header[2] <= 0 || header[3] < 0)
+		{
+			std::cout << "ERROR::ATLAS::FILE_NOT_READ: " << path << std::endl;
+			return false;
+		}
+		release();
+		create(header[0], header[1], header[2]);
+		packer.reset(0, 0);
+		for (int i = 0; i < header[3] && file; i++)
+		{
+			int r[5] = {};
+			file.read((char*)r, sizeof(r));
+			if (r[4] < 0 || r[4] > 4096)
+				break;
+			AtlasRegion region;
+			region.x = r[0]; region.y = r[1]; region.width = r[2]; region.height = r[3];
+			region.name.resize(r[4]);
+			if (r[4] > 0)
+				file.read(&region.name[0], r[4]);
+			region.uvScale = glm::vec2((float)region.width / width, (float)region.height / height);
+			region.uvOffset = glm::vec2((float)region.x / width, (float)region.y / height);
+			regions.push_back(region);
+			imageArea += (long long)region.width * region.height;
+		}
+		for (std::vector<unsigned char>& layer : pixels)
+		{
+			if (file)
+				file.read((char*)&layer[0], layer.size());
+		}
+		if (!file || (int)regions.size() != header[3])
+		{
+			std::cout << "ERROR::ATLAS::FILE_TRUNCATED: " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	SkylinePacker packer;
+	long long imageArea = 0;
+
+	static int align(int size)
+	{
+		return (size + GUTTER - 1) / GUTTER * GUTTER;
+	}
+
+	void create(int width, int height, int layers)
+	{
+		this->width = width;
+		this->height = height;
+		pixels.assign(layers, std::vector<unsigned char>((size_t)width * height * 4, 0));
+		regions.clear();
+		packer.reset(width, height);
+		imageArea = 0;
+	}
+
+	void release()
+	{
+		for (unsigned int texture : textures)
+			glDeleteTextures(1, &texture);
+		textures.clear();
+	}
+};
+#endif
@@ -0,0 +1,21 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec3 surfaceNormal;
+
+uniform sampler2D diffuseMap;
+//direction towards the light, the crowd is small next to its distance
+uniform vec3 lightDirection;
+
+void main()
+{
+    vec3 color = texture(diffuseMap, TexCoords).rgb;
+    // Ambient
+    vec3 ambient = 0.2 * color;
+    // Diffuse
+    float diff = max(dot(normalize(surfaceNormal), normalize(lightDirection)), 0.0);
+    vec3 diffuse = diff * color;
+
+    FragColor = vec4(ambient + diffuse, 1.0f);
+}
@@ -0,0 +1,71 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec4 aBoneIds;
+layout (location = 4) in vec4 aBoneWeights;
+//per instance
+layout (location = 5) in mat4 instanceModel;
+layout (location = 9) in float instanceTimeOffset;
+
+out vec2 TexCoords;
+out vec3 surfaceNormal;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+//baked clip, see anim_bake.h for the layout
+uniform sampler2D bakedAnimation;
+uniform bool bakedVertices;
+uniform int frameCount;
+uniform float frameRate;
+uniform float time;
+
+//affine bone matrix of one frame, stored as its first three rows
+mat4 fetchBone(int bone, int frame)
+{
+    vec4 r0 = texelFetch(bakedAnimation, ivec2(bone * 3, frame), 0);
+    vec4 r1 = texelFetch(bakedAnimation, ivec2(bone * 3 + 1, frame), 0);
+    vec4 r2 = texelFetch(bakedAnimation, ivec2(bone * 3 + 2, frame), 0);
+    return transpose(mat4(r0, r1, r2, vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+mat4 skinAt(int frame)
+{
+    mat4 skin = fetchBone(int(aBoneIds.x), frame) * aBoneWeights.x
+              + fetchBone(int(aBoneIds.y), frame) * aBoneWeights.y
+              + fetchBone(int(aBoneIds.z), frame) * aBoneWeights.z
+              + fetchBone(int(aBoneIds.w), frame) * aBoneWeights.w;
+    float total = aBoneWeights.x + aBoneWeights.y + aBoneWeights.z + aBoneWeights.w;
+    return total > 0.0 ? skin : mat4(1.0);
+}
+
+void main()
+{
+    //blend between the two baked frames around the current time
+    float frame = mod((time + instanceTimeOffset) * frameRate, float(frameCount));
+    int frame0 = int(floor(frame));
+    int frame1 = (frame0 + 1) % frameCount;
+    float blend = fract(frame);
+
+    vec3 position;
+    vec3 normal;
+    if (bakedVertices)
+    {
+        position = mix(texelFetch(bakedAnimation, ivec2(gl_VertexID, frame0 * 2), 0).xyz,
+                       texelFetch(bakedAnimation, ivec2(gl_VertexID, frame1 * 2), 0).xyz, blend);
+        normal = mix(texelFetch(bakedAnimation, ivec2(gl_VertexID, frame0 * 2 + 1), 0).xyz,
+                     texelFetch(bakedAnimation, ivec2(gl_VertexID, frame1 * 2 + 1), 0).xyz, blend);
+    }
+    else
+    {
+        mat4 skin = skinAt(frame0) * (1.0 - blend) + skinAt(frame1) * blend;
+        position = vec3(skin * vec4(aPos, 1.0));
+        normal = mat3(skin) * aNormal;
+    }
+
+    vec4 worldPosition = instanceModel * vec4(position, 1.0);
+    TexCoords = aTexCoords;
+    gl_Position = projection * view * worldPosition;
+    surfaceNormal = (instanceModel * vec4(normal, 0.0)).xyz;
+}
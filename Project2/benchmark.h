@@ -0,0 +1,199 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json_escape.h"
+
+// Frame timings of a run along a camera path: CPU wall time per frame and GPU time per frame from GL_TIME_ELAPSED
+// queries. The first warmupFrames are left out of the statistics (shader compiles, first uploads, streaming
+// catching up). A frame that takes more than STUTTER_FACTOR times the median counts as a stutter.
+// Runs are comparable across commits as long as the path, frame count, timestep, resolution and settings match,
+// all of which are written into the json next to the timings.
+
+#define BENCHMARK_STUTTER_FACTOR 2.0
+
+struct FrameTimeSummary {
+	unsigned int frames = 0;
+	double average = 0.0;
+	double min = 0.0;
+	double max = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+	unsigned int stutters = 0;
+};
+
+// nearest rank percentiles of the frame times from the first one on
+inline FrameTimeSummary summarizeFrameTimes(const std::vector<double>& milliseconds, unsigned int first = 0)
+{
+	FrameTimeSummary summary;
+	if (first >= milliseconds.size())
+		return summary;
+	std::vector<double> sorted(milliseconds.begin() + first, milliseconds.end());
+	std::sort(sorted.begin(), sorted.end());
+	auto percentile = [&](double p) {
+		size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+	};
+	summary.frames = (unsigned int)sorted.size();
+	summary.min = sorted.front();
+	summary.max = sorted.back();
+	summary.p50 = percentile(50.0);
+	summary.p95 = percentile(95.0);
+	summary.p99 = percentile(99.0);
+	for (double ms : sorted)
+	{
+		summary.average += ms;
+		if (ms > summary.p50 * BENCHMARK_STUTTER_FACTOR)
+			summary.stutters++;
+	}
+	summary.average /= sorted.size();
+	return summary;
+}
+
+// GL_TIME_ELAPSED around every frame. the queries go round a ring, a result is read once it is available, so
+// timing a frame never waits for the GPU unless the ring is full
+class GpuFrameTimer
+{
+public:
+	static const unsigned int RING_SIZE = 4;
+	// GPU time of every frame that finished, in frame order
+	std::vector<double> milliseconds;
+
+	GpuFrameTimer() {}
+	GpuFrameTimer(const GpuFrameTimer&) = delete;
+	GpuFrameTimer& operator=(const GpuFrameTimer&) = delete;
+
+	~GpuFrameTimer()
+	{
+		release();
+	}
+
+	// deletes the queries, results that weren't read are lost. begin() makes new ones
+	void release()
+	{
+		if (queries[0])
+			glDeleteQueries(RING_SIZE, queries);
+		for (unsigned int i = 0; i < RING_SIZE; i++)
+			queries[i] = 0;
+		retired = issued;
+	}
+
+	void begin()
+	{
+		if (!queries[0])
+			glGenQueries(RING_SIZE, queries);
+		collect(issued - retired >= RING_SIZE);
+		glBeginQuery(GL_TIME_ELAPSED, queries[issued % RING_SIZE]);
+	}
+
+	void end()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		issued++;
+	}
+
+	// reads the results that are there, with wait all of them
+	void collect(bool wait = false)
+	{
+		while (retired < issued)
+		{
+			unsigned int query = queries[retired % RING_SIZE];
+			if (!wait)
+			{
+				GLint available = 0;
+				glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+					return;
+			}
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+			milliseconds.push_back(nanoseconds / 1000000.0);
+			retired++;
+		}
+	}
+
+private:
+	unsigned int queries[RING_SIZE] = {};
+	unsigned int issued = 0;
+	unsigned int retired = 0;
+};
+
+struct BenchmarkRun {
+	std::string path;		// camera path file, or the name of the scripted one
+	unsigned int warmupFrames = 30;
+	float timestep = 0.0f;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::string renderer;
+	// features that change the timings, name -> value
+	std::vector<std::pair<std::string, std::string>> settings;
+	std::vector<double> cpuMilliseconds;
+	std::vector<double> gpuMilliseconds;
+
+	void print() const
+	{
+		printSummary("cpu", summarizeFrameTimes(cpuMilliseconds, warmupFrames));
+		printSummary("gpu", summarizeFrameTimes(gpuMilliseconds, warmupFrames));
+	}
+
+	bool writeJson(const std::string& file) const
+	{
+		FILE* out = fopen(file.c_str(), "w");
+		if (!out)
+		{
+			std::cout << "ERROR::BENCHMARK::FILE_NOT_WRITTEN " << file << std::endl;
+			return false;
+		}
+		fprintf(out, "{\n");
+		fprintf(out, "  \"path\": \"%s\",\n", jsonEscaped(path).c_str());
+		fprintf(out, "  \"renderer\": \"%s\",\n", jsonEscaped(renderer).c_str());
+		fprintf(out, "  \"width\": %u,\n  \"height\": %u,\n", width, height);
+		fprintf(out, "  \"timestep\": %.6f,\n", timestep);
+		fprintf(out, "  \"warmupFrames\": %u,\n", warmupFrames);
+		fprintf(out, "  \"stutterFactor\": %.2f,\n", BENCHMARK_STUTTER_FACTOR);
+		fprintf(out, "  \"settings\": {");
+		for (size_t i = 0; i < settings.size(); i++)
+			fprintf(out, "%s\n    \"%s\": \"%s\"", i ? "," : "", jsonEscaped(settings[i].first).c_str(), jsonEscaped(settings[i].second).c_str());
+		fprintf(out, "\n  },\n");
+		writeSummary(out, "cpu", summarizeFrameTimes(cpuMilliseconds, warmupFrames));
+		writeSummary(out, "gpu", summarizeFrameTimes(gpuMilliseconds, warmupFrames));
+		writeTimes(out, "cpuFrameTimes", cpuMilliseconds, false);
+		writeTimes(out, "gpuFrameTimes", gpuMilliseconds, true);
+		fprintf(out, "}\n");
+		fclose(out);
+		return true;
+	}
+
+private:
+	static void printSummary(const char* name, const FrameTimeSummary& summary)
+	{
+		std::cout << name << ": " << summary.frames << " frames, average " << summary.average << " ms, p50 " << summary.p50 << " ms, p95 "
+			<< summary.p95 << " ms, p99 " << summary.p99 << " ms, min " << summary.min << " ms, max " << summary.max << " ms, stutters "
+			<< summary.stutters << std::endl;
+	}
+
+	static void writeSummary(FILE* out, const char* name, const FrameTimeSummary& summary)
+	{
+		fprintf(out, "  \"%s\": { \"frames\": %u, \"average\": %.4f, \"min\": %.4f, \"max\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"stutters\": %u },\n",
+			name, summary.frames, summary.average, summary.min, summary.max, summary.p50, summary.p95, summary.p99, summary.stutters);
+	}
+
+	static void writeTimes(FILE* out, const char* name, const std::vector<double>& milliseconds, bool last)
+	{
+		fprintf(out, "  \"%s\": [", name);
+		for (size_t i = 0; i < milliseconds.size(); i++)
+			fprintf(out, "%s%.4f", i ? ", " : "", milliseconds[i]);
+		fprintf(out, "]%s\n", last ? "" : ",");
+	}
+};
+#endif
@@ -0,0 +1,136 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cstddef>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BOUNDS_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+// axis aligned bounding box, starts out empty (min > max)
+struct AABB {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	bool valid() const
+	{
+		return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+	}
+	glm::vec3 center() const
+	{
+		return (min + max) * 0.5f;
+	}
+	glm::vec3 extents() const
+	{
+		return (max - min) * 0.5f;
+	}
+	void expand(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+	void expand(const AABB& other)
+	{
+		if (!other.valid())
+			return;
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+	// box around this box after transforming it, e.g. into world space with a model matrix
+	AABB transformed(const glm::mat4& m) const
+	{
+		AABB result;
+		if (!valid())
+			return result;
+		// Arvo's method: the new extents are the old ones through the absolute rotation/scale part
+		glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.0f));
+		glm::vec3 e = extents();
+		glm::vec3 r = glm::abs(glm::vec3(m[0])) * e.x + glm::abs(glm::vec3(m[1])) * e.y + glm::abs(glm::vec3(m[2])) * e.z;
+		result.min = c - r;
+		result.max = c + r;
+		return result;
+	}
+};
+
+struct BoundingSphere {
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+};
+
+// min/max over the positions of count vertices. stride is the distance between two positions in bytes,
+// so this works directly on interleaved vertex arrays like vector<Vertex>
+inline AABB computeAABB(const void* positions, size_t count, size_t stride)
+{
+	AABB box;
+	const char* p = (const char*)positions;
+#ifdef BOUNDS_USE_SSE
+	if (count > 0)
+	{
+		// two running min/max pairs hide the latency of minps/maxps. a 16 byte load also picks up the
+		// float after the position, the fourth lane is ignored; the last vertex is read with 3 loads so
+		// nothing past the end of the array is touched
+		__m128 min0 = _mm_set1_ps(FLT_MAX), min1 = min0;
+		__m128 max0 = _mm_set1_ps(-FLT_MAX), max1 = max0;
+		size_t i = 0;
+		for (; i + 2 < count; i += 2)
+		{
+			__m128 a = _mm_loadu_ps((const float*)(p + i * stride));
+			__m128 b = _mm_loadu_ps((const float*)(p + (i + 1) * stride));
+			min0 = _mm_min_ps(min0, a);
+			max0 = _mm_max_ps(max0, a);
+			min1 = _mm_min_ps(min1, b);
+			max1 = _mm_max_ps(max1, b);
+		}
+		for (; i < count; i++)
+		{
+			const float* f = (const float*)(p + i * stride);
+			__m128 a = _mm_set_ps(0.0f, f[2], f[1], f[0]);
+			min0 = _mm_min_ps(min0, a);
+			max0 = _mm_max_ps(max0, a);
+		}
+		float mn[4], mx[4];
+		_mm_storeu_ps(mn, _mm_min_ps(min0, min1));
+		_mm_storeu_ps(mx, _mm_max_ps(max0, max1));
+		box.min = glm::vec3(mn[0], mn[1], mn[2]);
+		box.max = glm::vec3(mx[0], mx[1], mx[2]);
+	}
+#else
+	for (size_t i = 0; i < count; i++)
+		box.expand(*(const glm::vec3*)(p + i * stride));
+#endif
+	return box;
+}
+
+// sphere around the box center, with the radius of the farthest point (tighter than the box's half diagonal)
+inline BoundingSphere computeBoundingSphere(const void* positions, size_t count, size_t stride, const AABB& box)
+{
+	BoundingSphere sphere;
+	if (!box.valid())
+		return sphere;
+	sphere.center = box.center();
+	const char* p = (const char*)positions;
+	float radiusSquared = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 d = *(const glm::vec3*)(p + i * stride) - sphere.center;
+		radiusSquared = glm::max(radiusSquared, glm::dot(d, d));
+	}
+	sphere.radius = glm::sqrt(radiusSquared);
+	return sphere;
+}
+
+inline BoundingSphere sphereFromAABB(const AABB& box)
+{
+	BoundingSphere sphere;
+	if (box.valid())
+	{
+		sphere.center = box.center();
+		sphere.radius = glm::length(box.extents());
+	}
+	return sphere;
+}
+#endif
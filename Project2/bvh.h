@@ -0,0 +1,506 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "frustum.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Bounding volume hierarchy over the world space boxes of scene objects (mesh instances). Built top-down
+// with a binned surface area heuristic; when objects move, refit() updates the boxes without rebuilding.
+// Nodes are 32 bytes and stored depth-first in one array, the two children of a node are always next to
+// each other, so a traversal walks mostly forward through memory. The item boxes are also kept as an AABBBatch
+// in leaf order, so the items of a leaf the frustum cuts through are tested with the SIMD cullBatch().
+
+struct BVHNode {
+	glm::vec3 min;
+	unsigned int leftFirst;		// inner node: index of the left child (right is leftFirst + 1), leaf: first entry in itemIndices
+	glm::vec3 max;
+	unsigned int count;			// number of items in a leaf, 0 for inner nodes
+
+	bool isLeaf() const
+	{
+		return count > 0;
+	}
+};
+
+class BVH
+{
+public:
+	std::vector<BVHNode> nodes;
+	// items referenced by the leaves, each leaf owns a contiguous range
+	std::vector<unsigned int> itemIndices;
+	// world space box of every item, as passed to build()/refit()
+	std::vector<AABB> itemBounds;
+	// itemBounds in itemIndices order, a leaf's items are the batch entries [leftFirst, leftFirst + count)
+	AABBBatch leafItems;
+
+	// builds the tree from scratch, item i is the object with box items[i]
+	void build(const std::vector<AABB>& items)
+	{
+		itemBounds = items;
+		nodes.clear();
+		itemIndices.resize(items.size());
+		centroids.resize(items.size());
+		for (unsigned int i = 0; i < items.size(); i++)
+		{
+			itemIndices[i] = i;
+			centroids[i] = items[i].center();
+		}
+		leafItems.clear();
+		if (items.empty())
+			return;
+
+		nodes.reserve(items.size() * 2);
+		BVHNode root;
+		root.leftFirst = 0;
+		root.count = (unsigned int)items.size();
+		nodes.push_back(root);
+		updateNodeBounds(0);
+		subdivide(0);
+		fillLeafItems();
+	}
+
+	// updates the boxes of moved items and all nodes above them, keeping the topology. cheap, but the tree gets
+	// worse the further objects move from where they were at build time
+	void refit(const std::vector<AABB>& items)
+	{
+		itemBounds = items;
+		// children are always stored after their parent, so walking backwards visits them first
+		for (int i = (int)nodes.size() - 1; i >= 0; i--)
+		{
+			BVHNode& node = nodes[i];
+			if (node.isLeaf())
+			{
+				updateNodeBounds(i);
+				continue;
+			}
+			const BVHNode& left = nodes[node.leftFirst];
+			const BVHNode& right = nodes[node.leftFirst + 1];
+			node.min = glm::min(left.min, right.min);
+			node.max = glm::max(left.max, right.max);
+		}
+		fillLeafItems();
+	}
+
+	// appends every item that intersects the frustum. subtrees completely inside are taken without testing
+	// their items, subtrees completely outside are skipped. not const, the SIMD test writes to a scratch buffer
+	void cull(const Frustum& frustum, std::vector<unsigned int>& visible)
+	{
+		if (nodes.empty())
+			return;
+		unsigned int stack[STACK_SIZE];
+		unsigned int stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const BVHNode& node = nodes[stack[--stackSize]];
+			FrustumTest test = classify(frustum, nodeBox(node));
+			if (test == FRUSTUM_OUTSIDE)
+				continue;
+			if (test == FRUSTUM_INSIDE)
+			{
+				appendSubtree(node, visible);
+				continue;
+			}
+			if (node.isLeaf())
+			{
+				// cullBatch() starts on a multiple of 8, so a few boxes before the leaf are tested too
+				unsigned int end = node.leftFirst + node.count;
+				cullBatch(frustum, leafItems, node.leftFirst & ~7u, end, &leafVisible[0]);
+				for (unsigned int i = node.leftFirst; i < end; i++)
+				{
+					if (leafVisible[i])
+						visible.push_back(itemIndices[i]);
+				}
+				continue;
+			}
+			stack[stackSize++] = node.leftFirst + 1;
+			stack[stackSize++] = node.leftFirst;
+		}
+	}
+
+	// closest item whose box the ray hits, -1 if none. t receives the distance along direction to the box
+	int raycast(const glm::vec3& origin, const glm::vec3& direction, float& t, float maxDistance = FLT_MAX) const
+	{
+		int hit = -1;
+		t = maxDistance;
+		if (nodes.empty())
+			return hit;
+		glm::vec3 invDirection = 1.0f / direction;
+		unsigned int stack[STACK_SIZE];
+		unsigned int stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const BVHNode& node = nodes[stack[--stackSize]];
+			if (intersectRay(origin, invDirection, node.min, node.max) >= t)
+				continue;
+			if (node.isLeaf())
+			{
+				for (unsigned int i = 0; i < node.count; i++)
+				{
+					unsigned int item = itemIndices[node.leftFirst + i];
+					float d = intersectRay(origin, invDirection, itemBounds[item].min, itemBounds[item].max);
+					if (d < t)
+					{
+						t = d;
+						hit = (int)item;
+					}
+				}
+				continue;
+			}
+			// visit the nearer child first so the farther one is more likely to be pruned
+			const BVHNode& left = nodes[node.leftFirst];
+			const BVHNode& right = nodes[node.leftFirst + 1];
+			float dl = intersectRay(origin, invDirection, left.min, left.max);
+			float dr = intersectRay(origin, invDirection, right.min, right.max);
+			if (dl < dr)
+			{
+				stack[stackSize++] = node.leftFirst + 1;
+				stack[stackSize++] = node.leftFirst;
+			}
+			else
+			{
+				stack[stackSize++] = node.leftFirst;
+				stack[stackSize++] = node.leftFirst + 1;
+			}
+		}
+		return hit;
+	}
+
+	// item whose box is closest to point, -1 for an empty tree
+	int nearest(const glm::vec3& point, float& distance) const
+	{
+		int best = -1;
+		float bestSquared = FLT_MAX;
+		if (nodes.empty())
+		{
+			distance = FLT_MAX;
+			return best;
+		}
+		unsigned int stack[STACK_SIZE];
+		unsigned int stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const BVHNode& node = nodes[stack[--stackSize]];
+			if (distanceSquared(point, node.min, node.max) >= bestSquared)
+				continue;
+			if (node.isLeaf())
+			{
+				for (unsigned int i = 0; i < node.count; i++)
+				{
+					unsigned int item = itemIndices[node.leftFirst + i];
+					float d = distanceSquared(point, itemBounds[item].min, itemBounds[item].max);
+					if (d < bestSquared)
+					{
+						bestSquared = d;
+						best = (int)item;
+					}
+				}
+				continue;
+			}
+			const BVHNode& left = nodes[node.leftFirst];
+			const BVHNode& right = nodes[node.leftFirst + 1];
+			bool leftFirst = distanceSquared(point, left.min, left.max) < distanceSquared(point, right.min, right.max);
+			stack[stackSize++] = leftFirst ? node.leftFirst + 1 : node.leftFirst;
+			stack[stackSize++] = leftFirst ? node.leftFirst : node.leftFirst + 1;
+		}
+		distance = glm::sqrt(bestSquared);
+		return best;
+	}
+
+	// distance to the ray's entry point into the box, FLT_MAX on a miss
+	static float intersectRay(const glm::vec3& origin, const glm::vec3& invDirection, const glm::vec3& bmin, const glm::vec3& bmax)
+	{
+		glm::vec3 t1 = (bmin - origin) * invDirection;
+		glm::vec3 t2 = (bmax - origin) * invDirection;
+		glm::vec3 tmin = glm::min(t1, t2);
+		glm::vec3 tmax = glm::max(t1, t2);
+		float enter = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.0f));
+		float exit = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+		return enter <= exit ? enter : FLT_MAX;
+	}
+
+	static float distanceSquared(const glm::vec3& point, const glm::vec3& bmin, const glm::vec3& bmax)
+	{
+		glm::vec3 d = glm::max(glm::max(bmin - point, point - bmax), glm::vec3(0.0f));
+		return glm::dot(d, d);
+	}
+
+private:
+	static const unsigned int BIN_COUNT = 12;
+	static const unsigned int MAX_LEAF_SIZE = 4;
+	// nodes this deep become leaves whatever their size. a traversal pops one node and pushes its two children,
+	// so it never holds more than one pending sibling per level plus the two children: MAX_DEPTH + 1 entries
+	static const unsigned int MAX_DEPTH = 63;
+	static const unsigned int STACK_SIZE = MAX_DEPTH + 1;
+	std::vector<glm::vec3> centroids;
+	// result of cullBatch() on leafItems
+	std::vector<unsigned char> leafVisible;
+
+	void fillLeafItems()
+	{
+		leafItems.clear();
+		for (unsigned int item : itemIndices)
+			leafItems.add(itemBounds[item]);
+		leafVisible.resize(leafItems.paddedCount());
+	}
+
+	static AABB nodeBox(const BVHNode& node)
+	{
+		AABB box;
+		box.min = node.min;
+		box.max = node.max;
+		return box;
+	}
+
+	static float surfaceArea(const AABB& box)
+	{
+		if (!box.valid())
+			return 0.0f;
+		glm::vec3 e = box.max - box.min;
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	void updateNodeBounds(unsigned int nodeIndex)
+	{
+		BVHNode& node = nodes[nodeIndex];
+		AABB box;
+		for (unsigned int i = 0; i < node.count; i++)
+			box.expand(itemBounds[itemIndices[node.leftFirst + i]]);
+		node.min = box.min;
+		node.max = box.max;
+	}
+
+	void appendSubtree(const BVHNode& node, std::vector<unsigned int>& visible) const
+	{
+		if (node.isLeaf())
+		{
+			for (unsigned int i = 0; i < node.count; i++)
+				visible.push_back(itemIndices[node.leftFirst + i]);
+			return;
+		}
+		appendSubtree(nodes[node.leftFirst], visible);
+		appendSubtree(nodes[node.leftFirst + 1], visible);
+	}
+
+	// finds the cheapest split plane with binned SAH, returns false if keeping the node as a leaf is cheaper
+	bool findSplit(const BVHNode& node, int& bestAxis, float& bestPosition)
+	{
+		AABB centroidBox;
+		for (unsigned int i = 0; i < node.count; i++)
+			centroidBox.expand(centroids[itemIndices[node.leftFirst + i]]);
+
+		float bestCost = FLT_MAX;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float lo = centroidBox.min[axis], hi = centroidBox.max[axis];
+			if (lo == hi)
+				continue;
+			AABB binBox[BIN_COUNT];
+			unsigned int binCount[BIN_COUNT] = {};
+			float scale = BIN_COUNT / (hi - lo);
+			for (unsigned int i = 0; i < node.count; i++)
+			{
+				unsigned int item = itemIndices[node.leftFirst + i];
+				unsigned int bin = std::min(BIN_COUNT - 1, (unsigned int)((centroids[item][axis] - lo) * scale));
+				binCount[bin]++;
+				binBox[bin].expand(itemBounds[item]);
+			}
+			// sweep from both sides to get area and count left/right of every plane between two bins
+			float leftArea[BIN_COUNT - 1], rightArea[BIN_COUNT - 1];
+			unsigned int leftCount[BIN_COUNT - 1], rightCount[BIN_COUNT - 1];
+			AABB leftBox, rightBox;
+			unsigned int leftSum = 0, rightSum = 0;
+			for (unsigned int i = 0; i < BIN_COUNT - 1; i++)
+			{
+				leftSum += binCount[i];
+				leftCount[i] = leftSum;
+				leftBox.expand(binBox[i]);
+				leftArea[i] = surfaceArea(leftBox);
+				rightSum += binCount[BIN_COUNT - 1 - i];
+				rightCount[BIN_COUNT - 2 - i] = rightSum;
+				rightBox.expand(binBox[BIN_COUNT - 1 - i]);
+				rightArea[BIN_COUNT - 2 - i] = surfaceArea(rightBox);
+			}
+			float binWidth = (hi - lo) / BIN_COUNT;
+			for (unsigned int i = 0; i < BIN_COUNT - 1; i++)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+				float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestPosition = lo + binWidth * (i + 1);
+				}
+			}
+		}
+
+		// costs are in item tests weighted by area, visiting an inner node costs about as much as one item
+		float area = surfaceArea(nodeBox(node));
+		float leafCost = node.count * area;
+		return bestCost + area < leafCost || (bestCost < FLT_MAX && node.count > MAX_LEAF_SIZE);
+	}
+
+	void subdivide(unsigned int nodeIndex, unsigned int depth = 0)
+	{
+		if (nodes[nodeIndex].count <= 1 || depth >= MAX_DEPTH)
+			return;
+		int axis = 0;
+		float position = 0.0f;
+		if (!findSplit(nodes[nodeIndex], axis, position))
+			return;
+
+		// partition the node's items around the split plane
+		unsigned int first = nodes[nodeIndex].leftFirst;
+		unsigned int count = nodes[nodeIndex].count;
+		unsigned int i = first;
+		unsigned int j = first + count - 1;
+		while (i <= j && j != (unsigned int)-1)
+		{
+			if (centroids[itemIndices[i]][axis] < position)
+				i++;
+			else
+				std::swap(itemIndices[i], itemIndices[j--]);
+		}
+		unsigned int leftCount = i - first;
+		if (leftCount == 0 || leftCount == count)
+			return;
+
+		// children go to the end of the array, the vector may reallocate so don't keep references across this
+		unsigned int leftChild = (unsigned int)nodes.size();
+		BVHNode left, right;
+		left.leftFirst = first;
+		left.count = leftCount;
+		right.leftFirst = i;
+		right.count = count - leftCount;
+		nodes.push_back(left);
+		nodes.push_back(right);
+		nodes[nodeIndex].leftFirst = leftChild;
+		nodes[nodeIndex].count = 0;
+		updateNodeBounds(leftChild);
+		updateNodeBounds(leftChild + 1);
+		subdivide(leftChild, depth + 1);
+		subdivide(leftChild + 1, depth + 1);
+	}
+};
+
+// world space ray through a pixel, mouse coordinates as glfw reports them (origin top left)
+inline void screenRay(float mouseX, float mouseY, float width, float height, const glm::mat4& projection, const glm::mat4& view,
+	glm::vec3& origin, glm::vec3& direction)
+{
+	glm::mat4 inverse = glm::inverse(projection * view);
+	float x = 2.0f * mouseX / width - 1.0f;
+	float y = 1.0f - 2.0f * mouseY / height;
+	glm::vec4 nearPoint = inverse * glm::vec4(x, y, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverse * glm::vec4(x, y, 1.0f, 1.0f);
+	origin = glm::vec3(nearPoint) / nearPoint.w;
+	direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
+
+// build, refit and query times for a static scene and a scene where objects move every frame
+inline void benchmarkBVH(unsigned int count = 100000)
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> size(0.1f, 5.0f);
+	std::uniform_real_distribution<float> step(-1.0f, 1.0f);
+	std::vector<AABB> items(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		glm::vec3 c(position(rng), position(rng) * 0.1f, position(rng));
+		glm::vec3 e(size(rng), size(rng), size(rng));
+		items[i].min = c - e;
+		items[i].max = c + e;
+	}
+
+	auto ms = [](std::chrono::high_resolution_clock::time_point a, std::chrono::high_resolution_clock::time_point b) {
+		return std::chrono::duration<double, std::milli>(b - a).count();
+	};
+
+	BVH bvh;
+	auto start = std::chrono::high_resolution_clock::now();
+	bvh.build(items);
+	auto stop = std::chrono::high_resolution_clock::now();
+	std::cout << "benchmarkBVH() items=" << count << " nodes=" << bvh.nodes.size() << " (" << bvh.nodes.size() * sizeof(BVHNode) / 1024 << " KB)" << std::endl;
+	std::cout << "  build:  " << ms(start, stop) << " ms" << std::endl;
+
+	glm::mat4 projection = glm::perspective(75.0f, 4.0f / 3.0f, 0.01f, 1500.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = extractFrustum(projection * view);
+	std::vector<unsigned int> visible;
+	const unsigned int queries = 100;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (unsigned int q = 0; q < queries; q++)
+	{
+		visible.clear();
+		bvh.cull(frustum, visible);
+	}
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "  cull:   " << ms(start, stop) / queries << " ms, visible=" << visible.size() << std::endl;
+
+	unsigned int hits = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (unsigned int q = 0; q < 10000; q++)
+	{
+		glm::vec3 origin, direction;
+		screenRay((float)(q % 100) * 12.0f, (float)(q / 100) * 9.0f, 1200.0f, 900.0f, projection, view, origin, direction);
+		float t;
+		if (bvh.raycast(origin, direction, t) >= 0)
+			hits++;
+	}
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "  pick:   " << ms(start, stop) * 1000.0 / 10000 << " us per ray, hits=" << hits << "/10000" << std::endl;
+
+	float distance;
+	start = std::chrono::high_resolution_clock::now();
+	for (unsigned int q = 0; q < 10000; q++)
+		bvh.nearest(glm::vec3(position(rng), 0.0f, position(rng)), distance);
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "  nearest: " << ms(start, stop) * 1000.0 / 10000 << " us per query" << std::endl;
+
+	// dynamic scene: everything moves a little every frame, refit instead of rebuilding
+	const unsigned int frames = 60;
+	double refitTotal = 0.0, cullTotal = 0.0;
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		for (AABB& box : items)
+		{
+			glm::vec3 offset(step(rng), 0.0f, step(rng));
+			box.min += offset;
+			box.max += offset;
+		}
+		start = std::chrono::high_resolution_clock::now();
+		bvh.refit(items);
+		stop = std::chrono::high_resolution_clock::now();
+		refitTotal += ms(start, stop);
+
+		start = std::chrono::high_resolution_clock::now();
+		visible.clear();
+		bvh.cull(frustum, visible);
+		stop = std::chrono::high_resolution_clock::now();
+		cullTotal += ms(start, stop);
+	}
+	std::cout << "  dynamic: refit " << refitTotal / frames << " ms, cull after " << frames << " refits " << cullTotal / frames << " ms" << std::endl;
+
+	start = std::chrono::high_resolution_clock::now();
+	bvh.build(items);
+	stop = std::chrono::high_resolution_clock::now();
+	visible.clear();
+	auto cullStart = std::chrono::high_resolution_clock::now();
+	bvh.cull(frustum, visible);
+	auto cullStop = std::chrono::high_resolution_clock::now();
+	std::cout << "  rebuilt: build " << ms(start, stop) << " ms, cull " << ms(cullStart, cullStop) << " ms" << std::endl;
+}
+#endif
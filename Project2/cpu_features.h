@@ -0,0 +1,90 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_FEATURES_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Instruction sets the CPU has, checked at runtime. SIMD kernels for sets the build doesn't enable are compiled
+// with CPU_TARGET_AVX / CPU_TARGET_AVX2_FMA and only called when these say so, so the build needs no /arch flag.
+// MSVC emits the intrinsics as they are, gcc and clang need the instruction sets enabled on the function.
+
+#if defined(CPU_FEATURES_X86) && !defined(_MSC_VER)
+#define CPU_TARGET_AVX __attribute__((target("avx")))
+#define CPU_TARGET_AVX2_FMA __attribute__((target("avx2,fma")))
+#else
+#define CPU_TARGET_AVX
+#define CPU_TARGET_AVX2_FMA
+#endif
+
+#if defined(CPU_FEATURES_X86)
+inline void cpuid(unsigned int leaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex((int*)regs, (int)leaf, 0);
+#else
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// AVX in the CPU, and the OS saves the ymm registers
+inline bool detectAVX()
+{
+	unsigned int regs[4] = { 0, 0, 0, 0 };
+	cpuid(1, regs);
+	bool osxsave = (regs[2] & (1u << 27)) != 0;
+	bool avx = (regs[2] & (1u << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+#if defined(_MSC_VER)
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0Low, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+#endif
+	// xmm and ymm state
+	return (xcr0 & 6) == 6;
+}
+
+// AVX2 and FMA on top of AVX
+inline bool detectAVX2FMA()
+{
+	unsigned int regs[4] = { 0, 0, 0, 0 };
+	cpuid(0, regs);
+	if (regs[0] < 7 || !detectAVX())
+		return false;
+	cpuid(1, regs);
+	bool fma = (regs[2] & (1u << 12)) != 0;
+	cpuid(7, regs);
+	return fma && (regs[1] & (1u << 5)) != 0;
+}
+#endif
+
+// checked once
+inline bool cpuHasAVX()
+{
+#if defined(CPU_FEATURES_X86)
+	static const bool supported = detectAVX();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+inline bool cpuHasAVX2FMA()
+{
+#if defined(CPU_FEATURES_X86)
+	static const bool supported = detectAVX2FMA();
+	return supported;
+#else
+	return false;
+#endif
+}
+#endif
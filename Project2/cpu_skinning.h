@@ -0,0 +1,255 @@
+#ifndef CPU_SKINNING_H
+#define CPU_SKINNING_H
+
+#include "crowd.h"
+#include "cpu_features.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// CPU skinning for when the skinning shader can't be used (headless runs, drivers without texture buffers)
+// and as the reference the GPU path is checked against. Positions and normals of the SkinnedVertex arrays
+// built by loadModel() are blended with up to four bones from a getPose()/Crowd palette.
+
+// one skinned vertex as it's streamed to the GPU
+struct SkinnedOutput {
+	glm::vec3 position;
+	glm::vec3 normal;
+};
+
+// plain scalar version, the reference every other path is compared with
+inline void skinVerticesReference(const SkinnedVertex* vertices, unsigned int begin, unsigned int end, const glm::mat4* palette, SkinnedOutput* output)
+{
+	for (unsigned int i = begin; i < end; i++)
+	{
+		const SkinnedVertex& v = vertices[i];
+		float total = v.boneWeights.x + v.boneWeights.y + v.boneWeights.z + v.boneWeights.w;
+		if (total <= 0.0f)
+		{
+			// not bound to any bone
+			output[i].position = v.position;
+			output[i].normal = v.normal;
+			continue;
+		}
+		glm::mat4 skin = palette[(int)v.boneIds.x] * v.boneWeights.x
+			+ palette[(int)v.boneIds.y] * v.boneWeights.y
+			+ palette[(int)v.boneIds.z] * v.boneWeights.z
+			+ palette[(int)v.boneIds.w] * v.boneWeights.w;
+		output[i].position = glm::vec3(skin * glm::vec4(v.position, 1.0f));
+		output[i].normal = glm::normalize(glm::mat3(skin) * v.normal);
+	}
+}
+
+#if defined(CPU_FEATURES_X86)
+// the AVX2 kernel is always compiled and only called when the CPU has it, see cpu_features.h
+// a mat4 is 16 floats, i.e. two 8-wide registers, so blending four bones is eight fused multiply-adds
+CPU_TARGET_AVX2_FMA inline void skinVerticesAVX2(const SkinnedVertex* vertices, unsigned int begin, unsigned int end, const glm::mat4* palette, SkinnedOutput* output)
+{
+	for (unsigned int i = begin; i < end; i++)
+	{
+		const SkinnedVertex& v = vertices[i];
+		float total = v.boneWeights.x + v.boneWeights.y + v.boneWeights.z + v.boneWeights.w;
+		if (total <= 0.0f)
+		{
+			output[i].position = v.position;
+			output[i].normal = v.normal;
+			continue;
+		}
+
+		__m256 lo = _mm256_setzero_ps(); // columns 0 and 1
+		__m256 hi = _mm256_setzero_ps(); // columns 2 and 3
+		for (int b = 0; b < 4; b++)
+		{
+			const float* m = &palette[(int)v.boneIds[b]][0][0];
+			__m256 w = _mm256_set1_ps(v.boneWeights[b]);
+			lo = _mm256_fmadd_ps(_mm256_loadu_ps(m), w, lo);
+			hi = _mm256_fmadd_ps(_mm256_loadu_ps(m + 8), w, hi);
+		}
+
+		__m128 c0 = _mm256_castps256_ps128(lo);
+		__m128 c1 = _mm256_extractf128_ps(lo, 1);
+		__m128 c2 = _mm256_castps256_ps128(hi);
+		__m128 c3 = _mm256_extractf128_ps(hi, 1);
+
+		// position = c0 * x + c1 * y + c2 * z + c3
+		__m128 p = _mm_fmadd_ps(c0, _mm_set1_ps(v.position.x), c3);
+		p = _mm_fmadd_ps(c1, _mm_set1_ps(v.position.y), p);
+		p = _mm_fmadd_ps(c2, _mm_set1_ps(v.position.z), p);
+		// normal = c0 * x + c1 * y + c2 * z
+		__m128 n = _mm_mul_ps(c0, _mm_set1_ps(v.normal.x));
+		n = _mm_fmadd_ps(c1, _mm_set1_ps(v.normal.y), n);
+		n = _mm_fmadd_ps(c2, _mm_set1_ps(v.normal.z), n);
+		__m128 lengthSquared = _mm_dp_ps(n, n, 0x7F);
+		n = _mm_div_ps(n, _mm_sqrt_ps(lengthSquared));
+
+		float pf[4], nf[4];
+		_mm_storeu_ps(pf, p);
+		_mm_storeu_ps(nf, n);
+		output[i].position = glm::vec3(pf[0], pf[1], pf[2]);
+		output[i].normal = glm::vec3(nf[0], nf[1], nf[2]);
+	}
+}
+#endif
+
+// true when skinVertices() takes the AVX2 path, checked once
+inline bool useAVX2Skinning()
+{
+	return cpuHasAVX2FMA();
+}
+
+// skins vertices [begin, end) with the fastest path this CPU supports
+inline void skinVertices(const SkinnedVertex* vertices, unsigned int begin, unsigned int end, const glm::mat4* palette, SkinnedOutput* output)
+{
+#if defined(CPU_FEATURES_X86)
+	if (useAVX2Skinning())
+	{
+		skinVerticesAVX2(vertices, begin, end, palette, output);
+		return;
+	}
+#endif
+	skinVerticesReference(vertices, begin, end, palette, output);
+}
+
+// skins all vertices, split into vertex ranges across the job system
+inline void skinVerticesParallel(JobSystem& jobs, const std::vector<SkinnedVertex>& vertices, const glm::mat4* palette, SkinnedOutput* output)
+{
+	const SkinnedVertex* in = vertices.data();
+	jobs.parallelFor((unsigned int)vertices.size(), 2048, [in, palette, output](unsigned int begin, unsigned int end) {
+		skinVertices(in, begin, end, palette, output);
+	});
+}
+
+// largest distance between two skinning results, used to validate one path against another
+inline float maxSkinningError(const std::vector<SkinnedOutput>& a, const std::vector<SkinnedOutput>& b)
+{
+	float error = 0.0f;
+	for (unsigned int i = 0; i < a.size() && i < b.size(); i++)
+	{
+		error = glm::max(error, glm::length(a[i].position - b[i].position));
+		error = glm::max(error, glm::length(a[i].normal - b[i].normal));
+	}
+	return error;
+}
+
+// vertex buffer the skinned vertices are streamed into every frame. attribute 0 is the position
+// and attribute 1 the normal, same as createVertexArray(); the uvs stay in their static buffer
+class SkinnedVertexStream
+{
+public:
+	unsigned int VBO = 0;
+	unsigned int vertexCount = 0;
+
+	SkinnedVertexStream(unsigned int vertexCount) : vertexCount(vertexCount)
+	{
+		glGenBuffers(1, &VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(SkinnedOutput), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	SkinnedVertexStream(const SkinnedVertexStream&) = delete;
+	SkinnedVertexStream& operator=(const SkinnedVertexStream&) = delete;
+
+	~SkinnedVertexStream()
+	{
+		release();
+	}
+
+	// deletes the buffer while the context is alive, the VAO it's attached to belongs to whoever made it
+	void release()
+	{
+		if (VBO)
+			glDeleteBuffers(1, &VBO);
+		VBO = 0;
+		vertexCount = 0;
+	}
+
+	// points attributes 0 and 1 of the currently bound VAO at this buffer
+	void attach()
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedOutput), (void*)offsetof(SkinnedOutput, position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedOutput), (void*)offsetof(SkinnedOutput, normal));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// skins straight into the mapped buffer. the old contents are invalidated so the driver can
+	// hand out fresh memory instead of waiting for draws that still read last frame's vertices
+	void update(JobSystem& jobs, const std::vector<SkinnedVertex>& vertices, const glm::mat4* palette)
+	{
+		// the mapping only has room for vertexCount of them
+		if (vertices.size() > vertexCount)
+		{
+			std::cout << "ERROR::SKINNING:: " << vertices.size() << " vertices don't fit a stream of " << vertexCount << std::endl;
+			return;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertexCount * sizeof(SkinnedOutput), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped)
+		{
+			skinVerticesParallel(jobs, vertices, palette, (SkinnedOutput*)mapped);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		}
+		else
+		{
+			std::cout << "ERROR::SKINNING:: failed to map the vertex stream" << std::endl;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+};
+
+// prints skinned vertices per second for the reference and the SIMD path on 1..N threads,
+// and how far the SIMD result is from the reference
+inline void benchmarkCpuSkinning(const std::string& path, unsigned int frames = 200)
+{
+	AnimatedModel rig;
+	if (!loadAnimatedModel(path, rig))
+		return;
+
+	const std::vector<SkinnedVertex>& vertices = rig.vertices;
+	std::vector<glm::mat4> palette(rig.boneCount > 0 ? rig.boneCount : 1, glm::mat4(1.0f));
+	glm::mat4 identity(1.0f);
+	getPose(rig.animation, rig.skeleton, rig.animation.duration * 0.5f, palette, identity, rig.globalInverseTransform);
+
+	std::vector<SkinnedOutput> reference(vertices.size()), result(vertices.size());
+	skinVerticesReference(vertices.data(), 0, (unsigned int)vertices.size(), palette.data(), reference.data());
+	skinVertices(vertices.data(), 0, (unsigned int)vertices.size(), palette.data(), result.data());
+
+	const char* pathName = useAVX2Skinning() ? "avx2" : "scalar";
+	std::cout << "benchmarkCpuSkinning() vertices=" << vertices.size() << " bones=" << rig.boneCount << " path=" << pathName
+		<< " max error vs reference=" << maxSkinningError(reference, result) << std::endl;
+
+	auto measure = [&](JobSystem& jobs, bool useReference) {
+		auto start = std::chrono::high_resolution_clock::now();
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			if (useReference)
+				jobs.parallelFor((unsigned int)vertices.size(), 2048, [&](unsigned int begin, unsigned int end) {
+					skinVerticesReference(vertices.data(), begin, end, palette.data(), result.data());
+				});
+			else
+				skinVerticesParallel(jobs, vertices, palette.data(), result.data());
+		}
+		auto stop = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(stop - start).count();
+		return (double)vertices.size() * frames / seconds;
+	};
+
+	std::vector<unsigned int> threadCounts = JobSystem::benchmarkThreadCounts();
+
+	std::cout << std::setw(9) << "threads" << std::setw(18) << "reference Mv/s" << std::setw(14) << "fast Mv/s" << std::endl;
+	for (unsigned int threads : threadCounts)
+	{
+		JobSystem jobs(threads);
+		double slow = measure(jobs, true);
+		double fast = measure(jobs, false);
+		std::cout << std::setw(9) << threads << std::setw(18) << std::fixed << std::setprecision(2) << slow / 1e6
+			<< std::setw(14) << fast / 1e6 << std::endl;
+	}
+}
+#endif
@@ -0,0 +1,264 @@
+#ifndef CROWD_H
+#define CROWD_H
+
+#include "pose.h"
+#include "anim_lod.h"
+#include "jobsystem.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// per character animation state
+struct CrowdInstance {
+	int clip = 0;				// index into Crowd::clips
+	float time = 0.0f;			// playback time in ticks
+	float speed = 1.0f;
+	int blendClip = -1;			// optional second clip blended over the first one, -1 for none
+	float blendTime = 0.0f;
+	float blendWeight = 0.0f;
+};
+
+// evaluates the poses of many characters sharing one skeleton. pose sampling, blending and palette
+// generation run per character on a JobSystem, every character writes its own slice of one contiguous
+// palette buffer so the whole crowd can be uploaded with a single call
+class Crowd
+{
+public:
+	FlatSkeleton skeleton;
+	std::vector<ClipBinding> clips;
+	std::vector<CrowdInstance> instances;
+	// instances.size() * skeleton.paletteSize matrices, instance i starts at i * skeleton.paletteSize
+	std::vector<glm::mat4> palette;
+	glm::mat4 globalInverseTransform;
+
+	// constructor, expects the skeleton read by loadModel() and the inverse of the scene root transform
+	Crowd(const Bone& root, const glm::mat4& globalInverse) : globalInverseTransform(globalInverse)
+	{
+		flattenSkeleton(root, skeleton);
+	}
+
+	// binds an animation to the skeleton and returns its clip index. the animation must outlive the crowd
+	int addClip(const Animation& animation)
+	{
+		ClipBinding binding;
+		bindClip(animation, skeleton, binding);
+		clips.push_back(binding);
+		return (int)clips.size() - 1;
+	}
+
+	void resize(unsigned int count)
+	{
+		instances.resize(count);
+		palette.assign((size_t)count * skeleton.paletteSize, glm::mat4(1.0f));
+	}
+
+	const glm::mat4* instancePalette(unsigned int instance) const
+	{
+		return &palette[(size_t)instance * skeleton.paletteSize];
+	}
+
+	// advances every character by deltaTime seconds and rebuilds the palette
+	void update(JobSystem& jobs, float deltaTime)
+	{
+		jobs.parallelFor((unsigned int)instances.size(), 32, [this, deltaTime](unsigned int begin, unsigned int end) {
+			// scratch buffers are per chunk so workers never share them
+			std::vector<BoneLocal> pose, blendPose;
+			std::vector<glm::mat4> globals;
+			for (unsigned int i = begin; i < end; i++)
+			{
+				advanceInstance(i, deltaTime);
+				sampleInstance(instances[i], 0.0f, pose, blendPose, nullptr);
+				buildPalette(skeleton, clips[instances[i].clip], pose, globalInverseTransform, &palette[(size_t)i * skeleton.paletteSize], globals);
+			}
+		});
+	}
+
+	// same as update(), but every character is evaluated at the rate its AnimLodState asks for.
+	// a character that doesn't update this frame either keeps last frame's palette or, if its level
+	// interpolates, blends between the pose of its last update and the pose of its next one
+	void update(JobSystem& jobs, float deltaTime, const AnimLodScheduler& lod, const std::vector<AnimLodState>& states)
+	{
+		if (lodCache.size() != instances.size())
+			lodCache.assign(instances.size(), LodCache());
+		if (detailBones.size() != skeleton.bones.size())
+			detailBones = findDetailBones(skeleton);
+
+		jobs.parallelFor((unsigned int)instances.size(), 32, [&](unsigned int begin, unsigned int end) {
+			std::vector<BoneLocal> pose, blendPose;
+			std::vector<glm::mat4> globals;
+			for (unsigned int i = begin; i < end; i++)
+				updateInstanceLod(i, deltaTime, lod.levels[states[i].level], states[i].update, pose, blendPose, globals);
+		});
+	}
+
+private:
+	// sampled poses of a character on a reduced update rate
+	struct LodCache {
+		std::vector<BoneLocal> from, to;
+		float fromTime = 0.0f, toTime = 0.0f;
+		bool valid = false;
+	};
+	std::vector<LodCache> lodCache;
+	std::vector<unsigned char> detailBones;
+
+	void advanceInstance(unsigned int i, float deltaTime)
+	{
+		CrowdInstance& instance = instances[i];
+		instance.time += deltaTime * instance.speed * clips[instance.clip].ticksPerSecond;
+		if (instance.blendClip >= 0)
+			instance.blendTime += deltaTime * instance.speed * clips[instance.blendClip].ticksPerSecond;
+	}
+
+	// samples the instance's clip (and blend clip) ahead by seconds into pose
+	void sampleInstance(const CrowdInstance& instance, float ahead, std::vector<BoneLocal>& pose, std::vector<BoneLocal>& blendPose, const std::vector<unsigned char>* skip)
+	{
+		const ClipBinding& clip = clips[instance.clip];
+		samplePose(clip, instance.time + ahead * instance.speed * clip.ticksPerSecond, pose, skip);
+
+		if (instance.blendClip >= 0 && instance.blendWeight > 0.0f)
+		{
+			const ClipBinding& other = clips[instance.blendClip];
+			blendPose = pose;
+			samplePose(other, instance.blendTime + ahead * instance.speed * other.ticksPerSecond, blendPose, skip);
+			blendPoses(pose, blendPose, instance.blendWeight, pose);
+		}
+	}
+
+	void updateInstanceLod(unsigned int i, float deltaTime, const AnimLodLevel& level, bool update, std::vector<BoneLocal>& pose, std::vector<BoneLocal>& blendPose, std::vector<glm::mat4>& globals)
+	{
+		advanceInstance(i, deltaTime);
+		const CrowdInstance& instance = instances[i];
+		const ClipBinding& clip = clips[instance.clip];
+		glm::mat4* output = &palette[(size_t)i * skeleton.paletteSize];
+		LodCache& cache = lodCache[i];
+		// detail bones are neither sampled nor built into the palette, they follow their parent in their bind pose
+		const std::vector<unsigned char>* skip = level.detailBones || !cache.valid ? nullptr : &detailBones;
+
+		if (update || !cache.valid)
+		{
+			if (level.interpolate)
+			{
+				// the clip is deterministic, so the pose at the next update can be sampled right away and
+				// the frames in between blend towards it without lagging behind
+				float ahead = deltaTime * level.updateInterval;
+				if (cache.valid)
+					cache.from = cache.to;
+				else
+					sampleInstance(instance, 0.0f, cache.from, blendPose, nullptr);
+				sampleInstance(instance, ahead, cache.to, blendPose, skip);
+				cache.fromTime = instance.time;
+				cache.toTime = instance.time + ahead * instance.speed * clip.ticksPerSecond;
+			}
+			else
+			{
+				sampleInstance(instance, 0.0f, cache.to, blendPose, skip);
+				cache.fromTime = cache.toTime = instance.time;
+			}
+			cache.valid = true;
+		}
+		else if (!level.interpolate)
+		{
+			// not due yet, last update's palette stays as it is
+			return;
+		}
+
+		if (level.interpolate && cache.toTime > cache.fromTime)
+		{
+			float frac = glm::clamp((instance.time - cache.fromTime) / (cache.toTime - cache.fromTime), 0.0f, 1.0f);
+			blendPoses(cache.from, cache.to, frac, pose);
+			buildPalette(skeleton, clip, pose, globalInverseTransform, output, globals, skip);
+		}
+		else
+		{
+			buildPalette(skeleton, clip, cache.to, globalInverseTransform, output, globals, skip);
+		}
+	}
+};
+
+// measures how crowd evaluation scales with the number of cores. loads the rig and its first animation
+// from path and prints ms per update for every instance count and thread count
+inline void benchmarkCrowd(const std::string& path, const std::vector<unsigned int>& instanceCounts, unsigned int frames = 60)
+{
+	AnimatedModel rig;
+	if (!loadAnimatedModel(path, rig))
+		return;
+
+	Crowd crowd(rig.skeleton, rig.globalInverseTransform);
+	int clip = crowd.addClip(rig.animation);
+
+	std::vector<unsigned int> threadCounts = JobSystem::benchmarkThreadCounts();
+
+	std::cout << "benchmarkCrowd() bones=" << crowd.skeleton.bones.size() << " frames=" << frames << std::endl;
+	std::cout << std::setw(10) << "instances" << std::setw(9) << "threads" << std::setw(12) << "ms/update" << std::setw(10) << "speedup" << std::endl;
+	for (unsigned int count : instanceCounts)
+	{
+		crowd.resize(count);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			// spread the characters over the clip so they don't all sample the same keys
+			crowd.instances[i].clip = clip;
+			crowd.instances[i].time = rig.animation.duration * (float)i / (float)count;
+		}
+
+		double singleThreaded = 0.0;
+		for (unsigned int threads : threadCounts)
+		{
+			JobSystem jobs(threads);
+			crowd.update(jobs, 0.0f); // warm up
+			auto start = std::chrono::high_resolution_clock::now();
+			for (unsigned int f = 0; f < frames; f++)
+				crowd.update(jobs, 1.0f / 60.0f);
+			auto stop = std::chrono::high_resolution_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(stop - start).count() / frames;
+			if (threads == 1)
+				singleThreaded = ms;
+
+			std::cout << std::setw(10) << count << std::setw(9) << threads << std::setw(12) << std::fixed << std::setprecision(3) << ms
+				<< std::setw(9) << std::setprecision(2) << singleThreaded / ms << "x" << std::endl;
+		}
+	}
+
+	// update-rate LOD: the largest crowd spread out in front of the camera, average and worst frame
+	// with every character at full rate against the LOD schedule
+	if (instanceCounts.empty())
+		return;
+	unsigned int count = instanceCounts.back();
+	std::vector<glm::vec3> positions(count);
+	for (unsigned int i = 0; i < count; i++)
+		positions[i] = glm::vec3((float)(i % 100) - 50.0f, 0.0f, -2.0f - (float)(i / 100) * 2.0f);
+	glm::mat4 projection = glm::perspective(45.0f, 4.0f / 3.0f, 0.01f, 1500.0f);
+	AnimLodScheduler lod;
+	std::vector<AnimLodState> states;
+	JobSystem jobs(threadCounts.back());
+
+	for (int useLod = 0; useLod < 2; useLod++)
+	{
+		double total = 0.0, worst = 0.0;
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			if (useLod)
+			{
+				lod.schedule(positions, 1.0f, glm::vec3(0.0f), projection, states);
+				crowd.update(jobs, 1.0f / 60.0f, lod, states);
+			}
+			else
+			{
+				crowd.update(jobs, 1.0f / 60.0f);
+			}
+			auto stop = std::chrono::high_resolution_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(stop - start).count();
+			total += ms;
+			worst = std::max(worst, ms);
+		}
+		std::cout << (useLod ? "with LOD   " : "without LOD") << " instances=" << count << " avg ms=" << std::setprecision(3) << total / frames
+			<< " worst ms=" << worst << std::endl;
+	}
+	std::vector<unsigned int> histogram = lod.histogram(states);
+	for (unsigned int level = 0; level < histogram.size(); level++)
+		std::cout << "  LOD " << level << " (every " << lod.levels[level].updateInterval << " frames): " << histogram[level] << " characters" << std::endl;
+}
+#endif
@@ -0,0 +1,62 @@
+#version 330 core
+out vec4 FragColor;
+
+in VS_OUT {
+    vec3 FragPos;
+    vec2 TexCoords;
+    vec3 TangentLightPos;
+    vec3 TangentViewPos;
+    vec3 TangentFragPos;
+} fs_in;
+
+// effect.fs with the textures taken from texture arrays, see texture_array.h
+uniform sampler2DArray textureArrays[8];
+// x/y: array and layer of the diffuse map, z/w: of the normal map, -1 if there is none
+layout (std140) uniform Materials {
+    ivec4 materials[256];
+};
+uniform int materialIndex;
+
+// sampler arrays can only be indexed with constants in GLSL 3.30
+vec4 sampleArray(int array, int layer, vec2 uv, vec4 fallback)
+{
+    vec3 coord = vec3(uv, float(layer));
+    switch (array)
+    {
+    case 0: return texture(textureArrays[0], coord);
+    case 1: return texture(textureArrays[1], coord);
+    case 2: return texture(textureArrays[2], coord);
+    case 3: return texture(textureArrays[3], coord);
+    case 4: return texture(textureArrays[4], coord);
+    case 5: return texture(textureArrays[5], coord);
+    case 6: return texture(textureArrays[6], coord);
+    case 7: return texture(textureArrays[7], coord);
+    }
+    return fallback;
+}
+
+void main()
+{           
+    ivec4 material = materials[materialIndex];
+
+    vec3 normal = sampleArray(material.z, material.w, fs_in.TexCoords, vec4(0.5, 0.5, 1.0, 1.0)).rgb;
+	//transform into [-1,1]
+    normal = normalize(normal * 2.0 - 1.0);  
+
+	//light color
+    vec3 color = sampleArray(material.x, material.y, fs_in.TexCoords, vec4(1.0)).rgb;
+    // Ambient
+    vec3 ambient = 0.1 * color;
+    // Diffuse
+    vec3 lightDir = normalize(fs_in.TangentLightPos - fs_in.TangentFragPos);
+    float diff = max(dot(lightDir, normal), 0.0);
+    vec3 diffuse = diff * color;
+    // Specular
+    vec3 viewDir = normalize(fs_in.TangentViewPos - fs_in.TangentFragPos);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    vec3 halfwayDir = normalize(lightDir + viewDir);  
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), 32.0);
+    vec3 specular = vec3(0.2) * spec;
+    
+    FragColor = vec4(ambient + diffuse + specular, 1.0f);
+}
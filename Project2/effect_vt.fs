@@ -0,0 +1,69 @@
+#version 330 core
+out vec4 FragColor;
+
+in VS_OUT {
+    vec3 FragPos;
+    vec2 TexCoords;
+    vec3 TangentLightPos;
+    vec3 TangentViewPos;
+    vec3 TangentFragPos;
+} fs_in;
+
+uniform sampler2D normalMap;
+
+// effect.fs with the diffuse map taken from a virtual texture, see virtual_texture.h
+uniform sampler2D vtCache;
+uniform usampler2D vtPageTable;
+uniform vec2 vtSize;
+uniform float vtTileSize;
+uniform float vtBorder;
+uniform float vtCacheSize;
+uniform float vtLevels;
+uniform float vtLodBias;
+
+// mip level from the screen space derivatives, textureQueryLod needs GLSL 4.00
+float virtualMip(vec2 uv)
+{
+    vec2 dx = dFdx(uv * vtSize);
+    vec2 dy = dFdy(uv * vtSize);
+    float d = max(dot(dx, dx), dot(dy, dy));
+    return clamp(0.5 * log2(max(d, 1e-8)) + vtLodBias, 0.0, vtLevels - 1.0);
+}
+
+vec4 sampleVirtual(vec2 uv)
+{
+    vec2 wrapped = fract(uv);
+    int level = int(virtualMip(uv));
+    ivec2 tiles = textureSize(vtPageTable, level);
+    uvec4 entry = texelFetch(vtPageTable, min(ivec2(wrapped * vec2(tiles)), tiles - 1), level);
+    // the entry can be a parent of the tile, the position inside the tile is taken at the mip it holds
+    vec2 texel = wrapped * max(vtSize / exp2(float(entry.z)), vec2(1.0));
+    vec2 inTile = mod(texel, vtTileSize);
+    vec2 physical = (vec2(entry.xy) * (vtTileSize + 2.0 * vtBorder) + vtBorder + inTile) / vtCacheSize;
+    return textureLod(vtCache, physical, 0.0);
+}
+
+void main()
+{           
+
+    vec3 normal = texture(normalMap, fs_in.TexCoords).rgb;
+	//transform into [-1,1]
+    normal = normalize(normal * 2.0 - 1.0);  
+
+	//light color
+    vec3 color = sampleVirtual(fs_in.TexCoords).rgb;
+    // Ambient
+    vec3 ambient = 0.1 * color;
+    // Diffuse
+    vec3 lightDir = normalize(fs_in.TangentLightPos - fs_in.TangentFragPos);
+    float diff = max(dot(lightDir, normal), 0.0);
+    vec3 diffuse = diff * color;
+    // Specular
+    vec3 viewDir = normalize(fs_in.TangentViewPos - fs_in.TangentFragPos);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    vec3 halfwayDir = normalize(lightDir + viewDir);  
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), 32.0);
+    vec3 specular = vec3(0.2) * spec;
+    
+    FragColor = vec4(ambient + diffuse + specular, 1.0f);
+}
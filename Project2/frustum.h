@@ -0,0 +1,315 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "bounds.h"
+#include "cpu_features.h"
+#include "jobsystem.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// view frustum as six planes (xyz = normal pointing inside, w = distance), a point p is inside a plane
+// when dot(xyz, p) + w >= 0. extracted from a clip matrix: projection * view gives world space planes,
+// projection * view * model gives planes in the model's space, so mesh bounds can be tested untransformed
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+inline Frustum extractFrustum(const glm::mat4& clip)
+{
+	// Gribb & Hartmann: the planes are sums/differences of the matrix rows
+	glm::vec4 row0(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+	glm::vec4 row1(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+	glm::vec4 row2(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+	glm::vec4 row3(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0; // left
+	frustum.planes[1] = row3 - row0; // right
+	frustum.planes[2] = row3 + row1; // bottom
+	frustum.planes[3] = row3 - row1; // top
+	frustum.planes[4] = row3 + row2; // near
+	frustum.planes[5] = row3 - row2; // far
+	for (int i = 0; i < 6; i++)
+		frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+	return frustum;
+}
+
+// box against all six planes, false as soon as the box is completely behind one of them
+inline bool isVisible(const Frustum& frustum, const AABB& box)
+{
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.extents();
+	for (int i = 0; i < 6; i++)
+	{
+		glm::vec3 n = glm::vec3(frustum.planes[i]);
+		float d = glm::dot(n, c) + frustum.planes[i].w;
+		float r = glm::dot(glm::abs(n), e);
+		if (d + r < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+enum FrustumTest {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECT,
+	FRUSTUM_INSIDE
+};
+
+// like isVisible(), but also reports boxes completely inside, so a hierarchy can accept whole subtrees
+inline FrustumTest classify(const Frustum& frustum, const AABB& box)
+{
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.extents();
+	FrustumTest result = FRUSTUM_INSIDE;
+	for (int i = 0; i < 6; i++)
+	{
+		glm::vec3 n = glm::vec3(frustum.planes[i]);
+		float d = glm::dot(n, c) + frustum.planes[i].w;
+		float r = glm::dot(glm::abs(n), e);
+		if (d + r < 0.0f)
+			return FRUSTUM_OUTSIDE;
+		if (d - r < 0.0f)
+			result = FRUSTUM_INTERSECT;
+	}
+	return result;
+}
+
+inline bool isVisible(const Frustum& frustum, const BoundingSphere& sphere)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (glm::dot(glm::vec3(frustum.planes[i]), sphere.center) + frustum.planes[i].w < -sphere.radius)
+			return false;
+	}
+	return true;
+}
+
+// boxes as center/extent arrays (structure of arrays), padded to a multiple of 8 so the SIMD loops never
+// need a scalar tail. padding boxes are empty and far away, so they always come out culled
+struct AABBBatch {
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	unsigned int count = 0;
+
+	void clear()
+	{
+		centerX.clear(); centerY.clear(); centerZ.clear();
+		extentX.clear(); extentY.clear(); extentZ.clear();
+		count = 0;
+	}
+
+	void add(const AABB& box)
+	{
+		glm::vec3 c = box.valid() ? box.center() : glm::vec3(FLT_MAX);
+		glm::vec3 e = box.valid() ? box.extents() : glm::vec3(0.0f);
+		// overwrite padding if there is some, otherwise append
+		unsigned int i = count++;
+		if (i >= centerX.size())
+		{
+			centerX.resize(i + 1); centerY.resize(i + 1); centerZ.resize(i + 1);
+			extentX.resize(i + 1); extentY.resize(i + 1); extentZ.resize(i + 1);
+		}
+		centerX[i] = c.x; centerY[i] = c.y; centerZ[i] = c.z;
+		extentX[i] = e.x; extentY[i] = e.y; extentZ[i] = e.z;
+		pad();
+	}
+
+	unsigned int paddedCount() const
+	{
+		return (unsigned int)centerX.size();
+	}
+
+private:
+	void pad()
+	{
+		size_t padded = (count + 7) & ~7u;
+		// far away but finite, so the plane distances stay finite and compare as outside
+		centerX.resize(padded, 1e30f); centerY.resize(padded, 1e30f); centerZ.resize(padded, 1e30f);
+		extentX.resize(padded, 0.0f); extentY.resize(padded, 0.0f); extentZ.resize(padded, 0.0f);
+	}
+};
+
+// the kernels below test boxes [begin, end) of a batch, visible[i] is set to 1 or 0. begin has to be a multiple
+// of 8, the SIMD ones read up to the next multiple of 8 past end. they return the number of visible boxes
+
+inline unsigned int cullBatchScalar(const Frustum& frustum, const AABBBatch& batch, unsigned int begin, unsigned int end, unsigned char* visible)
+{
+	unsigned int visibleCount = 0;
+	for (unsigned int i = begin; i < end; i++)
+	{
+		AABB box;
+		glm::vec3 c(batch.centerX[i], batch.centerY[i], batch.centerZ[i]);
+		glm::vec3 e(batch.extentX[i], batch.extentY[i], batch.extentZ[i]);
+		box.min = c - e;
+		box.max = c + e;
+		visible[i] = isVisible(frustum, box) ? 1 : 0;
+		visibleCount += visible[i];
+	}
+	return visibleCount;
+}
+
+#if defined(BOUNDS_USE_SSE)
+// four boxes per iteration
+inline unsigned int cullBatchSSE(const Frustum& frustum, const AABBBatch& batch, unsigned int begin, unsigned int end, unsigned char* visible)
+{
+	unsigned int visibleCount = 0;
+	unsigned int paddedEnd = std::min((end + 7) & ~7u, batch.paddedCount());
+	for (unsigned int i = begin; i < paddedEnd; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&batch.centerX[i]), cy = _mm_loadu_ps(&batch.centerY[i]), cz = _mm_loadu_ps(&batch.centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&batch.extentX[i]), ey = _mm_loadu_ps(&batch.extentY[i]), ez = _mm_loadu_ps(&batch.extentZ[i]);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::abs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::abs(plane.y)))),
+				_mm_mul_ps(ez, _mm_set1_ps(std::abs(plane.z))));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+		}
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4 && i + k < end; k++)
+		{
+			visible[i + k] = (mask >> k) & 1;
+			visibleCount += visible[i + k];
+		}
+	}
+	return visibleCount;
+}
+#endif
+
+#if defined(CPU_FEATURES_X86)
+// eight boxes per iteration. always compiled, only called when the CPU has AVX, see cpu_features.h
+CPU_TARGET_AVX inline unsigned int cullBatchAVX(const Frustum& frustum, const AABBBatch& batch, unsigned int begin, unsigned int end, unsigned char* visible)
+{
+	unsigned int visibleCount = 0;
+	unsigned int paddedEnd = std::min((end + 7) & ~7u, batch.paddedCount());
+	for (unsigned int i = begin; i < paddedEnd; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(&batch.centerX[i]), cy = _mm256_loadu_ps(&batch.centerY[i]), cz = _mm256_loadu_ps(&batch.centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&batch.extentX[i]), ey = _mm256_loadu_ps(&batch.extentY[i]), ez = _mm256_loadu_ps(&batch.extentZ[i]);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)), _mm256_mul_ps(cy, _mm256_set1_ps(plane.y))),
+				_mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+			__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(std::abs(plane.x))), _mm256_mul_ps(ey, _mm256_set1_ps(std::abs(plane.y)))),
+				_mm256_mul_ps(ez, _mm256_set1_ps(std::abs(plane.z))));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+		int mask = _mm256_movemask_ps(inside);
+		for (int k = 0; k < 8 && i + k < end; k++)
+		{
+			visible[i + k] = (mask >> k) & 1;
+			visibleCount += visible[i + k];
+		}
+	}
+	return visibleCount;
+}
+#endif
+
+// name of the kernel cullBatch() runs on this CPU
+inline const char* cullBatchPath()
+{
+	if (cpuHasAVX())
+		return "avx 8-wide";
+#if defined(BOUNDS_USE_SSE)
+	return "sse 4-wide";
+#else
+	return "scalar";
+#endif
+}
+
+// tests boxes [begin, end) with the widest kernel the CPU supports
+inline unsigned int cullBatch(const Frustum& frustum, const AABBBatch& batch, unsigned int begin, unsigned int end, unsigned char* visible)
+{
+#if defined(CPU_FEATURES_X86)
+	if (cpuHasAVX())
+		return cullBatchAVX(frustum, batch, begin, end, visible);
+#endif
+#if defined(BOUNDS_USE_SSE)
+	return cullBatchSSE(frustum, batch, begin, end, visible);
+#else
+	return cullBatchScalar(frustum, batch, begin, end, visible);
+#endif
+}
+
+// culling counters of the last frame, shown in the ImGui panel
+struct CullStats {
+	unsigned int tested = 0;
+	unsigned int visible = 0;
+};
+
+// times culling count random boxes, single threaded and on the job system
+inline void benchmarkFrustumCulling(unsigned int count = 100000, unsigned int iterations = 100)
+{
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> size(0.1f, 5.0f);
+	AABBBatch batch;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		AABB box;
+		glm::vec3 c(position(rng), position(rng) * 0.1f, position(rng));
+		glm::vec3 e(size(rng), size(rng), size(rng));
+		box.min = c - e;
+		box.max = c + e;
+		batch.add(box);
+	}
+	glm::mat4 projection = glm::perspective(75.0f, 4.0f / 3.0f, 0.01f, 1500.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = extractFrustum(projection * view);
+	std::vector<unsigned char> visible(batch.paddedCount());
+
+	const char* pathName = cullBatchPath();
+
+	unsigned int visibleCount = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (unsigned int it = 0; it < iterations; it++)
+		visibleCount = cullBatch(frustum, batch, 0, count, visible.data());
+	auto stop = std::chrono::high_resolution_clock::now();
+	double ms = std::chrono::duration<double, std::milli>(stop - start).count() / iterations;
+
+	// scalar reference for the speedup and to make sure the SIMD path agrees
+	unsigned int mismatches = 0;
+	auto scalarStart = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		AABB box;
+		glm::vec3 c(batch.centerX[i], batch.centerY[i], batch.centerZ[i]);
+		glm::vec3 e(batch.extentX[i], batch.extentY[i], batch.extentZ[i]);
+		box.min = c - e;
+		box.max = c + e;
+		if ((isVisible(frustum, box) ? 1 : 0) != visible[i])
+			mismatches++;
+	}
+	auto scalarStop = std::chrono::high_resolution_clock::now();
+	double scalarMs = std::chrono::duration<double, std::milli>(scalarStop - scalarStart).count();
+
+	std::cout << "benchmarkFrustumCulling() boxes=" << count << " visible=" << visibleCount << " path=" << pathName << std::endl;
+	std::cout << "  simd:   " << ms << " ms (" << count / ms / 1000.0 << " Mboxes/s)" << std::endl;
+	std::cout << "  scalar: " << scalarMs << " ms, mismatches=" << mismatches << std::endl;
+
+	JobSystem jobs;
+	start = std::chrono::high_resolution_clock::now();
+	for (unsigned int it = 0; it < iterations; it++)
+	{
+		jobs.parallelFor(count, 8192, [&](unsigned int begin, unsigned int end) {
+			cullBatch(frustum, batch, begin, end, visible.data());
+		});
+	}
+	stop = std::chrono::high_resolution_clock::now();
+	ms = std::chrono::duration<double, std::milli>(stop - start).count() / iterations;
+	std::cout << "  simd on " << jobs.threadCount() << " threads: " << ms << " ms" << std::endl;
+}
+#endif
@@ -0,0 +1,195 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <map>
+#include <string>
+#include <utility>
+
+// Shadow copy of the GL state the draw code touches (program, VAO, texture and sampler bindings, sampler uniforms).
+// Calls that would set a value GL already has are dropped. With filtering off every call goes through, so the
+// counters of both modes give the number of GL calls per frame before and after filtering.
+// Anything that changes GL state behind the cache's back (ImGui, code calling GL directly) must be followed
+// by invalidate().
+
+struct GLCallStats {
+	unsigned int issued = 0;		// calls that reached GL
+	unsigned int skipped = 0;		// redundant calls that were filtered out
+	unsigned int programChanges = 0;
+	unsigned int vaoChanges = 0;
+	unsigned int textureBinds = 0;
+	unsigned int draws = 0;
+};
+
+class GLStateCache
+{
+public:
+	static const unsigned int MAX_TEXTURE_UNITS = 32;
+
+	bool filtering = true;
+	GLCallStats stats;
+
+	GLStateCache()
+	{
+		invalidate();
+	}
+
+	// forget everything, the next call of every kind is issued
+	void invalidate()
+	{
+		program = UNKNOWN;
+		vao = UNKNOWN;
+		activeUnit = UNKNOWN;
+		for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+		{
+			textures[i] = UNKNOWN;
+			targets[i] = UNKNOWN;
+			samplers[i] = UNKNOWN;
+		}
+		uniforms.clear();
+	}
+
+	void resetStats()
+	{
+		stats = GLCallStats();
+	}
+
+	void useProgram(unsigned int id)
+	{
+		if (filtering && program == id)
+		{
+			stats.skipped++;
+			return;
+		}
+		program = id;
+		glUseProgram(id);
+		stats.issued++;
+		stats.programChanges++;
+	}
+
+	void bindVertexArray(unsigned int id)
+	{
+		if (filtering && vao == id)
+		{
+			stats.skipped++;
+			return;
+		}
+		vao = id;
+		glBindVertexArray(id);
+		stats.issued++;
+		stats.vaoChanges++;
+	}
+
+	void bindTexture2D(unsigned int unit, unsigned int id)
+	{
+		bindTexture(unit, GL_TEXTURE_2D, id);
+	}
+
+	// only the last binding of a unit is remembered, binding another target to it counts as a change
+	void bindTexture(unsigned int unit, unsigned int target, unsigned int id)
+	{
+		if (filtering && unit < MAX_TEXTURE_UNITS && textures[unit] == id && targets[unit] == target)
+		{
+			stats.skipped += 2;
+			return;
+		}
+		if (!filtering || activeUnit != unit)
+		{
+			activeUnit = unit;
+			glActiveTexture(GL_TEXTURE0 + unit);
+			stats.issued++;
+		}
+		else
+			stats.skipped++;
+		if (unit < MAX_TEXTURE_UNITS)
+		{
+			textures[unit] = id;
+			targets[unit] = target;
+		}
+		glBindTexture(target, id);
+		stats.issued++;
+		stats.textureBinds++;
+	}
+
+	// sampler object of a unit, 0 leaves the sampling to the texture's own parameters
+	void bindSampler(unsigned int unit, unsigned int id)
+	{
+		if (filtering && unit < MAX_TEXTURE_UNITS && samplers[unit] == id)
+		{
+			stats.skipped++;
+			return;
+		}
+		if (unit < MAX_TEXTURE_UNITS)
+			samplers[unit] = id;
+		glBindSampler(unit, id);
+		stats.issued++;
+	}
+
+	// sets an int uniform (a sampler's texture unit) of the current program. the location lookup is cached
+	// too, glGetUniformLocation is a GL call like any other
+	void setInt(unsigned int programId, const std::string& name, int value)
+	{
+		std::pair<unsigned int, std::string> key(programId, name);
+		std::map<std::pair<unsigned int, std::string>, UniformValue>::iterator it = uniforms.find(key);
+		if (filtering && it != uniforms.end())
+		{
+			if (it->second.value == value)
+			{
+				stats.skipped += 2;
+				return;
+			}
+			stats.skipped++;
+		}
+		else
+		{
+			UniformValue uniform;
+			uniform.location = glGetUniformLocation(programId, name.c_str());
+			stats.issued++;
+			it = uniforms.insert(std::make_pair(key, uniform)).first;
+		}
+		it->second.value = value;
+		glUniform1i(it->second.location, value);
+		stats.issued++;
+	}
+
+	// glDraw* calls are never redundant, they are only counted
+	void countDraw()
+	{
+		stats.issued++;
+		stats.draws++;
+	}
+
+	// the VAO and active unit resets the uncached Mesh::Draw does after every mesh. with filtering off they are
+	// issued like there, so the counters compare with the old per draw cost; with it on they are dropped
+	void resetAfterDraw()
+	{
+		if (filtering)
+		{
+			stats.skipped += 2;
+			return;
+		}
+		vao = 0;
+		glBindVertexArray(0);
+		activeUnit = 0;
+		glActiveTexture(GL_TEXTURE0);
+		stats.issued += 2;
+	}
+
+private:
+	static const unsigned int UNKNOWN = 0xffffffffu;
+
+	struct UniformValue {
+		int location = -1;
+		int value = 0x7fffffff;
+	};
+
+	unsigned int program;
+	unsigned int vao;
+	unsigned int activeUnit;
+	unsigned int textures[MAX_TEXTURE_UNITS];
+	unsigned int targets[MAX_TEXTURE_UNITS];
+	unsigned int samplers[MAX_TEXTURE_UNITS];
+	std::map<std::pair<unsigned int, std::string>, UniformValue> uniforms;
+};
+#endif
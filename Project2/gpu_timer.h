@@ -0,0 +1,141 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+
+// GPU time of the render passes of a frame. Every pass gets a GL_TIMESTAMP query at its start and its end. The
+// queries of a frame are read GPU_TIMER_FRAMES frames later when its set of queries comes round again, by then
+// the GPU is long done with them and reading never stalls. A frame whose results still aren't there is dropped.
+// Passes must not overlap, and a frame has at most GPU_TIMER_MAX_PASSES of them.
+
+#define GPU_TIMER_FRAMES 3
+#define GPU_TIMER_MAX_PASSES 16
+#define GPU_TIMER_HISTORY 120
+
+struct GpuPassHistory {
+	std::string name;
+	// milliseconds of the last GPU_TIMER_HISTORY frames, next is the oldest
+	float milliseconds[GPU_TIMER_HISTORY] = {};
+	unsigned int next = 0;
+	float last = 0.0f;
+
+	float average() const
+	{
+		float sum = 0.0f;
+		for (float ms : milliseconds)
+			sum += ms;
+		return sum / GPU_TIMER_HISTORY;
+	}
+};
+
+class GpuPassTimer
+{
+public:
+	// passes in the order they were first timed
+	std::vector<GpuPassHistory> passes;
+	// frames whose queries weren't done when they were read
+	unsigned int droppedFrames = 0;
+
+	GpuPassTimer() {}
+	GpuPassTimer(const GpuPassTimer&) = delete;
+	GpuPassTimer& operator=(const GpuPassTimer&) = delete;
+
+	~GpuPassTimer()
+	{
+		release();
+	}
+
+	// deletes the queries, frames that weren't read are dropped. beginFrame() makes new ones
+	void release()
+	{
+		if (queries[0][0])
+			glDeleteQueries(GPU_TIMER_FRAMES * GPU_TIMER_MAX_PASSES * 2, &queries[0][0]);
+		for (unsigned int f = 0; f < GPU_TIMER_FRAMES; f++)
+		{
+			for (unsigned int q = 0; q < GPU_TIMER_MAX_PASSES * 2; q++)
+				queries[f][q] = 0;
+			counts[f] = 0;
+		}
+		frame = 0;
+		open = false;
+	}
+
+	// reads the results of the frame that used this frame's queries before
+	void beginFrame()
+	{
+		if (!queries[0][0])
+			glGenQueries(GPU_TIMER_FRAMES * GPU_TIMER_MAX_PASSES * 2, &queries[0][0]);
+		slot = frame % GPU_TIMER_FRAMES;
+		if (frame >= GPU_TIMER_FRAMES)
+			collect(slot);
+		counts[slot] = 0;
+		frame++;
+	}
+
+	void begin(const char* name)
+	{
+		open = counts[slot] < GPU_TIMER_MAX_PASSES;
+		if (!open)
+			return;
+		names[slot][counts[slot]] = name;
+		glQueryCounter(queries[slot][counts[slot] * 2], GL_TIMESTAMP);
+	}
+
+	void end()
+	{
+		if (!open)
+			return;
+		glQueryCounter(queries[slot][counts[slot] * 2 + 1], GL_TIMESTAMP);
+		counts[slot]++;
+		open = false;
+	}
+
+private:
+	unsigned int queries[GPU_TIMER_FRAMES][GPU_TIMER_MAX_PASSES * 2] = {};
+	const char* names[GPU_TIMER_FRAMES][GPU_TIMER_MAX_PASSES] = {};
+	unsigned int counts[GPU_TIMER_FRAMES] = {};
+	unsigned int frame = 0;
+	unsigned int slot = 0;
+	bool open = false;
+
+	void collect(unsigned int frameSlot)
+	{
+		unsigned int count = counts[frameSlot];
+		if (count == 0)
+			return;
+		// the timestamps complete in order, the last one being there means all of them are
+		GLint available = 0;
+		glGetQueryObjectiv(queries[frameSlot][count * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			droppedFrames++;
+			return;
+		}
+		for (unsigned int i = 0; i < count; i++)
+		{
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(queries[frameSlot][i * 2], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(queries[frameSlot][i * 2 + 1], GL_QUERY_RESULT, &end);
+			GpuPassHistory& pass = history(names[frameSlot][i]);
+			pass.last = end > start ? (end - start) / 1000000.0f : 0.0f;
+			pass.milliseconds[pass.next] = pass.last;
+			pass.next = (pass.next + 1) % GPU_TIMER_HISTORY;
+		}
+	}
+
+	GpuPassHistory& history(const char* name)
+	{
+		for (GpuPassHistory& pass : passes)
+		{
+			if (pass.name == name)
+				return pass;
+		}
+		passes.push_back(GpuPassHistory());
+		passes.back().name = name;
+		return passes.back();
+	}
+};
+#endif
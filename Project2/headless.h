@@ -0,0 +1,213 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Headless runs render a fixed camera path for a fixed number of frames into an offscreen framebuffer, with a
+// fixed timestep so every run sees the same frames, and exit with the frame timings (see benchmark.h). The window they need for a
+// context is never shown (with GLFW 3.4 the null platform and an EGL context don't need a display at all).
+
+struct HeadlessOptions {
+	bool enabled = false;
+	unsigned int frames = 300;
+	// seconds of camera path per frame, independent of how long the frame took
+	float timestep = 1.0f / 60.0f;
+	// every dumpEvery-th frame is written to dumpDirectory as a .tga, 0 writes none
+	unsigned int dumpEvery = 0;
+	std::string dumpDirectory = ".";
+	// ask GLFW for an EGL context, which Mesa can create without an X server
+	bool egl = false;
+	// recorded camera path to replay instead of the scripted one
+	std::string cameraPath;
+	// json of the timings, see benchmark.h
+	std::string jsonOutput;
+	unsigned int warmupFrames = 30;
+};
+
+// color and depth attachments of the size of the screen, the main pass draws into it instead of the window
+class OffscreenTarget
+{
+public:
+	unsigned int width = 0;
+	unsigned int height = 0;
+
+	OffscreenTarget() {}
+	OffscreenTarget(const OffscreenTarget&) = delete;
+	OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+	~OffscreenTarget()
+	{
+		release();
+	}
+
+	bool create(unsigned int width, unsigned int height)
+	{
+		release();
+		this->width = width;
+		this->height = height;
+		glGenFramebuffers(1, &fbo);
+		glGenRenderbuffers(1, &color);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!complete)
+		{
+			std::cout << "ERROR::OFFSCREEN_TARGET::FRAMEBUFFER_INCOMPLETE" << std::endl;
+			release();
+		}
+		return complete;
+	}
+
+	void bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	}
+
+	// deletes the attachments, called by the destructor and by whoever has to before the context goes
+	void release()
+	{
+		if (fbo)
+			glDeleteFramebuffers(1, &fbo);
+		if (color)
+			glDeleteRenderbuffers(1, &color);
+		if (depth)
+			glDeleteRenderbuffers(1, &depth);
+		fbo = color = depth = 0;
+	}
+
+	// writes the color attachment as an uncompressed 32 bit tga. tga rows go bottom up like glReadPixels rows
+	bool writeImage(const std::string& path) const
+	{
+		std::vector<unsigned char> pixels((size_t)width * height * 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, &pixels[0]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file)
+		{
+			std::cout << "ERROR::OFFSCREEN_TARGET::FILE_NOT_WRITTEN " << path << std::endl;
+			return false;
+		}
+		unsigned char header[18] = {};
+		header[2] = 2;		// uncompressed true color
+		header[12] = width & 0xff;
+		header[13] = (width >> 8) & 0xff;
+		header[14] = height & 0xff;
+		header[15] = (height >> 8) & 0xff;
+		header[16] = 32;
+		header[17] = 8;		// 8 alpha bits, origin bottom left
+		fwrite(header, 1, sizeof(header), file);
+		fwrite(&pixels[0], 1, pixels.size(), file);
+		fclose(file);
+		return true;
+	}
+
+private:
+	unsigned int fbo = 0;
+	unsigned int color = 0;
+	unsigned int depth = 0;
+};
+
+// camera placement along a path, in the terms the player camera is moved in: a position and a heading in degrees
+struct CameraKey {
+	float time;
+	glm::vec3 position;
+	float heading;
+};
+
+// keys interpolated linearly, the path loops after the last key
+class CameraPath
+{
+public:
+	std::vector<CameraKey> keys;
+
+	void sample(float time, glm::vec3& position, float& heading) const
+	{
+		if (keys.empty())
+			return;
+		float duration = keys.back().time;
+		if (duration > 0.0f)
+			time -= duration * std::floor(time / duration);
+		unsigned int next = 1;
+		while (next < keys.size() && keys[next].time < time)
+			next++;
+		if (next >= keys.size())
+		{
+			position = keys.back().position;
+			heading = keys.back().heading;
+			return;
+		}
+		const CameraKey& a = keys[next - 1];
+		const CameraKey& b = keys[next];
+		float t = b.time > a.time ? (time - a.time) / (b.time - a.time) : 0.0f;
+		position = glm::mix(a.position, b.position, t);
+		heading = a.heading + (b.heading - a.heading) * t;
+	}
+
+	// one key per line: time x y z heading
+	bool save(const std::string& path) const
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+		{
+			std::cout << "ERROR::CAMERA_PATH::FILE_NOT_WRITTEN " << path << std::endl;
+			return false;
+		}
+		for (const CameraKey& key : keys)
+			fprintf(file, "%.4f %.6f %.6f %.6f %.4f\n", key.time, key.position.x, key.position.y, key.position.z, key.heading);
+		fclose(file);
+		return true;
+	}
+
+	bool load(const std::string& path)
+	{
+		FILE* file = fopen(path.c_str(), "r");
+		if (!file)
+		{
+			std::cout << "ERROR::CAMERA_PATH::FILE_NOT_FOUND " << path << std::endl;
+			return false;
+		}
+		keys.clear();
+		CameraKey key;
+		while (fscanf(file, "%f %f %f %f %f", &key.time, &key.position.x, &key.position.y, &key.position.z, &key.heading) == 5)
+			keys.push_back(key);
+		fclose(file);
+		if (keys.empty())
+			std::cout << "ERROR::CAMERA_PATH::NO_KEYS " << path << std::endl;
+		return !keys.empty();
+	}
+
+	// walks forward from the start position, turns around, walks back and turns again: the ground is seen close
+	// up, at grazing angles and from every side
+	static CameraPath walkAndTurn(glm::vec3 start, float distance = 3.0f, float seconds = 10.0f)
+	{
+		CameraPath path;
+		glm::vec3 end = start - glm::vec3(0.0f, 0.0f, distance);
+		path.keys.push_back({ 0.0f, start, 0.0f });
+		path.keys.push_back({ seconds * 0.25f, end, 0.0f });
+		path.keys.push_back({ seconds * 0.5f, end, 180.0f });
+		path.keys.push_back({ seconds * 0.75f, start, 180.0f });
+		path.keys.push_back({ seconds, start, 360.0f });
+		return path;
+	}
+};
+#endif
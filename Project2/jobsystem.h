@@ -0,0 +1,167 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+// A small work-stealing thread pool. Every thread (the calling thread included) owns a queue;
+// a thread pops work from the back of its own queue and steals from the front of the others when it runs dry.
+class JobSystem
+{
+public:
+	// threadCount includes the calling thread, 0 means one thread per hardware core
+	JobSystem(unsigned int threadCount = 0)
+	{
+		if (threadCount == 0)
+			threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0)
+			threadCount = 1;
+
+		queues = std::vector<WorkQueue>(threadCount);
+		// queue 0 belongs to the thread that calls parallelFor, the rest get a worker each
+		for (unsigned int i = 1; i < threadCount; i++)
+			workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+	}
+
+	~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			stopping = true;
+		}
+		wakeCondition.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	// 1, 2, 4, ... threads, always ending with one per core. the thread counts benchmarks scale over
+	static std::vector<unsigned int> benchmarkThreadCounts()
+	{
+		unsigned int maxThreads = std::thread::hardware_concurrency();
+		std::vector<unsigned int> counts;
+		for (unsigned int threads = 1; threads < maxThreads; threads *= 2)
+			counts.push_back(threads);
+		counts.push_back(maxThreads > 0 ? maxThreads : 1);
+		return counts;
+	}
+
+	unsigned int threadCount() const
+	{
+		return (unsigned int)queues.size();
+	}
+
+	// splits [0, count) into chunks of at most grain items and runs fn(begin, end) on every chunk.
+	// blocks until all chunks are done; the calling thread works on chunks while it waits.
+	void parallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)>& fn)
+	{
+		if (count == 0)
+			return;
+		if (grain == 0)
+			grain = 1;
+		unsigned int chunks = (count + grain - 1) / grain;
+		if (queues.size() == 1 || chunks == 1)
+		{
+			fn(0, count);
+			return;
+		}
+
+		std::atomic<unsigned int> remaining(chunks);
+		for (unsigned int c = 0; c < chunks; c++)
+		{
+			unsigned int begin = c * grain;
+			unsigned int end = begin + grain < count ? begin + grain : count;
+			push(c % queues.size(), [&fn, &remaining, begin, end]() {
+				PROFILE_SCOPE("parallelFor chunk");
+				fn(begin, end);
+				remaining.fetch_sub(1, std::memory_order_release);
+			});
+		}
+
+		while (remaining.load(std::memory_order_acquire) > 0)
+		{
+			if (!runOne(0))
+				std::this_thread::yield();
+		}
+	}
+
+private:
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> jobs;
+	};
+
+	std::vector<WorkQueue> queues;
+	std::vector<std::thread> workers;
+	std::atomic<unsigned int> pendingJobs{ 0 };
+	std::mutex wakeMutex;
+	std::condition_variable wakeCondition;
+	bool stopping = false;
+
+	void push(unsigned int queueIndex, std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(queues[queueIndex].mutex);
+			queues[queueIndex].jobs.push_back(std::move(job));
+		}
+		pendingJobs.fetch_add(1);
+		{
+			// take the lock so a worker between its predicate check and wait() can't miss the wake-up
+			std::lock_guard<std::mutex> lock(wakeMutex);
+		}
+		wakeCondition.notify_one();
+	}
+
+	// runs one job from the own queue, or steals one from another queue. returns false if there was nothing to do
+	bool runOne(unsigned int self)
+	{
+		std::function<void()> job;
+		{
+			WorkQueue& own = queues[self];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.jobs.empty())
+			{
+				job = std::move(own.jobs.back());
+				own.jobs.pop_back();
+			}
+		}
+		for (unsigned int i = 1; !job && i < queues.size(); i++)
+		{
+			WorkQueue& victim = queues[(self + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty())
+			{
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+			}
+		}
+		if (!job)
+			return false;
+
+		pendingJobs.fetch_sub(1);
+		job();
+		return true;
+	}
+
+	void workerLoop(unsigned int index)
+	{
+		Profiler::instance().setThreadName("worker " + std::to_string(index));
+		while (true)
+		{
+			if (runOne(index))
+				continue;
+
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wakeCondition.wait(lock, [this]() { return stopping || pendingJobs.load() > 0; });
+			if (stopping && pendingJobs.load() == 0)
+				return;
+		}
+	}
+};
+#endif
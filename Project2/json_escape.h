@@ -0,0 +1,33 @@
+#ifndef JSON_ESCAPE_H
+#define JSON_ESCAPE_H
+
+#include <cstdio>
+#include <string>
+
+// text as the inside of a json string: quotes and backslashes escaped, control characters as \n, \t or \u00XX
+inline std::string jsonEscaped(const std::string& text)
+{
+	std::string result;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			result += '\\';
+			result += c;
+		}
+		else if (c == '\n')
+			result += "\\n";
+		else if (c == '\t')
+			result += "\\t";
+		else if ((unsigned char)c < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+			result += code;
+		}
+		else
+			result += c;
+	}
+	return result;
+}
+#endif
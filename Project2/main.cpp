@@ -11,11 +11,29 @@
 #include <../camera.h>
 #include "model.h"
 #include "utils.h"
+#include "crowd.h"
+#include "cpu_skinning.h"
+#include "palette_buffer.h"
+#include "anim_bake.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "texture_array.h"
+#include "virtual_texture.h"
+#include "mip_feedback.h"
+#include "texture_budget.h"
+#include "sampler_cache.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "profiler_view.h"
+#include "gpu_timer.h"
+#include "asset_benchmarks.h"
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assimp/Importer.hpp>
 #include <unordered_map>
 #include <cstdlib>
+#include <cfloat>
+#include <chrono>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <iostream>
@@ -24,6 +42,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 
 
 // settings
@@ -62,18 +81,139 @@ float selfRotation = 0.0f;
 Camera camera1(true,rotate_step,x_position, y_position, z_position,glm::vec3(0.0f, 0.0f, 0.0f));
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
+// set by a left click, the pick runs in the render loop where the matrices are known
+bool pickRequested = false;
 
 
 
-int main()
+int main(int argc, char** argv)
 {
+	// command line benchmarks only need the CPU, they run and exit before any window is created
+	// ------------------------------------------------------------------------------------------
+	Profiler::instance().setThreadName("main");
+	bool streamTextures = false;
+	bool buildAtlases = false;
+	HeadlessOptions headless;
+	std::string recordPath;
+	// where the profiler's Chrome trace goes, also written on exit when it was given on the command line
+	std::string traceFile = "profile_trace.json";
+	bool writeTraceOnExit = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		// not a benchmark: load the model's textures coarse mips first and stream the rest, see streamed_texture.h
+		if (arg == "--stream-textures")
+			streamTextures = true;
+		// not a benchmark either: --headless [frames] renders the camera path offscreen and exits, see headless.h
+		if (arg == "--headless")
+		{
+			headless.enabled = true;
+			if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+				headless.frames = (unsigned int)std::atoi(argv[++i]);
+		}
+		if (arg == "--dump-frames" && i + 1 < argc)
+		{
+			headless.dumpDirectory = argv[++i];
+			if (headless.dumpEvery == 0)
+				headless.dumpEvery = 60;
+		}
+		if (arg == "--dump-every" && i + 1 < argc)
+			headless.dumpEvery = (unsigned int)std::atoi(argv[++i]);
+		if (arg == "--egl")
+			headless.egl = true;
+		if (arg == "--camera-path" && i + 1 < argc)
+			headless.cameraPath = argv[++i];
+		if (arg == "--bench-json" && i + 1 < argc)
+			headless.jsonOutput = argv[++i];
+		if (arg == "--warmup" && i + 1 < argc)
+			headless.warmupFrames = (unsigned int)std::atoi(argv[++i]);
+		// interactive runs: the camera is written as a path for --camera-path when the window closes
+		if (arg == "--record-path" && i + 1 < argc)
+			recordPath = argv[++i];
+		if (arg == "--bench-crowd")
+		{
+			benchmarkCrowd("../Project2/resources/man/model.dae", { 1000, 2500, 5000, 10000 });
+			return 0;
+		}
+		if (arg == "--bench-skinning")
+		{
+			benchmarkCpuSkinning("../Project2/resources/man/model.dae");
+			return 0;
+		}
+		if (arg == "--bench-culling")
+		{
+			benchmarkFrustumCulling(100000);
+			return 0;
+		}
+		if (arg == "--bench-bvh")
+		{
+			benchmarkBVH(100000);
+			return 0;
+		}
+		if (arg == "--bench-profiler")
+		{
+			std::cout << "profiler zone overhead: " << measureProfilerOverhead() << " ns" << std::endl;
+			return 0;
+		}
+		if (arg == "--trace" && i + 1 < argc)
+		{
+			traceFile = argv[++i];
+			writeTraceOnExit = true;
+		}
+		if (arg == "--bench-occlusion")
+			return benchmarkOcclusion() ? 0 : 1;
+		// --bench-micro [filter]: the asset microbenchmarks, as json too when --bench-json is given anywhere
+		if (arg == "--bench-micro")
+		{
+			std::string filter = i + 1 < argc && argv[i + 1][0] != '-' ? argv[i + 1] : "";
+			std::string json;
+			for (int j = 1; j + 1 < argc; j++)
+			{
+				if (std::string(argv[j]) == "--bench-json")
+					json = argv[j + 1];
+			}
+			return runMicroBenchmarks(filter, json);
+		}
+		if (arg == "--test-lod")
+			return testLodErrorScaling() ? 0 : 1;
+		if (arg == "--bench-lod")
+		{
+			benchmarkMeshLod("../Project2/resources/wineglass.FBX");
+			benchmarkMeshLod("../Project2/resources/teapot.FBX");
+			return 0;
+		}
+		// not a benchmark: packs the model's small textures, saves the atlases for later runs to load and exits
+		if (arg == "--build-atlas")
+			buildAtlases = true;
+		// offline virtual texture tiles: --bake-vt image, written next to it as image.vtex
+		if (arg == "--bake-vt" && i + 1 < argc)
+		{
+			stbi_set_flip_vertically_on_load(true);
+			std::string image = argv[i + 1];
+			return bakeVirtualTexture(image, image + ".vtex") ? 0 : 1;
+		}
+	}
+
 	// glfw: initialize and configure
 	// ------------------------------
-	glfwInit();
+#ifdef GLFW_PLATFORM_NULL
+	// GLFW 3.4 can run without a display, the context then has to come from EGL or OSMesa
+	if (headless.enabled)
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
+	if (!glfwInit())
+	{
+		std::cout << "Failed to initialize GLFW" << std::endl;
+		return -1;
+	}
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	if (headless.enabled)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	if (headless.egl)
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
 	
 	
 	// glfw window creation
@@ -87,6 +227,8 @@ int main()
 	}
 	glfwMakeContextCurrent(window);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	glfwSetCursorPosCallback(window, mouse_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
 
 
 	// tell GLFW to capture our mouse
@@ -100,6 +242,9 @@ int main()
 		return -1;
 	}
 	
+	if (headless.enabled)
+		std::cout << "headless: " << headless.frames << " frames on " << glGetString(GL_RENDERER) << std::endl;
+	
 	// tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
 	stbi_set_flip_vertically_on_load(true);
 
@@ -113,10 +258,147 @@ int main()
 	
 	// load models
 	// -----------
-	Model ourModel("../Project2/resources/ground.fbx");
+	TextureStreamer textureStreamer;
+	// the model's meshes are converted on it while loading, later it runs the culling and the feedback reductions
+	JobSystem jobs;
+	double loadStart = glfwGetTime();
+	Model ourModel("../Project2/resources/ground.fbx", false, true, streamTextures ? &textureStreamer : nullptr, &jobs);
+	std::cout << "model loaded in " << (glfwGetTime() - loadStart) * 1000.0 << " ms" << (streamTextures ? " (textures streamed)" : "") << std::endl;
+	ourModel.generateLods();
+	// before the texture arrays are built, they then see the atlases instead of the small textures.
+	// streamed textures don't have their finest levels yet, they stay out of atlases, arrays and the virtual texture
+	const std::string bakedAtlases = "../Project2/resources/small_textures.";
+	if (!streamTextures)
+		ourModel.atlasSmallTextures(1024, 4096, buildAtlases ? "" : bakedAtlases);
+	if (buildAtlases)
+	{
+		if (streamTextures || !ourModel.saveAtlases(bakedAtlases))
+			std::cout << "ERROR::MAIN::ATLASES_NOT_SAVED" << std::endl;
+		// no frames, the usual teardown runs
+		glfwSetWindowShouldClose(window, true);
+		headless.frames = 0;
+	}
 
 	//load Shader
 	Shader lightingShader("../Project2/effect.vs", "../Project2/effect.fs");
+	// the walking character, skinned on the GPU from a bone palette in a texture buffer (skinning.vs). it's posed
+	// as a crowd of one, at the rate the animation LOD picks for its size on screen. the palette ids are the bone
+	// ids Model gives the vertices
+	Model character("../Project2/resources/man/model.dae");
+	AnimatedModel characterRig;
+	bool characterLoaded = loadAnimatedModel("../Project2/resources/man/model.dae", characterRig);
+	bool drawCharacter = characterLoaded;
+	const float characterScale = 0.04f;
+	Crowd characterCrowd(characterRig.skeleton, characterRig.globalInverseTransform);
+	AnimLodScheduler characterLod;
+	std::vector<AnimLodState> characterLodStates;
+	std::vector<glm::vec3> characterPositions(1);
+	BoundingSphere characterBounds;
+	if (characterLoaded)
+	{
+		characterCrowd.addClip(characterRig.animation);
+		characterCrowd.resize(1);
+		AABB box = computeAABB(&characterRig.vertices[0].position, characterRig.vertices.size(), sizeof(SkinnedVertex));
+		characterBounds = computeBoundingSphere(&characterRig.vertices[0].position, characterRig.vertices.size(), sizeof(SkinnedVertex), box);
+	}
+	std::vector<glm::mat4> characterPalette(std::max(characterCrowd.skeleton.paletteSize, (unsigned int)character.boneCounter), glm::mat4(1.0f));
+	BonePaletteBuffer characterBones((unsigned int)characterPalette.size());
+	Shader skinningShader("../Project2/skinning.vs", "../Project2/effect.fs");
+	// a background crowd of the same character playing its clip from a baked texture, one instanced draw
+	Shader bakedCrowdShader("../Project2/baked_crowd.vs", "../Project2/baked_crowd.fs");
+	BakedAnimation bakedClip;
+	unsigned int crowdVAO = 0;
+	unsigned int crowdDiffuse = 0;
+	if (characterLoaded)
+	{
+		bakedClip = bakeAnimation(characterRig, 30.0f, false);
+		crowdVAO = createVertexArray(characterRig.vertices, characterRig.indices);
+		crowdDiffuse = createTexture("../Project2/resources/man/diffuse.png");
+	}
+	BakedCrowd bakedCrowd(crowdVAO, (unsigned int)characterRig.indices.size());
+	// the same character skinned on the CPU into a mapped buffer instead of by skinning.vs, the default of
+	// headless runs. positions and normals come from the stream, the uvs from the rig's static buffer
+	Shader cpuSkinnedShader("../Project2/cpu_skinned.vs", "../Project2/baked_crowd.fs");
+	unsigned int cpuSkinnedVAO = 0;
+	SkinnedVertexStream characterStream(characterLoaded ? (unsigned int)characterRig.vertices.size() : 0);
+	bool cpuSkinning = headless.enabled;
+	if (characterLoaded)
+	{
+		cpuSkinnedVAO = createVertexArray(characterRig.vertices, characterRig.indices);
+		glBindVertexArray(cpuSkinnedVAO);
+		characterStream.attach();
+		glBindVertexArray(0);
+	}
+	bool drawBakedCrowd = characterLoaded;
+	{
+		// a grid beside the start position, every character a bit further into the clip than its neighbour
+		std::vector<BakedInstance> instances;
+		for (int row = 0; row < 8; row++)
+		{
+			for (int column = 0; column < 8; column++)
+			{
+				BakedInstance instance;
+				instance.model = glm::translate(glm::mat4(1.0f), glm::vec3(x_position + 1.0f + column * 0.4f, y_position, z_position - 1.0f - row * 0.4f));
+				instance.model = glm::rotate(instance.model, -90.0f, glm::vec3(1, 0, 0));
+				instance.model = glm::scale(instance.model, glm::vec3(0.04f));
+				instance.timeOffset = (row * 8 + column) * 0.37f;
+				instances.push_back(instance);
+			}
+		}
+		bakedCrowd.setInstances(instances);
+	}
+	// the largest diffuse map is streamed from a virtual texture, its tiles are baked on the first run.
+	// units 12 and 13, above the texture arrays
+	Shader virtualShader("../Project2/effect.vs", "../Project2/effect_vt.fs");
+	Shader feedbackShader("../Project2/effect.vs", "../Project2/vt_feedback.fs");
+	VirtualTexture virtualTexture;
+	bool useVirtualTexture = false;
+	const Texture* virtualSource = streamTextures ? nullptr : ourModel.largestDiffuseTexture();
+	if (virtualSource)
+	{
+		std::string image = ourModel.directory + "/" + virtualSource->path;
+		std::string tiles = image + ".vtex";
+		if ((std::ifstream(tiles.c_str()).good() || bakeVirtualTexture(image, tiles)) && virtualTexture.open(tiles, 16, SCR_WIDTH, SCR_HEIGHT))
+		{
+			virtualTexture.setupShader(virtualShader, 12, 13);
+			virtualTexture.setupShader(feedbackShader, 12, 13);
+			useVirtualTexture = ourModel.useVirtualTexture(virtualSource->id) > 0;
+		}
+	}
+	// same lighting, textures from the texture arrays. the arrays use units 4-11, above the mesh textures.
+	// built after the virtual texture is set up, the diffuse maps it replaces don't have to be kept
+	Shader arrayShader("../Project2/effect.vs", "../Project2/effect_array.fs");
+	TextureArrayLibrary textureArrays;
+	if (!streamTextures)
+		textureArrays.build(ourModel.meshes);
+	textureArrays.setupShader(arrayShader, 4);
+	// the released originals can't be drawn any more, so the arrays can't be switched off
+	const bool useTextureArrays = !textureArrays.arrays.empty();
+	// which mip levels the screen samples, measured every frame. drives the texture streaming when it is on
+	Shader mipFeedbackShader("../Project2/effect.vs", "../Project2/mip_feedback.fs");
+	MipFeedback mipFeedback;
+	mipFeedback.create(SCR_WIDTH, SCR_HEIGHT);
+	for (std::map<unsigned int, TextureArrayPlacement>::const_iterator it = textureArrays.placement.begin(); it != textureArrays.placement.end(); ++it)
+	{
+		if (it->second.released)
+			mipFeedback.setTextureSize(it->first, glm::ivec2(textureArrays.arrays[it->second.array].width, textureArrays.arrays[it->second.array].height));
+	}
+	bool useMipFeedback = true;
+	// evicts fine mips of the least recently visible textures when they don't fit, needs the mip feedback
+	TextureBudget textureBudget;
+	textureBudget.track(ourModel.meshes, streamTextures ? &textureStreamer : nullptr, &textureArrays);
+	bool useTextureBudget = true;
+	int textureBudgetMB = (int)(textureBudget.budgetBytes >> 20);
+	// sampling policy of every texture type, switched in the Sampling window. off samples with the parameters the
+	// textures were loaded with
+	SamplerCache samplerCache;
+	const char* samplerTypes[] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+	SamplerDesc samplerPolicies[4];
+	bool samplerEnabled[4] = { false, false, false, false };
+	int samplerAnisotropy[4] = { 0, 0, 0, 0 };		// log2 of the anisotropy
+	// the texture arrays and the virtual texture cache hold diffuse and normal maps together, they follow the diffuse policy
+	unsigned int arraySampler = 0;
+	unsigned int virtualCacheSampler = 0;
 	lightingShader.use();
 	
 
@@ -127,20 +409,91 @@ int main()
 	ImGui_ImplGlfw_InitForOpenGL(window, true);
 	ImGui_ImplOpenGL3_Init(glsl_version);
 	ImGui::StyleColorsDark();
+	// visibility counters of the previous frame
+	CullStats cullStats;
+	// hierarchy over the world space bounds of every mesh, refit each frame so moving the model keeps it valid
+	BVH sceneBVH;
+	vector<AABB> meshWorldBounds(ourModel.meshes.size());
+	vector<unsigned int> visibleMeshes;
+	int pickedMesh = -1;
+	int nearestMesh = -1;
+	// software occlusion culling, the biggest visible meshes are the occluders
+	OcclusionCuller occlusion(320, 240);
+	bool occlusionCulling = true;
+	unsigned int occludedMeshes = 0;
+	vector<unsigned int> occluders;
+	// largest simplification error in pixels a mesh level may show
+	float lodPixelError = 1.0f;
+	// draws are sorted by state and issued through a cache that drops redundant GL calls
+	RenderQueue renderQueue;
+	GLStateCache glState;
+	GLCallStats glCalls;
+	// headless runs draw into an offscreen target along a fixed camera path
+	OffscreenTarget offscreen;
+	CameraPath cameraPath = CameraPath::walkAndTurn(glm::vec3(x_position, y_position, z_position));
+	CameraPath recordedPath;
+	BenchmarkRun benchmark;
+	GpuFrameTimer gpuTimer;
+	// GPU time of every pass, graphed in the GPU passes window
+	GpuPassTimer gpuPasses;
+	unsigned int frameIndex = 0;
+	int exitCode = 0;
+	if (headless.enabled)
+	{
+		if (!offscreen.create(SCR_WIDTH, SCR_HEIGHT) || (!headless.cameraPath.empty() && !cameraPath.load(headless.cameraPath)))
+		{
+			// no frames, but everything is still released below while the context is there
+			headless.frames = 0;
+			exitCode = -1;
+		}
+		benchmark.path = headless.cameraPath.empty() ? "walkAndTurn" : headless.cameraPath;
+		benchmark.warmupFrames = headless.warmupFrames;
+		benchmark.timestep = headless.timestep;
+		benchmark.width = SCR_WIDTH;
+		benchmark.height = SCR_HEIGHT;
+		benchmark.renderer = (const char*)glGetString(GL_RENDERER);
+		benchmark.settings.push_back(std::make_pair("frames", std::to_string(headless.frames)));
+		benchmark.settings.push_back(std::make_pair("streamTextures", streamTextures ? "true" : "false"));
+		benchmark.settings.push_back(std::make_pair("textureArrays", useTextureArrays ? "true" : "false"));
+		benchmark.settings.push_back(std::make_pair("virtualTexture", useVirtualTexture ? "true" : "false"));
+		benchmark.settings.push_back(std::make_pair("mipFeedback", useMipFeedback ? "true" : "false"));
+		benchmark.settings.push_back(std::make_pair("textureBudgetMB", std::to_string(textureBudgetMB)));
+		benchmark.settings.push_back(std::make_pair("occlusionCulling", occlusionCulling ? "true" : "false"));
+		benchmark.settings.push_back(std::make_pair("meshletCulling", ourModel.meshletCulling ? "true" : "false"));
+		benchmark.settings.push_back(std::make_pair("lodPixelError", std::to_string(lodPixelError)));
+		benchmark.settings.push_back(std::make_pair("cpuSkinning", cpuSkinning ? "true" : "false"));
+	}
 	// render loop
 	// -----------
-	while (!glfwWindowShouldClose(window))
+	while (headless.enabled ? frameIndex < headless.frames : !glfwWindowShouldClose(window))
 	{
+		PROFILE_SCOPE("frame");
+		std::chrono::high_resolution_clock::time_point frameStart = std::chrono::high_resolution_clock::now();
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
 		ImGui::NewFrame();
 		
 		
-		float elapsedTime = (float)glfwGetTime();
+		float elapsedTime = headless.enabled ? frameIndex * headless.timestep : (float)glfwGetTime();
 		deltaTime = elapsedTime - lastFrame;
 		float dAngle = elapsedTime * 0.002;
 		lastFrame = elapsedTime;
-		processInput(window);
+		if (headless.enabled)
+		{
+			glm::vec3 position;
+			cameraPath.sample(elapsedTime, position, rotate_step);
+			x_position = position.x;
+			y_position = position.y;
+			z_position = position.z;
+			current_speed = 0.0f;
+			current_rotate_speed = 0.0f;
+		}
+		else
+		{
+			processInput(window);
+			if (!recordPath.empty())
+				recordedPath.keys.push_back({ elapsedTime, glm::vec3(x_position, y_position, z_position), rotate_step });
+		}
 		rotate_step += current_rotate_speed * deltaTime;
 		float distance = current_speed * deltaTime;
 
@@ -157,6 +510,7 @@ int main()
 		bool show_another_window = false;
 		ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 		{
+			PROFILE_SCOPE("imgui windows");
 			static float f = 0.0f;
 			static int counter = 0;
 
@@ -165,16 +519,186 @@ int main()
 			ImGui::SliderFloat("Y", &y_position, -500.0f, 500.0f);
 			ImGui::SliderFloat("Z", &z_position, 0.0f, 1000.0f);
 			ImGui::SliderFloat3("Light Position", &lightPos.x, 0.0f, 1000.0f);
+			ImGui::Text("Meshes visible: %u  culled: %u", cullStats.visible, cullStats.tested - cullStats.visible);
+			ImGui::Text("Picked mesh: %d  nearest to player: %d", pickedMesh, nearestMesh);
+			ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+			ImGui::Text("Occluded meshes: %u  occluder triangles: %u", occludedMeshes, occlusion.stats.occluderTriangles);
+			ImGui::SliderFloat("LOD pixel error", &lodPixelError, 0.0f, 16.0f);
+			unsigned int trianglesDrawn = 0;
+			for (unsigned int i = 0; i < MAX_MESH_LODS; i++)
+			{
+				if (ourModel.lodStats.meshes[i] > 0)
+					ImGui::Text("LOD %u: %u meshes, %u triangles", i, ourModel.lodStats.meshes[i], ourModel.lodStats.triangles[i]);
+				trianglesDrawn += ourModel.lodStats.triangles[i];
+			}
+			ImGui::Text("Triangles/s: %.1f M", deltaTime > 0.0f ? trianglesDrawn / deltaTime * 1e-6f : 0.0f);
+			ImGui::Checkbox("Meshlet culling", &ourModel.meshletCulling);
+			ImGui::Checkbox("Filter redundant GL state", &glState.filtering);
+			if (characterLoaded)
+			{
+				ImGui::Checkbox("Character", &drawCharacter);
+				ImGui::Checkbox("Dual quaternion skinning", &characterBones.dualQuaternion);
+				ImGui::Checkbox("CPU skinning", &cpuSkinning);
+				if (!characterLodStates.empty())
+				{
+					const AnimLodLevel& level = characterLod.levels[characterLodStates[0].level];
+					ImGui::Text("Animation LOD %u: posed every %u frames%s", characterLodStates[0].level, level.updateInterval, level.detailBones ? "" : ", no detail bones");
+				}
+				ImGui::Checkbox("Baked crowd", &drawBakedCrowd);
+				ImGui::Text("Baked crowd: %u characters, %u frames at %.0f fps", bakedCrowd.instanceCount, bakedClip.frameCount, bakedClip.frameRate);
+			}
+			ImGui::Text("Atlases: %u (%.0f%% occupied)  meshes remapped: %u  texture sets: %u -> %u", ourModel.atlasStats.atlases,
+				ourModel.atlasStats.occupancy * 100.0f, ourModel.atlasStats.meshesRemapped, ourModel.atlasStats.materialsBefore, ourModel.atlasStats.materialsAfter);
+			ImGui::Text("Texture arrays: %u  materials: %u", (unsigned int)textureArrays.arrays.size(), (unsigned int)textureArrays.materials.size());
+			if (streamTextures)
+			{
+				const StreamingStats& streaming = textureStreamer.stats;
+				ImGui::Text("Streamed textures: %u  waiting for levels: %u  uploads: %u  resident: %u KB of %u KB", streaming.textures,
+					streaming.pending, streaming.uploads, (unsigned int)(streaming.residentBytes / 1024), (unsigned int)(streaming.fullBytes / 1024));
+			}
+			const TextureBudgetStats& budget = textureBudget.stats;
+			ImGui::Checkbox("Texture budget", &useTextureBudget);
+			ImGui::SliderInt("Budget (MB)", &textureBudgetMB, 1, 512);
+			ImGui::Text("Texture memory: %.1f MB of %.1f MB (budget %d MB%s)  parked in RAM: %.1f MB", budget.residentBytes / 1048576.0f,
+				budget.fullBytes / 1048576.0f, textureBudgetMB, budget.overBudget ? ", over" : "", budget.parkedBytes / 1048576.0f);
+			ImGui::Text("Mip levels evicted: %u  restored: %u", budget.totalEvictions, budget.totalRestores);
+			if (virtualTexture.loaded())
+			{
+				ImGui::Checkbox("Virtual texture", &useVirtualTexture);
+				const VirtualTextureStats& vt = virtualTexture.stats;
+				ImGui::Text("VT tiles requested: %u  resident: %u  pending: %u  uploads: %u  evictions: %u", vt.requested, vt.resident,
+					vt.pending, vt.uploads, vt.evictions);
+				ImGui::Text("VT memory: %u KB (full texture %u KB)", (unsigned int)(vt.cacheBytes / 1024), (unsigned int)(vt.fullBytes / 1024));
+			}
+			ImGui::Text("GL calls: %u issued, %u redundant skipped", glCalls.issued, glCalls.skipped);
+			ImGui::Text("Program switches: %u  VAO binds: %u  texture binds: %u  draws: %u", glCalls.programChanges,
+				glCalls.vaoChanges, glCalls.textureBinds, glCalls.draws);
+			ImGui::Text("Meshlets tested: %u  frustum culled: %u  backface culled: %u", ourModel.meshletStats.tested,
+				ourModel.meshletStats.frustumCulled, ourModel.meshletStats.backfaceCulled);
 		
 
 			ImGui::End();
+
+			// every texture the feedback has seen: the finest level the screen needs, the finest one loaded and
+			// how many feedback pixels need each level
+			ImGui::Begin("Texture residency");
+			ImGui::Checkbox("Mip feedback", &useMipFeedback);
+			ImGui::Text("Feedback reduction: %.2f ms on %u threads", mipFeedback.reduceMilliseconds, jobs.threadCount());
+			if (ImGui::BeginTable("residency", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+			{
+				ImGui::TableSetupColumn("Texture");
+				ImGui::TableSetupColumn("Size");
+				ImGui::TableSetupColumn("Needed");
+				ImGui::TableSetupColumn("Resident");
+				ImGui::TableSetupColumn("Pixels");
+				ImGui::TableSetupColumn("Pixels per level");
+				ImGui::TableHeadersRow();
+				for (std::map<unsigned int, TextureMipUsage>::const_iterator it = mipFeedback.usage.begin(); it != mipFeedback.usage.end(); ++it)
+				{
+					const TextureMipUsage& usage = it->second;
+					std::string name = "texture " + std::to_string(it->first);
+					for (const Texture& texture : ourModel.textures_loaded)
+					{
+						if (texture.id == it->first)
+							name = texture.path;
+					}
+					std::string levels;
+					for (int level = 0; level < usage.levels; level++)
+						levels += std::to_string(usage.histogram[level]) + (level + 1 < usage.levels ? " " : "");
+					int resident = textureStreamer.residentLevel(it->first);
+					if (resident < 0)
+						resident = textureBudget.residentLevel(it->first);
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn();
+					ImGui::TextUnformatted(name.c_str());
+					ImGui::TableNextColumn();
+					ImGui::Text("%dx%d", usage.size.x, usage.size.y);
+					ImGui::TableNextColumn();
+					if (usage.lastSeen == mipFeedback.frame)
+						ImGui::Text("%d", usage.requiredLevel);
+					else
+						ImGui::TextUnformatted("-");
+					ImGui::TableNextColumn();
+					ImGui::Text("%d", resident < 0 ? 0 : resident);
+					ImGui::TableNextColumn();
+					ImGui::Text("%u", usage.pixels);
+					ImGui::TableNextColumn();
+					ImGui::TextUnformatted(levels.c_str());
+				}
+				ImGui::EndTable();
+			}
+			ImGui::End();
+
+			// the filtering of the mesh textures, per texture type. takes effect without touching the textures
+			ImGui::Begin("Sampling");
+			ImGui::Text("Sampler objects: %u  max anisotropy: %.0fx", samplerCache.size(), samplerCache.maxAnisotropy());
+			for (int i = 0; i < 4; i++)
+			{
+				ImGui::PushID(i);
+				SamplerDesc& policy = samplerPolicies[i];
+				bool changed = ImGui::Checkbox(samplerTypes[i], &samplerEnabled[i]);
+				int filter = policy.filter;
+				changed |= ImGui::Combo("Filter", &filter, "Nearest\0Bilinear\0Trilinear\0");
+				policy.filter = (SamplerFilter)filter;
+				int wrap = policy.wrap == GL_MIRRORED_REPEAT ? 1 : policy.wrap == GL_CLAMP_TO_EDGE ? 2 : 0;
+				changed |= ImGui::Combo("Wrap", &wrap, "Repeat\0Mirrored repeat\0Clamp to edge\0");
+				policy.wrap = wrap == 1 ? GL_MIRRORED_REPEAT : wrap == 2 ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+				changed |= ImGui::Combo("Anisotropy", &samplerAnisotropy[i], "Off\0" "2x\0" "4x\0" "8x\0" "16x\0");
+				policy.anisotropy = (float)(1 << samplerAnisotropy[i]);
+				changed |= ImGui::SliderFloat("LOD bias", &policy.lodBias, -2.0f, 2.0f);
+				// quarter steps, dragging the slider would otherwise make a sampler for every value it passes
+				policy.lodBias = std::floor(policy.lodBias * 4.0f + 0.5f) / 4.0f;
+				if (changed)
+					ourModel.setSampler(samplerTypes[i], samplerEnabled[i] ? samplerCache.get(policy) : 0);
+				if (changed && i == 0)
+				{
+					SamplerDesc clamped = policy;
+					clamped.wrap = GL_CLAMP_TO_EDGE;
+					arraySampler = samplerEnabled[i] ? samplerCache.get(policy) : 0;
+					virtualCacheSampler = samplerEnabled[i] ? samplerCache.get(clamped) : 0;
+				}
+				ImGui::PopID();
+				ImGui::Separator();
+			}
+			ImGui::End();
+
+			drawProfilerWindow(traceFile);
+
+			ImGui::Begin("GPU passes");
+			ImGui::Text("Timestamps read %d frames late, frames dropped: %u", GPU_TIMER_FRAMES, gpuPasses.droppedFrames);
+			for (const GpuPassHistory& pass : gpuPasses.passes)
+			{
+				char overlay[64];
+				snprintf(overlay, sizeof(overlay), "%.3f ms (average %.3f ms)", pass.last, pass.average());
+				ImGui::PlotLines(pass.name.c_str(), pass.milliseconds, GPU_TIMER_HISTORY, pass.next, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+			}
+			ImGui::End();
 		}
 		// render
 		// ------
+		// the feedback passes go back to framebuffer 0 when they are done, the main pass is drawn before them
+		if (headless.enabled)
+		{
+			offscreen.bind();
+			gpuTimer.begin();
+		}
+		gpuPasses.beginFrame();
+		// the scene pass includes the virtual texture tile uploads
+		gpuPasses.begin("scene");
 		glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glViewport(0, 0, 1200, 900);
-		lightingShader.use();
+		// tiles asked for by the feedback of an earlier frame. uploading them binds textures behind the cache's
+		// back, so it happens before the cache is reset
+		if (useVirtualTexture)
+		{
+			PROFILE_SCOPE("virtual texture update");
+			virtualTexture.update();
+		}
+		// ImGui and the code below set GL state without the cache
+		glState.invalidate();
+		glState.resetStats();
+		glState.useProgram(lightingShader.ID);
 		lightingShader.setVec3("lightPos", lightPos);
 		lightingShader.setVec3("viewPos", camera1.Position);
 
@@ -193,27 +717,278 @@ int main()
 		//model2 = glm::scale(model2, glm::vec3(2.1f, 2.1f, 2.1f));
 		model2 = glm::rotate(model2, 90.0f, glm::vec3(1, 0, 0));
 		lightingShader.setMat4("model", model2);
+		if (useTextureArrays)
+		{
+			glState.useProgram(arrayShader.ID);
+			arrayShader.setVec3("lightPos", lightPos);
+			arrayShader.setVec3("viewPos", camera1.Position);
+			arrayShader.setMat4("projection", projectionMatrix);
+			arrayShader.setMat4("view", viewMatrix);
+			arrayShader.setMat4("model", model2);
+			textureArrays.bind(glState, 4, 0, arraySampler);
+		}
+		if (useVirtualTexture)
+		{
+			glState.useProgram(virtualShader.ID);
+			virtualShader.setVec3("lightPos", lightPos);
+			virtualShader.setVec3("viewPos", camera1.Position);
+			virtualShader.setMat4("projection", projectionMatrix);
+			virtualShader.setMat4("view", viewMatrix);
+			virtualShader.setMat4("model", model2);
+			virtualTexture.bind(glState, 12, 13, virtualCacheSampler);
+		}
 		
-		ourModel.Draw(lightingShader);
+		{
+			PROFILE_SCOPE("culling");
+			for (unsigned int i = 0; i < ourModel.meshes.size(); i++)
+				meshWorldBounds[i] = ourModel.meshes[i].bounds.transformed(model2);
+			if (sceneBVH.nodes.empty())
+				sceneBVH.build(meshWorldBounds);
+			else
+				sceneBVH.refit(meshWorldBounds);
+
+			visibleMeshes.clear();
+			sceneBVH.cull(extractFrustum(viewProjectionMatrix), visibleMeshes);
+			cullStats.tested = (unsigned int)ourModel.meshes.size();
+		}
+		occludedMeshes = 0;
+		if (occlusionCulling)
+		{
+			PROFILE_SCOPE("occlusion culling");
+			occluders = visibleMeshes;
+			std::sort(occluders.begin(), occluders.end(), [&](unsigned int a, unsigned int b) {
+				return glm::length(meshWorldBounds[a].extents()) > glm::length(meshWorldBounds[b].extents());
+			});
+			occlusion.begin(viewProjectionMatrix);
+			// a big mesh over the remaining triangle budget is passed over, smaller ones after it may still fit
+			for (unsigned int i : occluders)
+			{
+				const Mesh& mesh = ourModel.meshes[i];
+				occlusion.addOccluder(mesh.vertices.data(), sizeof(Vertex), mesh.indices.data(), mesh.indices.size(), model2);
+			}
+			occlusion.render(jobs);
+			occludedMeshes = occlusion.cull(meshWorldBounds, visibleMeshes);
+		}
+		cullStats.visible = (unsigned int)visibleMeshes.size();
+		{
+			PROFILE_SCOPE("lod selection and submit");
+			ourModel.selectLods(model2, camera1.Position, projectionMatrix, (float)SCR_HEIGHT, lodPixelError);
+			ourModel.setMeshletView(model2, viewProjectionMatrix, camera1.Position);
+			ourModel.submit(renderQueue, lightingShader, visibleMeshes, model2, camera1.Position, useTextureArrays ? &arrayShader : nullptr,
+				useVirtualTexture ? &virtualShader : nullptr);
+		}
+		{
+			PROFILE_SCOPE("render queue flush");
+			renderQueue.flush(glState);
+			glCalls = glState.stats;
+		}
+		if (drawCharacter)
+		{
+			PROFILE_SCOPE("character");
+			// stands where the player is and turns with it. the palette keeps the file's z up axis
+			glm::mat4 characterModel = glm::translate(glm::mat4(1.0f), glm::vec3(x_position, y_position, z_position));
+			characterModel = glm::rotate(characterModel, -rotate_step, glm::vec3(0, 1, 0));
+			characterModel = glm::rotate(characterModel, -90.0f, glm::vec3(1, 0, 0));
+			characterModel = glm::scale(characterModel, glm::vec3(characterScale));
+			// far away or small on screen it's posed every few frames, between them the palette is interpolated or kept
+			characterPositions[0] = glm::vec3(characterModel * glm::vec4(characterBounds.center, 1.0f));
+			characterLod.schedule(characterPositions, characterBounds.radius * characterScale, camera1.Position, projectionMatrix, characterLodStates);
+			characterCrowd.update(jobs, deltaTime, characterLod, characterLodStates);
+			std::copy(characterCrowd.instancePalette(0), characterCrowd.instancePalette(0) + characterCrowd.skeleton.paletteSize, characterPalette.begin());
+			if (cpuSkinning)
+			{
+				characterStream.update(jobs, characterRig.vertices, characterPalette.data());
+				cpuSkinnedShader.use();
+				cpuSkinnedShader.setMat4("projection", projectionMatrix);
+				cpuSkinnedShader.setMat4("view", viewMatrix);
+				cpuSkinnedShader.setMat4("model", characterModel);
+				cpuSkinnedShader.setVec3("lightDirection", lightPos - glm::vec3(x_position, y_position, z_position));
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, crowdDiffuse);
+				glBindSampler(0, 0);
+				cpuSkinnedShader.setInt("diffuseMap", 0);
+				glBindVertexArray(cpuSkinnedVAO);
+				glDrawElements(GL_TRIANGLES, (GLsizei)characterRig.indices.size(), GL_UNSIGNED_INT, 0);
+				glBindVertexArray(0);
+			}
+			else
+			{
+				characterBones.upload(characterPalette);
+				skinningShader.use();
+				skinningShader.setMat4("projection", projectionMatrix);
+				skinningShader.setMat4("view", viewMatrix);
+				skinningShader.setMat4("model", characterModel);
+				skinningShader.setVec3("lightPos", lightPos);
+				skinningShader.setVec3("viewPos", camera1.Position);
+				skinningShader.setInt("paletteOffset", 0);
+				// above the units of the mesh textures, the arrays and the virtual texture
+				characterBones.bind(skinningShader, 14);
+				character.Draw(skinningShader);
+			}
+			// the draw binds behind the state cache's back
+			glState.invalidate();
+		}
+		if (drawBakedCrowd)
+		{
+			PROFILE_SCOPE("baked crowd");
+			bakedCrowdShader.use();
+			bakedCrowdShader.setMat4("projection", projectionMatrix);
+			bakedCrowdShader.setMat4("view", viewMatrix);
+			bakedCrowdShader.setVec3("lightDirection", lightPos - glm::vec3(x_position, y_position, z_position));
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, crowdDiffuse);
+			glBindSampler(0, 0);
+			bakedCrowdShader.setInt("diffuseMap", 0);
+			bakedCrowd.Draw(bakedCrowdShader, bakedClip, elapsedTime);
+			glState.invalidate();
+		}
+		gpuPasses.end();
+		if (useVirtualTexture)
+		{
+			PROFILE_SCOPE("virtual texture feedback");
+			gpuPasses.begin("virtual texture feedback");
+			virtualTexture.beginFeedback(feedbackShader);
+			feedbackShader.setMat4("projection", projectionMatrix);
+			feedbackShader.setMat4("view", viewMatrix);
+			feedbackShader.setMat4("model", model2);
+			ourModel.drawVirtualTextured(feedbackShader, visibleMeshes);
+			virtualTexture.endFeedback();
+			gpuPasses.end();
+			glViewport(0, 0, 1200, 900);
+			glState.invalidate();
+		}
+		if (useMipFeedback)
+		{
+			PROFILE_SCOPE("mip feedback");
+			gpuPasses.begin("mip feedback");
+			// the feedback of two frames ago is reduced before this frame's is drawn
+			mipFeedback.update(jobs, ourModel.meshes);
+			mipFeedbackShader.use();
+			mipFeedbackShader.setMat4("projection", projectionMatrix);
+			mipFeedbackShader.setMat4("view", viewMatrix);
+			mipFeedbackShader.setMat4("model", model2);
+			mipFeedback.render(mipFeedbackShader, ourModel.meshes, visibleMeshes);
+			gpuPasses.end();
+			glViewport(0, 0, 1200, 900);
+			glState.invalidate();
+		}
+		// after the draws, the uploads bind textures behind the state cache's back. the measured levels are used
+		// once there are any, the estimate from the mesh sizes until then
+		// the budget only restores levels that fit, streamed ones through textureStreamer.require()
+		{
+			PROFILE_SCOPE("texture budget and streaming");
+			gpuPasses.begin("texture uploads");
+			bool budgetTextures = useTextureBudget && useMipFeedback && mipFeedback.frame > 0;
+			if (budgetTextures)
+			{
+				textureBudget.budgetBytes = (size_t)textureBudgetMB << 20;
+				textureBudget.update(mipFeedback);
+			}
+			if (streamTextures)
+			{
+				if (!budgetTextures && useMipFeedback && mipFeedback.frame > 0)
+				{
+					for (std::map<unsigned int, TextureMipUsage>::const_iterator it = mipFeedback.usage.begin(); it != mipFeedback.usage.end(); ++it)
+					{
+						if (it->second.lastSeen == mipFeedback.frame)
+							textureStreamer.require(it->first, it->second.requiredLevel);
+					}
+				}
+				else if (!budgetTextures)
+					ourModel.requireTextureLevels(visibleMeshes, model2, camera1.Position, projectionMatrix, (float)SCR_HEIGHT);
+				textureStreamer.update(deltaTime);
+			}
+			gpuPasses.end();
+		}
+		if (pickRequested)
+		{
+			PROFILE_SCOPE("picking");
+			glm::vec3 rayOrigin, rayDirection;
+			screenRay(lastX, lastY, (float)SCR_WIDTH, (float)SCR_HEIGHT, projectionMatrix, viewMatrix, rayOrigin, rayDirection);
+			float hitDistance;
+			pickedMesh = sceneBVH.raycast(rayOrigin, rayDirection, hitDistance);
+			pickRequested = false;
+		}
+		float nearestDistance;
+		nearestMesh = sceneBVH.nearest(glm::vec3(x_position, y_position, z_position), nearestDistance);
 
 
 
 		ImGui::Render();
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		if (headless.enabled)
+		{
+			gpuTimer.end();
+			// nothing is presented, waiting for the GPU makes the frame time include its work
+			{
+				PROFILE_SCOPE("glFinish");
+				glFinish();
+			}
+			benchmark.cpuMilliseconds.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count());
+			if (headless.dumpEvery > 0 && frameIndex % headless.dumpEvery == 0)
+				offscreen.writeImage(headless.dumpDirectory + "/frame" + std::to_string(frameIndex) + ".tga");
+			frameIndex++;
+			glfwPollEvents();
+			continue;
+		}
+		{
+			PROFILE_SCOPE("imgui render");
+			gpuPasses.begin("imgui");
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+			gpuPasses.end();
+		}
 		
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 		// -------------------------------------------------------------------------------
-		glfwSwapBuffers(window);
+		{
+			PROFILE_SCOPE("swap buffers");
+			glfwSwapBuffers(window);
+		}
 		glfwPollEvents();
 	}
+	if (headless.enabled && exitCode == 0)
+	{
+		gpuTimer.collect(true);
+		benchmark.gpuMilliseconds = gpuTimer.milliseconds;
+		benchmark.print();
+		if (!headless.jsonOutput.empty())
+			benchmark.writeJson(headless.jsonOutput);
+	}
+	if (writeTraceOnExit)
+		Profiler::instance().writeChromeTrace(traceFile);
+	if (!recordPath.empty() && !recordedPath.keys.empty())
+	{
+		// the path starts when the recording did
+		float start = recordedPath.keys[0].time;
+		for (CameraKey& key : recordedPath.keys)
+			key.time -= start;
+		recordedPath.save(recordPath);
+	}
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
+	// GL objects go before the context does
+	characterBones.release();
+	bakedCrowd.release();
+	glDeleteVertexArrays(1, &crowdVAO);
+	characterStream.release();
+	glDeleteVertexArrays(1, &cpuSkinnedVAO);
+	glDeleteTextures(1, &bakedClip.texture);
+	glDeleteTextures(1, &crowdDiffuse);
+	textureArrays.release();
+	// the atlases delete their textures when the last reference goes
+	ourModel.atlases.clear();
+	virtualTexture.release();
+	textureStreamer.release();
+	mipFeedback.release();
+	samplerCache.clear();
+	offscreen.release();
+	gpuTimer.release();
+	gpuPasses.release();
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
 	
 	glfwTerminate();
-	return 0;
+	return exitCode;
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -277,6 +1052,18 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 	lastX = xpos;
 	lastY = ypos;
 
-	camera1.ProcessMouseMovement(xoffset, yoffset);
+	// the cursor is free for ImGui and picking, the camera only turns while the right button is held
+	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS)
+		camera1.ProcessMouseMovement(xoffset, yoffset);
+}
+
+// glfw: left click picks the mesh under the cursor, unless the click went to an ImGui window
+// -------------------------------------------------------------------------------------------
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+	(void)window;
+	(void)mods;
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && !ImGui::GetIO().WantCaptureMouse)
+		pickRequested = true;
 }
 
@@ -7,8 +7,13 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <../shader.h>
+#include "bounds.h"
+#include "mesh_lod.h"
+#include "meshlet.h"
+#include "gl_state.h"
 
 #include <string>
+#include <utility>
 #include <vector>
 using namespace std;
 
@@ -36,6 +41,8 @@ struct Texture {
 	unsigned int id;
 	string type;
 	string path;
+	// sampler object from a SamplerCache, 0 samples with the texture's own parameters
+	unsigned int sampler = 0;
 };
 
 //define mesh class
@@ -46,30 +53,145 @@ public:
 	vector<unsigned int> indices;
 	vector<Texture>      textures;
 	unsigned int VAO;
+	// bounds of the vertex positions, in the mesh's own space
+	AABB bounds;
+	BoundingSphere sphere;
+	// index ranges of the detail levels in the element buffer, lods[0] is the full index list
+	vector<MeshLod> lods;
+	// clusters of the full detail index list, empty unless the model was loaded with meshlets
+	vector<Meshlet> meshlets;
+	// material in a TextureArrayLibrary, -1 if the mesh's textures aren't in one
+	int arrayMaterial = -1;
+	// diffuse map comes from the VirtualTexture instead of textures
+	bool virtualTextured = false;
 
 	// constructor
 	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+		this->vertices = std::move(vertices);
+		this->indices = std::move(indices);
+		this->textures = std::move(textures);
+		computeBounds();
+		computeSamplerNames();
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
 		setupMesh();
 	}
 
-	// render the mesh
-	void Draw(Shader &shader)
+	// simplifies the mesh into up to maxLevels levels and puts all of them into the element buffer,
+	// the vertex buffer stays as it is
+	void generateLods(unsigned int maxLevels = 4)
+	{
+		if (vertices.empty() || indices.empty())
+			return;
+		vector<float> errors;
+		vector<vector<unsigned int>> chain = buildLodChain(&vertices[0].Position, vertices.size(), sizeof(Vertex), indices, errors, maxLevels);
+
+		vector<unsigned int> elements;
+		lods.clear();
+		for (unsigned int i = 0; i < chain.size(); i++)
+		{
+			MeshLod lod;
+			lod.indexOffset = (unsigned int)elements.size();
+			lod.indexCount = (unsigned int)chain[i].size();
+			lod.error = errors[i];
+			lods.push_back(lod);
+			elements.insert(elements.end(), chain[i].begin(), chain[i].end());
+		}
+		// the element buffer binding is part of the VAO
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(unsigned int), &elements[0], GL_STATIC_DRAW);
+		glBindVertexArray(0);
+	}
+
+	// moves the texture coordinates into a region of an atlas (uv * scale + offset) and updates the vertex buffer
+	void remapTexCoords(glm::vec2 scale, glm::vec2 offset)
+	{
+		for (Vertex& vertex : vertices)
+			vertex.TexCoords = vertex.TexCoords * scale + offset;
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(Vertex), &vertices[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// swaps the textures for others of the same types (e.g. atlas textures), keeps the sampler names in sync
+	void setTextures(const vector<Texture>& textures)
+	{
+		this->textures = textures;
+		computeSamplerNames();
+	}
+
+	// meshes are copied around by value, so the buffers aren't freed by a destructor but here, by whoever owns them
+	void deleteBuffers()
+	{
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		VAO = VBO = EBO = 0;
+	}
+
+	// render the mesh, lod selects one of the ranges in lods. with a view the full detail level of a mesh
+	// that has meshlets only draws the clusters that pass the frustum and backface cone tests
+	void Draw(Shader &shader, unsigned int lod = 0, const MeshletView *view = nullptr, MeshletCullStats *stats = nullptr)
 	{
 		// bind appropriate textures
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+			// now set the sampler to the correct texture unit
+			glUniform1i(glGetUniformLocation(shader.ID, samplerNames[i].c_str()), i);
+			// and finally bind the texture
+			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			glBindSampler(i, textures[i].sampler);
+		}
+
+		// draw mesh
+		glBindVertexArray(VAO);
+		drawElements(lod, view, stats);
+		glBindVertexArray(0);
+
+		// always good practice to set everything back to defaults once configured.
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// same as above, but every bind and sampler uniform goes through the state cache so the ones that are
+	// already set are skipped. the resets afterwards are only issued with filtering off, the next draw through
+	// the cache sets what it needs.
+	// bindTextures is false when the shader reads the textures from texture arrays instead
+	void Draw(GLStateCache &state, Shader &shader, unsigned int lod = 0, const MeshletView *view = nullptr, MeshletCullStats *stats = nullptr, bool bindTextures = true)
+	{
+		for (unsigned int i = 0; bindTextures && i < textures.size(); i++)
+		{
+			state.setInt(shader.ID, samplerNames[i], i);
+			state.bindTexture2D(i, textures[i].id);
+			state.bindSampler(i, textures[i].sampler);
+		}
+		state.bindVertexArray(VAO);
+		if (drawElements(lod, view, stats))
+			state.countDraw();
+		state.resetAfterDraw();
+	}
+
+private:
+	// render data 
+	unsigned int VBO, EBO;
+	// index ranges of the meshlets that survived the last cull
+	vector<GLsizei> meshletCounts;
+	vector<const void*> meshletOffsets;
+	// sampler uniform of every texture, texture_diffuseN etc.
+	vector<string> samplerNames;
+
+	// retrieve texture number (the N in diffuse_textureN)
+	void computeSamplerNames()
+	{
 		unsigned int diffuseNr = 1;
 		unsigned int specularNr = 1;
 		unsigned int normalNr = 1;
 		unsigned int heightNr = 1;
+		samplerNames.clear();
 		for (unsigned int i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-			// retrieve texture number (the N in diffuse_textureN)
 			string number;
 			string name = textures[i].type;
 			if (name == "texture_diffuse")
@@ -80,25 +202,33 @@ public:
 				number = std::to_string(normalNr++); // transfer unsigned int to stream
 			else if (name == "texture_height")
 				number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			samplerNames.push_back(name + number);
 		}
+	}
 
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+	// issues the draw call of one level, or of the visible meshlets. false if everything was culled
+	bool drawElements(unsigned int lod, const MeshletView *view, MeshletCullStats *stats)
+	{
+		if (view && lod == 0 && !meshlets.empty())
+		{
+			MeshletCullStats ignored;
+			cullMeshlets(meshlets, *view, meshletCounts, meshletOffsets, stats ? *stats : ignored);
+			if (meshletCounts.empty())
+				return false;
+			glMultiDrawElements(GL_TRIANGLES, &meshletCounts[0], GL_UNSIGNED_INT, &meshletOffsets[0], (GLsizei)meshletCounts.size());
+			return true;
+		}
+		glDrawElements(GL_TRIANGLES, lods[lod].indexCount, GL_UNSIGNED_INT, (void*)(lods[lod].indexOffset * sizeof(unsigned int)));
+		return true;
 	}
 
-private:
-	// render data 
-	unsigned int VBO, EBO;
+	void computeBounds()
+	{
+		if (vertices.empty())
+			return;
+		bounds = computeAABB(&vertices[0].Position, vertices.size(), sizeof(Vertex));
+		sphere = computeBoundingSphere(&vertices[0].Position, vertices.size(), sizeof(Vertex), bounds);
+	}
 
 	// initializes all the buffer objects/arrays
 	void setupMesh()
@@ -118,6 +248,8 @@ private:
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		lods.assign(1, MeshLod());
+		lods[0].indexCount = (unsigned int)indices.size();
 
 		// set the vertex attribute pointers
 		// vertex Positions
@@ -0,0 +1,494 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include "bounds.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Mesh levels of detail. simplifyMesh() reduces an index list with quadric error edge collapses (Garland &
+// Heckbert) but only ever collapses a vertex onto one of its neighbours, so every level indexes the original
+// vertices and all levels of a mesh can live in one element buffer in front of one vertex buffer.
+// Vertices on UV/normal seams (several vertices at one position) and on open borders are never moved, which
+// keeps the textures and the outline of the mesh intact at the cost of a less aggressive reduction.
+
+#define MAX_MESH_LODS 8
+
+// one level: a range of the mesh's element buffer and its geometric error, the largest distance of a vertex of
+// the full detail mesh from the level's surface, in the mesh's units
+struct MeshLod {
+	unsigned int indexOffset = 0;
+	unsigned int indexCount = 0;
+	float error = 0.0f;
+};
+
+// per level counters of what a draw submitted
+struct LodStats {
+	unsigned int meshes[MAX_MESH_LODS] = {};
+	unsigned int triangles[MAX_MESH_LODS] = {};
+};
+
+// symmetric 4x4 error quadric, the weighted sum of squared distances to a set of planes
+struct Quadric {
+	double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0, zw = 0, ww = 0;
+	// sum of the plane weights
+	double w = 0;
+
+	void addPlane(const glm::vec3& n, float d, float weight)
+	{
+		w += weight;
+		xx += weight * n.x * n.x; xy += weight * n.x * n.y; xz += weight * n.x * n.z; xw += weight * n.x * d;
+		yy += weight * n.y * n.y; yz += weight * n.y * n.z; yw += weight * n.y * d;
+		zz += weight * n.z * n.z; zw += weight * n.z * d;
+		ww += weight * d * d;
+	}
+	void add(const Quadric& q)
+	{
+		xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+		yy += q.yy; yz += q.yz; yw += q.yw;
+		zz += q.zz; zw += q.zw;
+		ww += q.ww;
+		w += q.w;
+	}
+	double evaluate(const glm::vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		return xx * x * x + 2 * xy * x * y + 2 * xz * x * z + 2 * xw * x
+			+ yy * y * y + 2 * yz * y * z + 2 * yw * y
+			+ zz * z * z + 2 * zw * z + ww;
+	}
+	// weighted mean of the squared plane distances. unlike evaluate() it is a squared length, it doesn't
+	// grow with the area the planes were weighted by
+	double distanceSquared(const glm::vec3& p) const
+	{
+		return w > 0 ? std::max(0.0, evaluate(p) / w) : 0.0;
+	}
+};
+
+// squared distance from p to the triangle abc (closest point as in Ericson, Real-Time Collision Detection 5.1.5)
+inline float pointTriangleDistanceSquared(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return glm::dot(ap, ap);
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return glm::dot(bp, bp);
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+	{
+		glm::vec3 d = ap - ab * (d1 / (d1 - d3));
+		return glm::dot(d, d);
+	}
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return glm::dot(cp, cp);
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+	{
+		glm::vec3 d = ap - ac * (d2 / (d2 - d6));
+		return glm::dot(d, d);
+	}
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+	{
+		glm::vec3 d = bp - (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		return glm::dot(d, d);
+	}
+	float denom = 1.0f / (va + vb + vc);
+	glm::vec3 d = ap - ab * (vb * denom) - ac * (vc * denom);
+	return glm::dot(d, d);
+}
+
+// reduces indices towards targetIndexCount triangles*3, stops early when every remaining collapse would flip a
+// triangle or move a locked vertex. error receives the largest collapse error as a distance (the root of the
+// mean squared distance to the planes the collapsed vertices came from). collapsedOnto receives for every
+// vertex the vertex it was moved onto, itself if it was kept
+inline std::vector<unsigned int> simplifyMesh(const void* positions, size_t vertexCount, size_t stride,
+	const std::vector<unsigned int>& indices, size_t targetIndexCount, float* error = nullptr, std::vector<unsigned int>* collapsedOnto = nullptr)
+{
+	const char* base = (const char*)positions;
+	auto position = [&](unsigned int v) -> const glm::vec3& { return *(const glm::vec3*)(base + v * stride); };
+
+	// vertices that share a position form a group, sorted by position so equal ones are next to each other
+	std::vector<unsigned int> order(vertexCount), group(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+		const glm::vec3& pa = position(a);
+		const glm::vec3& pb = position(b);
+		if (pa.x != pb.x) return pa.x < pb.x;
+		if (pa.y != pb.y) return pa.y < pb.y;
+		return pa.z < pb.z;
+	});
+	std::vector<unsigned char> locked(vertexCount, 0);
+	for (size_t i = 0; i < vertexCount; )
+	{
+		size_t j = i + 1;
+		while (j < vertexCount && position(order[j]) == position(order[i]))
+			j++;
+		for (size_t k = i; k < j; k++)
+		{
+			group[order[k]] = order[i];
+			locked[order[k]] = j - i > 1;
+		}
+		i = j;
+	}
+
+	// open borders: edges (between position groups) used by a single triangle
+	std::unordered_map<unsigned long long, unsigned int> edgeUse;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			unsigned int a = group[indices[i + e]], b = group[indices[i + (e + 1) % 3]];
+			edgeUse[((unsigned long long)std::min(a, b) << 32) | std::max(a, b)]++;
+		}
+	}
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			unsigned int a = indices[i + e], b = indices[i + (e + 1) % 3];
+			unsigned int ga = group[a], gb = group[b];
+			if (edgeUse[((unsigned long long)std::min(ga, gb) << 32) | std::max(ga, gb)] == 1)
+				locked[a] = locked[b] = 1;
+		}
+	}
+
+	// area weighted plane quadrics, accumulated per group so all copies of a seam vertex agree. costs are
+	// divided by the summed area, so they measure a distance and don't depend on the mesh's scale or tessellation
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const glm::vec3& p0 = position(indices[i]);
+		glm::vec3 n = glm::cross(position(indices[i + 1]) - p0, position(indices[i + 2]) - p0);
+		float area = glm::length(n);
+		if (area <= 0.0f)
+			continue;
+		n /= area;
+		for (int k = 0; k < 3; k++)
+			quadrics[group[indices[i + k]]].addPlane(n, -glm::dot(n, p0), area * 0.5f);
+	}
+
+	struct Collapse {
+		unsigned int from, to;
+		double cost;
+	};
+	std::vector<unsigned int> result = indices;
+	std::vector<unsigned int> remap(vertexCount);
+	std::vector<unsigned char> touched(vertexCount);
+	std::vector<unsigned int> triangleStart(vertexCount + 1), triangleList;
+	std::vector<Collapse> candidates;
+	double maxCost = 0.0;
+	std::vector<unsigned int> onto(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		onto[v] = (unsigned int)v;
+
+	while (result.size() > targetIndexCount)
+	{
+		// vertex -> triangle adjacency of the current index list, for the flip test
+		std::fill(triangleStart.begin(), triangleStart.end(), 0);
+		for (unsigned int v : result)
+			triangleStart[v + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			triangleStart[v + 1] += triangleStart[v];
+		triangleList.resize(result.size());
+		std::vector<unsigned int> fill(triangleStart.begin(), triangleStart.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+			triangleList[fill[result[i]]++] = (unsigned int)(i / 3);
+
+		candidates.clear();
+		for (size_t i = 0; i + 2 < result.size(); i += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				unsigned int a = result[i + e], b = result[i + (e + 1) % 3];
+				for (int dir = 0; dir < 2; dir++)
+				{
+					unsigned int from = dir ? b : a, to = dir ? a : b;
+					if (locked[from])
+						continue;
+					Quadric q = quadrics[from];
+					q.add(quadrics[group[to]]);
+					candidates.push_back({ from, to, q.distanceSquared(position(to)) });
+				}
+			}
+		}
+		// equal costs in a fixed order, so the result doesn't depend on how the sort happens to break ties
+		std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) {
+			if (a.cost != b.cost) return a.cost < b.cost;
+			if (a.from != b.from) return a.from < b.from;
+			return a.to < b.to;
+		});
+
+		// independent collapses only: a vertex whose triangles changed this pass can't move again until the next
+		for (size_t v = 0; v < vertexCount; v++)
+			remap[v] = (unsigned int)v;
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t removed = 0;
+		for (const Collapse& c : candidates)
+		{
+			if (removed >= trianglesToRemove)
+				break;
+			if (touched[c.from] || remap[c.to] != c.to)
+				continue;
+			// moving from onto to must not turn any of its other triangles around
+			bool flips = false;
+			size_t collapsing = 0;
+			for (unsigned int t = triangleStart[c.from]; t < triangleStart[c.from + 1] && !flips; t++)
+			{
+				const unsigned int* tri = &result[triangleList[t] * 3];
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+				{
+					collapsing++;
+					continue;
+				}
+				glm::vec3 p[3], q[3];
+				for (int k = 0; k < 3; k++)
+				{
+					p[k] = position(tri[k]);
+					q[k] = tri[k] == c.from ? position(c.to) : p[k];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+					flips = true;
+			}
+			if (flips)
+				continue;
+			remap[c.from] = c.to;
+			quadrics[group[c.to]].add(quadrics[c.from]);
+			maxCost = std::max(maxCost, c.cost);
+			removed += collapsing;
+			for (unsigned int t = triangleStart[c.from]; t < triangleStart[c.from + 1]; t++)
+			{
+				const unsigned int* tri = &result[triangleList[t] * 3];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+		}
+		if (removed == 0)
+			break;
+		for (size_t v = 0; v < vertexCount; v++)
+			onto[v] = remap[onto[v]];
+
+		// apply the collapses and drop the triangles that became degenerate
+		size_t kept = 0;
+		for (size_t i = 0; i + 2 < result.size(); i += 3)
+		{
+			unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+			result[kept++] = a;
+			result[kept++] = b;
+			result[kept++] = c;
+		}
+		result.resize(kept);
+	}
+
+	if (error)
+		*error = (float)std::sqrt(maxCost);
+	if (collapsedOnto)
+		collapsedOnto->swap(onto);
+	return result;
+}
+
+// largest distance of a vertex of source from the surface of level, the one sided Hausdorff distance over the
+// vertices. collapsedOnto maps every vertex to the one it ended on in level, a vertex is measured against the
+// triangles around that one
+inline float lodDeviation(const void* positions, size_t vertexCount, size_t stride, const std::vector<unsigned int>& source,
+	const std::vector<unsigned int>& level, const std::vector<unsigned int>& collapsedOnto)
+{
+	const char* base = (const char*)positions;
+	auto position = [&](unsigned int v) -> const glm::vec3& { return *(const glm::vec3*)(base + v * stride); };
+
+	std::vector<unsigned int> triangleStart(vertexCount + 1, 0), triangleList(level.size());
+	for (unsigned int v : level)
+		triangleStart[v + 1]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		triangleStart[v + 1] += triangleStart[v];
+	std::vector<unsigned int> fill(triangleStart.begin(), triangleStart.end() - 1);
+	for (size_t i = 0; i < level.size(); i++)
+		triangleList[fill[level[i]]++] = (unsigned int)(i / 3);
+
+	std::vector<unsigned char> measured(vertexCount, 0);
+	float maxDistanceSquared = 0.0f;
+	for (unsigned int v : source)
+	{
+		if (measured[v])
+			continue;
+		measured[v] = 1;
+		unsigned int target = collapsedOnto[v];
+		if (target == v)
+			continue;
+		const glm::vec3& p = position(v);
+		// a vertex whose triangles all collapsed away only has the point it moved to
+		glm::vec3 offset = p - position(target);
+		float closest = glm::dot(offset, offset);
+		for (unsigned int t = triangleStart[target]; t < triangleStart[target + 1]; t++)
+		{
+			const unsigned int* tri = &level[triangleList[t] * 3];
+			closest = std::min(closest, pointTriangleDistanceSquared(p, position(tri[0]), position(tri[1]), position(tri[2])));
+		}
+		maxDistanceSquared = std::max(maxDistanceSquared, closest);
+	}
+	return std::sqrt(maxDistanceSquared);
+}
+
+// LOD chain, level 0 is the input. every next level aims for ratio of the previous level's triangles and is
+// simplified from it; the chain ends early when a level would save less than 10% or get below minTriangles.
+// errors receives every level's deviation from the input, see lodDeviation()
+inline std::vector<std::vector<unsigned int>> buildLodChain(const void* positions, size_t vertexCount, size_t stride,
+	const std::vector<unsigned int>& indices, std::vector<float>& errors, unsigned int maxLevels = 4, float ratio = 0.5f, unsigned int minTriangles = 32)
+{
+	std::vector<std::vector<unsigned int>> chain;
+	chain.push_back(indices);
+	errors.assign(1, 0.0f);
+	// where every vertex of the input ended up in the last level
+	std::vector<unsigned int> onto(vertexCount), levelOnto;
+	for (size_t v = 0; v < vertexCount; v++)
+		onto[v] = (unsigned int)v;
+	while (chain.size() < std::min(maxLevels, (unsigned int)MAX_MESH_LODS))
+	{
+		const std::vector<unsigned int>& previous = chain.back();
+		size_t target = (size_t)(previous.size() / 3 * ratio) * 3;
+		if (target / 3 < minTriangles)
+			break;
+		std::vector<unsigned int> level = simplifyMesh(positions, vertexCount, stride, previous, target, nullptr, &levelOnto);
+		if (level.size() > previous.size() * 9 / 10)
+			break;
+		for (size_t v = 0; v < vertexCount; v++)
+			onto[v] = levelOnto[onto[v]];
+		// measured against the input, not the previous level, and never below the level before it
+		errors.push_back(std::max(errors.back(), lodDeviation(positions, vertexCount, stride, indices, level, onto)));
+		chain.push_back(level);
+	}
+	return chain;
+}
+
+// coarsest level whose error stays under pixelError pixels on screen. the sphere is in world space and
+// worldScale converts the mesh's units (the largest scale of its model matrix)
+inline unsigned int selectLod(const std::vector<MeshLod>& lods, const BoundingSphere& sphere, float worldScale,
+	const glm::vec3& cameraPosition, const glm::mat4& projection, float viewportHeight, float pixelError)
+{
+	float distance = glm::length(sphere.center - cameraPosition) - sphere.radius;
+	if (distance <= 0.0f)
+		return 0;
+	float pixelsPerUnit = projection[1][1] * 0.5f * viewportHeight / distance;
+	for (unsigned int i = (unsigned int)lods.size() - 1; i > 0; i--)
+	{
+		if (lods[i].error * worldScale * pixelsPerUnit <= pixelError)
+			return i;
+	}
+	return 0;
+}
+
+// checks that the level errors are distances: the chain of a wavy grid scaled by 8 has to have the same
+// triangle counts and 8 times the errors. a power of two keeps the scaled positions exact, so the simplifier
+// takes the same collapses on both. returns false and prints the levels that don't
+inline bool testLodErrorScaling(unsigned int gridSize = 48)
+{
+	std::vector<glm::vec3> grid, scaled;
+	for (unsigned int y = 0; y < gridSize; y++)
+	{
+		for (unsigned int x = 0; x < gridSize; x++)
+		{
+			float u = (float)x / (gridSize - 1), v = (float)y / (gridSize - 1);
+			grid.push_back(glm::vec3(u, 0.05f * std::sin(u * 9.0f) * std::cos(v * 7.0f), v));
+			scaled.push_back(grid.back() * 8.0f);
+		}
+	}
+	std::vector<unsigned int> indices;
+	for (unsigned int y = 0; y + 1 < gridSize; y++)
+	{
+		for (unsigned int x = 0; x + 1 < gridSize; x++)
+		{
+			unsigned int i = y * gridSize + x;
+			unsigned int quad[6] = { i, i + gridSize, i + 1, i + 1, i + gridSize, i + gridSize + 1 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+
+	std::vector<float> errors, scaledErrors;
+	std::vector<std::vector<unsigned int>> chain = buildLodChain(grid.data(), grid.size(), sizeof(glm::vec3), indices, errors, 5);
+	std::vector<std::vector<unsigned int>> scaledChain = buildLodChain(scaled.data(), scaled.size(), sizeof(glm::vec3), indices, scaledErrors, 5);
+	bool passed = chain.size() == scaledChain.size() && chain.size() > 1;
+	std::cout << "testLodErrorScaling() " << indices.size() / 3 << " triangles, " << chain.size() << " levels" << std::endl;
+	for (unsigned int i = 0; i < chain.size() && i < scaledChain.size(); i++)
+	{
+		float ratio = errors[i] > 0.0f ? scaledErrors[i] / errors[i] : 8.0f;
+		bool levelPassed = chain[i].size() == scaledChain[i].size() && std::fabs(ratio - 8.0f) < 0.01f;
+		std::cout << "  LOD " << i << ": " << chain[i].size() / 3 << " triangles, error " << errors[i] << ", scaled by 8: "
+			<< scaledChain[i].size() / 3 << " triangles, error " << scaledErrors[i] << (levelPassed ? "" : "  <- wrong") << std::endl;
+		passed = passed && levelPassed;
+	}
+	if (!passed)
+		std::cout << "ERROR::MESH_LOD:: the level errors don't scale with the mesh" << std::endl;
+	return passed;
+}
+
+// builds the LOD chains of every mesh in a file and prints the triangles per level, how long the simplification
+// took and from which distance a level is used at 1 pixel error on a 900 pixel high, 75 degree view
+inline void benchmarkMeshLod(const std::string& path, unsigned int maxLevels = 5)
+{
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+	{
+		std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+		return;
+	}
+
+	unsigned int triangles[MAX_MESH_LODS] = {};
+	float errors[MAX_MESH_LODS] = {};
+	unsigned int levels = 0;
+	double ms = 0.0;
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		const aiMesh* mesh = scene->mMeshes[m];
+		std::vector<unsigned int> indices;
+		for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+			if (mesh->mFaces[f].mNumIndices == 3)
+				indices.insert(indices.end(), mesh->mFaces[f].mIndices, mesh->mFaces[f].mIndices + 3);
+
+		std::vector<float> meshErrors;
+		auto start = std::chrono::high_resolution_clock::now();
+		// aiVector3D is three floats, so the positions can be read in place
+		std::vector<std::vector<unsigned int>> chain = buildLodChain(mesh->mVertices, mesh->mNumVertices, sizeof(aiVector3D), indices, meshErrors, maxLevels);
+		auto stop = std::chrono::high_resolution_clock::now();
+		ms += std::chrono::duration<double, std::milli>(stop - start).count();
+
+		// a mesh with a shorter chain keeps drawing its last level
+		for (unsigned int i = 0; i < maxLevels && i < MAX_MESH_LODS; i++)
+		{
+			unsigned int level = std::min(i, (unsigned int)chain.size() - 1);
+			triangles[i] += (unsigned int)chain[level].size() / 3;
+			errors[i] = std::max(errors[i], meshErrors[level]);
+		}
+		levels = std::max(levels, (unsigned int)chain.size());
+	}
+
+	float pixelsPerUnitAtOne = 1.0f / std::tan(glm::radians(75.0f) * 0.5f) * 0.5f * 900.0f;
+	std::cout << "benchmarkMeshLod() " << path << " meshes=" << scene->mNumMeshes << " simplify=" << ms << " ms" << std::endl;
+	for (unsigned int i = 0; i < levels; i++)
+	{
+		std::cout << "  LOD " << i << ": " << triangles[i] << " triangles (" << 100.0f * triangles[i] / std::max(1u, triangles[0]) << "%)"
+			<< ", error " << errors[i] << ", used from distance " << errors[i] * pixelsPerUnitAtOne << std::endl;
+	}
+}
+#endif
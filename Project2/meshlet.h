@@ -0,0 +1,217 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "frustum.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Meshlets: a mesh's triangles regrouped into small clusters (at most 64 vertices and 124 triangles), each with
+// a bounding sphere and a cone around its triangle normals. The clusters are consecutive ranges of the mesh's
+// index list, so a mesh can cull them one by one and draw the survivors with a single glMultiDrawElements;
+// large meshes like a terrain are then only drawn where they are in view and facing the camera.
+// GL 3.3 has no compute shaders, so the culling runs on the CPU.
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet {
+	unsigned int indexOffset = 0;	// first index in the mesh's index list
+	unsigned int indexCount = 0;
+	BoundingSphere sphere;
+	// every triangle faces away from a camera that looks at the cluster from inside the cone
+	// dot(normalize(center - camera), coneAxis) >= coneCutoff. coneCutoff > 1 disables the test
+	glm::vec3 coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	float coneCutoff = 2.0f;
+};
+
+// frustum and camera in the mesh's own space, see Model::setMeshletView()
+struct MeshletView {
+	Frustum frustum;
+	glm::vec3 cameraPosition;
+};
+
+struct MeshletCullStats {
+	unsigned int tested = 0;
+	unsigned int frustumCulled = 0;
+	unsigned int backfaceCulled = 0;
+};
+
+// sphere and normal cone of the triangles indices[first, first + count)
+inline void computeMeshletBounds(const void* positions, size_t stride, const std::vector<unsigned int>& indices, Meshlet& meshlet)
+{
+	const char* base = (const char*)positions;
+	auto position = [&](unsigned int v) -> const glm::vec3& { return *(const glm::vec3*)(base + v * stride); };
+
+	AABB box;
+	for (unsigned int i = 0; i < meshlet.indexCount; i++)
+		box.expand(position(indices[meshlet.indexOffset + i]));
+	meshlet.sphere.center = box.center();
+	float radiusSquared = 0.0f;
+	for (unsigned int i = 0; i < meshlet.indexCount; i++)
+	{
+		glm::vec3 d = position(indices[meshlet.indexOffset + i]) - meshlet.sphere.center;
+		radiusSquared = std::max(radiusSquared, glm::dot(d, d));
+	}
+	meshlet.sphere.radius = std::sqrt(radiusSquared);
+
+	// the axis is the average normal, the cutoff the sine of the largest angle between it and a triangle normal
+	std::vector<glm::vec3> normals;
+	glm::vec3 axis(0.0f);
+	for (unsigned int i = 0; i + 2 < meshlet.indexCount; i += 3)
+	{
+		const glm::vec3& p0 = position(indices[meshlet.indexOffset + i]);
+		glm::vec3 n = glm::cross(position(indices[meshlet.indexOffset + i + 1]) - p0, position(indices[meshlet.indexOffset + i + 2]) - p0);
+		float length = glm::length(n);
+		if (length <= 0.0f)
+			continue;
+		normals.push_back(n / length);
+		axis += normals.back();
+	}
+	meshlet.coneCutoff = 2.0f;
+	if (normals.empty() || glm::length(axis) <= 0.0f)
+		return;
+	meshlet.coneAxis = glm::normalize(axis);
+	float minDot = 1.0f;
+	for (const glm::vec3& n : normals)
+		minDot = std::min(minDot, glm::dot(n, meshlet.coneAxis));
+	// normals spread over more than a hemisphere: some triangle always faces the camera
+	if (minDot <= 0.1f)
+		return;
+	meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+// regroups the triangles of an index list into meshlets and returns the reordered index list. a meshlet grows
+// from a seed triangle by always taking the neighbouring triangle that adds the fewest new vertices, so the
+// clusters stay compact and their spheres and cones tight
+inline std::vector<unsigned int> buildMeshlets(const void* positions, size_t vertexCount, size_t stride,
+	const std::vector<unsigned int>& indices, std::vector<Meshlet>& meshlets,
+	unsigned int maxVertices = MESHLET_MAX_VERTICES, unsigned int maxTriangles = MESHLET_MAX_TRIANGLES)
+{
+	unsigned int triangleCount = (unsigned int)(indices.size() / 3);
+	meshlets.clear();
+	std::vector<unsigned int> result;
+	result.reserve(triangleCount * 3);
+
+	// vertex -> triangle adjacency
+	std::vector<unsigned int> triangleStart(vertexCount + 1, 0), triangleList(triangleCount * 3);
+	for (unsigned int i = 0; i < triangleCount * 3; i++)
+		triangleStart[indices[i] + 1]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		triangleStart[v + 1] += triangleStart[v];
+	std::vector<unsigned int> fill(triangleStart.begin(), triangleStart.end() - 1);
+	for (unsigned int i = 0; i < triangleCount * 3; i++)
+		triangleList[fill[indices[i]]++] = i / 3;
+
+	std::vector<unsigned char> emitted(triangleCount, 0);
+	// meshlet a vertex was last added to, +1 so 0 means none
+	std::vector<unsigned int> vertexMeshlet(vertexCount, 0);
+	std::vector<unsigned int> candidates;
+	unsigned int seed = 0;
+
+	while (true)
+	{
+		while (seed < triangleCount && emitted[seed])
+			seed++;
+		if (seed == triangleCount)
+			break;
+
+		Meshlet meshlet;
+		meshlet.indexOffset = (unsigned int)result.size();
+		unsigned int id = (unsigned int)meshlets.size() + 1;
+		unsigned int vertices = 0, triangles = 0;
+		candidates.assign(1, seed);
+
+		while (triangles < maxTriangles && !candidates.empty())
+		{
+			// best candidate: fewest vertices not in the meshlet yet
+			int best = -1;
+			unsigned int bestNew = 4;
+			for (unsigned int c = 0; c < candidates.size(); c++)
+			{
+				unsigned int t = candidates[c];
+				if (emitted[t])
+					continue;
+				unsigned int added = 0;
+				for (int k = 0; k < 3; k++)
+					added += vertexMeshlet[indices[t * 3 + k]] != id;
+				if (added < bestNew)
+				{
+					bestNew = added;
+					best = (int)c;
+				}
+			}
+			if (best < 0 || vertices + bestNew > maxVertices)
+				break;
+
+			unsigned int t = candidates[best];
+			candidates[best] = candidates.back();
+			candidates.pop_back();
+			emitted[t] = 1;
+			triangles++;
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[t * 3 + k];
+				result.push_back(v);
+				if (vertexMeshlet[v] == id)
+					continue;
+				vertexMeshlet[v] = id;
+				vertices++;
+				for (unsigned int a = triangleStart[v]; a < triangleStart[v + 1]; a++)
+				{
+					if (!emitted[triangleList[a]])
+						candidates.push_back(triangleList[a]);
+				}
+			}
+			// drop the stale entries now and then so the scan stays short
+			if (candidates.size() > 256)
+			{
+				candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](unsigned int c) { return emitted[c] != 0; }), candidates.end());
+				std::sort(candidates.begin(), candidates.end());
+				candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+			}
+		}
+
+		meshlet.indexCount = (unsigned int)result.size() - meshlet.indexOffset;
+		computeMeshletBounds(positions, stride, result, meshlet);
+		meshlets.push_back(meshlet);
+	}
+	return result;
+}
+
+// culls the meshlets against the view and appends the survivors as ranges for glMultiDrawElements
+inline void cullMeshlets(const std::vector<Meshlet>& meshlets, const MeshletView& view,
+	std::vector<GLsizei>& counts, std::vector<const void*>& offsets, MeshletCullStats& stats)
+{
+	counts.clear();
+	offsets.clear();
+	for (const Meshlet& meshlet : meshlets)
+	{
+		stats.tested++;
+		if (!isVisible(view.frustum, meshlet.sphere))
+		{
+			stats.frustumCulled++;
+			continue;
+		}
+		glm::vec3 toCenter = meshlet.sphere.center - view.cameraPosition;
+		if (glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.sphere.radius)
+		{
+			stats.backfaceCulled++;
+			continue;
+		}
+		// neighbouring survivors are merged into one range
+		const void* offset = (const void*)(size_t)(meshlet.indexOffset * sizeof(unsigned int));
+		if (!counts.empty() && (const char*)offsets.back() + counts.back() * sizeof(unsigned int) == offset)
+			counts.back() += meshlet.indexCount;
+		else
+		{
+			counts.push_back((GLsizei)meshlet.indexCount);
+			offsets.push_back(offset);
+		}
+	}
+}
+#endif
@@ -0,0 +1,243 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json_escape.h"
+
+// A small benchmark runner in the style of Google Benchmark. A benchmark is a function that does its setup and
+// then loops while (state.keepRunning()) over the code to time. The runner first grows the iteration count until
+// one run takes minSeconds, then repeats the run repetitions times with that count. Results are the mean time per
+// iteration with the fastest repetition and the standard deviation over the repetitions, as a table or as json.
+
+// keeps the compiler from dropping a result that is never read
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+	static volatile const void* sink;
+	sink = &value;
+	(void)sink;
+}
+
+class MicroBenchmarkState
+{
+public:
+	explicit MicroBenchmarkState(unsigned long long iterations) : iterations(iterations), remaining(iterations) {}
+
+	// true while iterations are left, the clock starts at the first call
+	bool keepRunning()
+	{
+		if (!started)
+		{
+			started = true;
+			start = Clock::now();
+		}
+		if (remaining > 0)
+		{
+			remaining--;
+			return true;
+		}
+		elapsed += Clock::now() - start;
+		return false;
+	}
+
+	// leaves per iteration setup out of the time
+	void pauseTiming()
+	{
+		elapsed += Clock::now() - start;
+	}
+
+	void resumeTiming()
+	{
+		start = Clock::now();
+	}
+
+	// the benchmark can't run, e.g. without a GL context
+	void skip(const std::string& reason)
+	{
+		skipped = reason;
+		remaining = 0;
+	}
+
+	void setLabel(const std::string& text)
+	{
+		label = text;
+	}
+
+	// items handled by one iteration, reported as items per second
+	void setItemsPerIteration(double items)
+	{
+		itemsPerIteration = items;
+	}
+
+	double seconds() const
+	{
+		return std::chrono::duration<double>(elapsed).count();
+	}
+
+	const unsigned long long iterations;
+	std::string skipped;
+	std::string label;
+	double itemsPerIteration = 0.0;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+	unsigned long long remaining;
+	bool started = false;
+	Clock::time_point start;
+	Clock::duration elapsed = Clock::duration::zero();
+};
+
+struct MicroBenchmarkResult {
+	std::string name;
+	std::string label;
+	std::string skipped;
+	unsigned long long iterations = 0;
+	double nanoseconds = 0.0;		// mean per iteration
+	double minNanoseconds = 0.0;	// per iteration in the fastest repetition
+	double stddevNanoseconds = 0.0;
+	double itemsPerSecond = 0.0;
+};
+
+class MicroBenchmarkSuite
+{
+public:
+	double minSeconds = 0.2;
+	unsigned int repetitions = 3;
+	std::vector<MicroBenchmarkResult> results;
+
+	void add(const std::string& name, const std::function<void(MicroBenchmarkState&)>& function)
+	{
+		benchmarks.push_back(std::make_pair(name, function));
+	}
+
+	// runs the benchmarks whose names contain filter, all of them for an empty filter
+	void run(const std::string& filter = "")
+	{
+		for (const std::pair<std::string, std::function<void(MicroBenchmarkState&)>>& benchmark : benchmarks)
+		{
+			if (!filter.empty() && benchmark.first.find(filter) == std::string::npos)
+				continue;
+			results.push_back(runOne(benchmark.first, benchmark.second));
+			printRow(results.back());
+		}
+	}
+
+	static void printHeader()
+	{
+		std::cout << std::left << std::setw(44) << "benchmark" << std::right << std::setw(12) << "iterations" << std::setw(14) << "time"
+			<< std::setw(14) << "min" << std::setw(10) << "stddev" << std::setw(14) << "items/s" << "  label" << std::endl;
+	}
+
+	bool writeJson(const std::string& path, const std::vector<std::pair<std::string, std::string>>& context) const
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+		{
+			std::cout << "ERROR::MICROBENCH::FILE_NOT_WRITTEN " << path << std::endl;
+			return false;
+		}
+		fprintf(file, "{\n  \"context\": {");
+		for (size_t i = 0; i < context.size(); i++)
+			fprintf(file, "%s\n    \"%s\": \"%s\"", i ? "," : "", jsonEscaped(context[i].first).c_str(), jsonEscaped(context[i].second).c_str());
+		fprintf(file, "\n  },\n  \"benchmarks\": [");
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const MicroBenchmarkResult& result = results[i];
+			fprintf(file, "%s\n    { \"name\": \"%s\", \"iterations\": %llu, \"ns\": %.3f, \"minNs\": %.3f, \"stddevNs\": %.3f, \"itemsPerSecond\": %.3f, \"label\": \"%s\"%s%s%s }",
+				i ? "," : "", jsonEscaped(result.name).c_str(), result.iterations, result.nanoseconds, result.minNanoseconds, result.stddevNanoseconds,
+				result.itemsPerSecond, jsonEscaped(result.label).c_str(), result.skipped.empty() ? "" : ", \"skipped\": \"",
+				jsonEscaped(result.skipped).c_str(), result.skipped.empty() ? "" : "\"");
+		}
+		fprintf(file, "\n  ]\n}\n");
+		fclose(file);
+		return true;
+	}
+
+private:
+	std::vector<std::pair<std::string, std::function<void(MicroBenchmarkState&)>>> benchmarks;
+
+	MicroBenchmarkResult runOne(const std::string& name, const std::function<void(MicroBenchmarkState&)>& function)
+	{
+		MicroBenchmarkResult result;
+		result.name = name;
+		// grow the iteration count until a run is long enough to time
+		unsigned long long iterations = 1;
+		while (true)
+		{
+			MicroBenchmarkState state(iterations);
+			function(state);
+			result.label = state.label;
+			if (!state.skipped.empty())
+			{
+				result.skipped = state.skipped;
+				return result;
+			}
+			double seconds = state.seconds();
+			if (seconds >= minSeconds || iterations >= 1000000000ull)
+				break;
+			double factor = seconds > 0.0 ? minSeconds * 1.2 / seconds : 10.0;
+			iterations = (unsigned long long)(iterations * std::max(2.0, std::min(factor, 10.0)));
+		}
+
+		std::vector<double> perIteration;
+		double itemsPerIteration = 0.0;
+		for (unsigned int r = 0; r < repetitions; r++)
+		{
+			MicroBenchmarkState state(iterations);
+			function(state);
+			perIteration.push_back(state.seconds() * 1e9 / iterations);
+			itemsPerIteration = state.itemsPerIteration;
+		}
+		result.iterations = iterations;
+		for (double ns : perIteration)
+			result.nanoseconds += ns;
+		result.nanoseconds /= perIteration.size();
+		result.minNanoseconds = *std::min_element(perIteration.begin(), perIteration.end());
+		for (double ns : perIteration)
+			result.stddevNanoseconds += (ns - result.nanoseconds) * (ns - result.nanoseconds);
+		result.stddevNanoseconds = std::sqrt(result.stddevNanoseconds / perIteration.size());
+		if (itemsPerIteration > 0.0 && result.nanoseconds > 0.0)
+			result.itemsPerSecond = itemsPerIteration * 1e9 / result.nanoseconds;
+		return result;
+	}
+
+	static std::string formatTime(double nanoseconds)
+	{
+		char text[32];
+		if (nanoseconds >= 1e6)
+			snprintf(text, sizeof(text), "%.3f ms", nanoseconds / 1e6);
+		else if (nanoseconds >= 1e3)
+			snprintf(text, sizeof(text), "%.3f us", nanoseconds / 1e3);
+		else
+			snprintf(text, sizeof(text), "%.1f ns", nanoseconds);
+		return text;
+	}
+
+	static void printRow(const MicroBenchmarkResult& result)
+	{
+		std::cout << std::left << std::setw(44) << result.name << std::right;
+		if (!result.skipped.empty())
+		{
+			std::cout << "  skipped: " << result.skipped << std::endl;
+			return;
+		}
+		char stddev[16];
+		snprintf(stddev, sizeof(stddev), "%.1f%%", result.nanoseconds > 0.0 ? result.stddevNanoseconds / result.nanoseconds * 100.0 : 0.0);
+		char items[32] = "";
+		if (result.itemsPerSecond > 0.0)
+			snprintf(items, sizeof(items), "%.1fM", result.itemsPerSecond / 1e6);
+		std::cout << std::setw(12) << result.iterations << std::setw(14) << formatTime(result.nanoseconds) << std::setw(14)
+			<< formatTime(result.minNanoseconds) << std::setw(10) << stddev << std::setw(14) << items << "  " << result.label << std::endl;
+	}
+};
+#endif
@@ -0,0 +1,27 @@
+#version 330 core
+out vec4 FragColor;
+
+in VS_OUT {
+    vec3 FragPos;
+    vec2 TexCoords;
+    vec3 TangentLightPos;
+    vec3 TangentViewPos;
+    vec3 TangentFragPos;
+} fs_in;
+
+// writes the mesh (index + 1, red/green) and the level of detail of its uvs for a 1x1 texture (blue/alpha, 16 bit
+// fixed point), see mip_feedback.h. textureQueryLod needs GLSL 4.00, the lod comes from the derivatives.
+// lodBias makes up for the lower resolution of the feedback target
+uniform int meshIndex;
+uniform float lodBias;
+
+void main()
+{
+    vec2 dx = dFdx(fs_in.TexCoords);
+    vec2 dy = dFdy(fs_in.TexCoords);
+    float d = max(dot(dx, dx), dot(dy, dy));
+    float lod = clamp(0.5 * log2(max(d, 1e-20)) + lodBias, -32.0, 223.0);
+    uint value = uint((lod + 32.0) * 256.0);
+    uint mesh = uint(meshIndex);
+    FragColor = vec4(float(mesh & 255u), float(mesh >> 8u), float(value & 255u), float(value >> 8u)) / 255.0;
+}
@@ -0,0 +1,282 @@
+#ifndef MIP_FEEDBACK_H
+#define MIP_FEEDBACK_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <../shader.h>
+#include "mesh.h"
+#include "jobsystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <vector>
+
+// Measures which mip levels the screen actually samples. A feedback pass draws the visible meshes at a fraction
+// of the screen resolution with mip_feedback.fs, which writes per pixel the mesh and the level of detail of its
+// uvs for a 1x1 texture (from the uv derivatives, textureQueryLod needs GLSL 4.00). A texture of size s then
+// needs level lod + log2(s) there, so one pass covers every texture of a mesh.
+// The image is read back through two PBOs two frames later, so mapping it never waits for the GPU, and reduced on
+// the worker threads into the finest level every texture needs and how many pixels need each level.
+
+#define MIP_FEEDBACK_MAX_LEVELS 16
+
+// the uv level of detail is stored as 16 bit fixed point in blue/alpha: (lod + offset) * scale
+#define MIP_FEEDBACK_LOD_OFFSET 32.0f
+#define MIP_FEEDBACK_LOD_SCALE 256.0f
+// uv lod of a mesh that isn't on screen
+#define MIP_FEEDBACK_NO_LOD 1e9f
+
+struct TextureMipUsage {
+	glm::ivec2 size = glm::ivec2(0);
+	int levels = 1;
+	// finest level any pixel needs, levels if the texture wasn't on screen
+	int requiredLevel = 0;
+	unsigned int pixels = 0;
+	// pixels per needed level
+	unsigned int histogram[MIP_FEEDBACK_MAX_LEVELS] = {};
+	// last update() the texture was on screen
+	unsigned int lastSeen = 0;
+};
+
+class MipFeedback
+{
+public:
+	int divisor = 8;
+	// texture id -> usage of the last reduced feedback
+	std::map<unsigned int, TextureMipUsage> usage;
+	// update() calls that reduced a feedback image
+	unsigned int frame = 0;
+	float reduceMilliseconds = 0.0f;
+
+	MipFeedback() {}
+	MipFeedback(const MipFeedback&) = delete;
+	MipFeedback& operator=(const MipFeedback&) = delete;
+
+	~MipFeedback()
+	{
+		release();
+	}
+
+	void create(int screenWidth, int screenHeight)
+	{
+		release();
+		width = std::max(screenWidth / divisor, 1);
+		height = std::max(screenHeight / divisor, 1);
+		glGenTextures(1, &color);
+		glBindTexture(GL_TEXTURE_2D, color);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::MIP_FEEDBACK::FRAMEBUFFER_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glGenBuffers(2, buffers);
+		for (int i = 0; i < 2; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		written = 0;
+	}
+
+	// draws meshes[meshIndices] into the feedback image. the shader's projection/view/model must be set
+	void render(Shader& shader, std::vector<Mesh>& meshes, const std::vector<unsigned int>& meshIndices)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, width, height);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		// blending would mix the encoded values
+		GLboolean blend = glIsEnabled(GL_BLEND);
+		glDisable(GL_BLEND);
+		shader.use();
+		// the derivatives are divisor times larger than on screen
+		shader.setFloat("lodBias", -std::log2((float)divisor));
+		for (unsigned int i = 0; i < meshIndices.size(); i++)
+		{
+			shader.setInt("meshIndex", (int)meshIndices[i] + 1);
+			meshes[meshIndices[i]].Draw(shader);
+		}
+		if (blend)
+			glEnable(GL_BLEND);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[written % 2]);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		written++;
+	}
+
+	// gives a texture its size when GL doesn't have it any more, e.g. a source texture a TextureArrayLibrary
+	// released. the usage is reset
+	void setTextureSize(unsigned int id, glm::ivec2 size)
+	{
+		TextureMipUsage entry;
+		entry.size = size;
+		countLevels(entry);
+		usage[id] = entry;
+	}
+
+	// reduces the feedback image of two frames ago into usage. false until there is one
+	bool update(JobSystem& jobs, const std::vector<Mesh>& meshes)
+	{
+		if (written < 2)
+			return false;
+		auto start = std::chrono::high_resolution_clock::now();
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[written % 2]);
+		const unsigned char* texels = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if (!texels)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			return false;
+		}
+
+		// every chunk of rows reduces into its own lists: the finest uv lod of every mesh and a count of its
+		// pixels per whole uv lod, -MIP_FEEDBACK_MAX_LEVELS..MIP_FEEDBACK_MAX_LEVELS
+		const unsigned int grain = 8;
+		const unsigned int buckets = MIP_FEEDBACK_MAX_LEVELS * 2;
+		unsigned int chunks = (height + grain - 1) / grain;
+		chunkLods.resize(chunks);
+		chunkCounts.resize(chunks);
+		for (unsigned int c = 0; c < chunks; c++)
+		{
+			chunkLods[c].assign(meshes.size(), MIP_FEEDBACK_NO_LOD);
+			chunkCounts[c].assign(meshes.size() * buckets, 0);
+		}
+		jobs.parallelFor((unsigned int)height, grain, [&](unsigned int begin, unsigned int end) {
+			std::vector<float>& lods = chunkLods[begin / grain];
+			std::vector<unsigned int>& counts = chunkCounts[begin / grain];
+			for (unsigned int y = begin; y < end; y++)
+			{
+				const unsigned char* row = texels + (size_t)y * width * 4;
+				for (int x = 0; x < width; x++)
+				{
+					const unsigned char* texel = row + x * 4;
+					unsigned int mesh = texel[0] | (texel[1] << 8);
+					if (mesh == 0 || mesh > lods.size())
+						continue;
+					float lod = (texel[2] | (texel[3] << 8)) / MIP_FEEDBACK_LOD_SCALE - MIP_FEEDBACK_LOD_OFFSET;
+					lods[mesh - 1] = std::min(lods[mesh - 1], lod);
+					int bucket = std::min(std::max((int)std::floor(lod) + MIP_FEEDBACK_MAX_LEVELS, 0), (int)buckets - 1);
+					counts[(mesh - 1) * buckets + bucket]++;
+				}
+			}
+		});
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		meshLods.assign(meshes.size(), MIP_FEEDBACK_NO_LOD);
+		meshCounts.assign(meshes.size() * buckets, 0);
+		for (unsigned int c = 0; c < chunks; c++)
+		{
+			for (unsigned int i = 0; i < meshes.size(); i++)
+				meshLods[i] = std::min(meshLods[i], chunkLods[c][i]);
+			for (unsigned int i = 0; i < meshCounts.size(); i++)
+				meshCounts[i] += chunkCounts[c][i];
+		}
+
+		// the textures of a mesh need the mesh's uv lods shifted by their size
+		frame++;
+		for (std::map<unsigned int, TextureMipUsage>::iterator it = usage.begin(); it != usage.end(); ++it)
+		{
+			it->second.requiredLevel = it->second.levels;
+			it->second.pixels = 0;
+			std::fill(it->second.histogram, it->second.histogram + MIP_FEEDBACK_MAX_LEVELS, 0u);
+		}
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			if (meshLods[i] >= MIP_FEEDBACK_NO_LOD)
+				continue;
+			for (const Texture& texture : meshes[i].textures)
+			{
+				TextureMipUsage& entry = usageOf(texture.id);
+				entry.requiredLevel = std::min(entry.requiredLevel, levelOf(entry, meshLods[i]));
+				entry.lastSeen = frame;
+				// whole level buckets, the histogram is off by up to a level for sizes that aren't powers of two
+				for (unsigned int bucket = 0; bucket < buckets; bucket++)
+				{
+					unsigned int count = meshCounts[i * buckets + bucket];
+					if (!count)
+						continue;
+					entry.histogram[levelOf(entry, (float)bucket - MIP_FEEDBACK_MAX_LEVELS)] += count;
+					entry.pixels += count;
+				}
+			}
+		}
+		reduceMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return true;
+	}
+
+	// deletes the feedback target and read back buffers, before the context goes away. create() makes new ones
+	void release()
+	{
+		if (color)
+			glDeleteTextures(1, &color);
+		if (depth)
+			glDeleteRenderbuffers(1, &depth);
+		if (framebuffer)
+			glDeleteFramebuffers(1, &framebuffer);
+		if (buffers[0])
+			glDeleteBuffers(2, buffers);
+		color = depth = framebuffer = 0;
+		buffers[0] = buffers[1] = 0;
+	}
+
+private:
+	int width = 0, height = 0;
+	unsigned int framebuffer = 0, color = 0, depth = 0;
+	unsigned int buffers[2] = { 0, 0 };
+	unsigned int written = 0;
+	std::vector<std::vector<float>> chunkLods;
+	std::vector<std::vector<unsigned int>> chunkCounts;
+	std::vector<float> meshLods;
+	std::vector<unsigned int> meshCounts;
+
+	// the entry of a texture, created with its full size taken from the base level, so streamed textures that
+	// don't have level 0 yet work too
+	TextureMipUsage& usageOf(unsigned int id)
+	{
+		std::map<unsigned int, TextureMipUsage>::iterator it = usage.find(id);
+		if (it != usage.end())
+			return it->second;
+		TextureMipUsage entry;
+		int base = 0;
+		glBindTexture(GL_TEXTURE_2D, id);
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, &base);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, base, GL_TEXTURE_WIDTH, &entry.size.x);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, base, GL_TEXTURE_HEIGHT, &entry.size.y);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		entry.size.x <<= base;
+		entry.size.y <<= base;
+		countLevels(entry);
+		return usage.insert(std::make_pair(id, entry)).first->second;
+	}
+
+	// levels of the full mip chain of entry.size, nothing is required yet
+	static void countLevels(TextureMipUsage& entry)
+	{
+		entry.levels = 1;
+		while ((std::max(entry.size.x, entry.size.y) >> entry.levels) > 0 && entry.levels < MIP_FEEDBACK_MAX_LEVELS)
+			entry.levels++;
+		entry.requiredLevel = entry.levels;
+	}
+
+	static int levelOf(const TextureMipUsage& entry, float uvLod)
+	{
+		float lod = uvLod + std::log2((float)std::max(std::max(entry.size.x, entry.size.y), 1));
+		return std::min(std::max((int)std::floor(lod), 0), entry.levels - 1);
+	}
+};
+#endif
@@ -0,0 +1,77 @@
+#ifndef MIPGEN_H
+#define MIPGEN_H
+
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPGEN_SSE2
+#endif
+
+// Box filtered mip levels of RGBA8 images on the CPU, for the offline bakers. Every texel of the next level is the
+// rounded average (a + b + c + d + 2) / 4 of a 2x2 block, an odd last row or column is repeated, which is what
+// glGenerateMipmap does for power of two sizes. The SSE2 version gives the same bytes as the scalar one.
+
+// next level of a width x height image into dst, which holds max(width / 2, 1) x max(height / 2, 1) texels
+inline void downsampleBoxScalar(const unsigned char* src, int width, int height, unsigned char* dst)
+{
+	int nextWidth = std::max(width / 2, 1), nextHeight = std::max(height / 2, 1);
+	for (int y = 0; y < nextHeight; y++)
+		for (int x = 0; x < nextWidth; x++)
+		{
+			int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+			int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+			for (int c = 0; c < 4; c++)
+			{
+				int sum = src[((size_t)y0 * width + x0) * 4 + c] + src[((size_t)y0 * width + x1) * 4 + c]
+					+ src[((size_t)y1 * width + x0) * 4 + c] + src[((size_t)y1 * width + x1) * 4 + c];
+				dst[((size_t)y * nextWidth + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+}
+
+// same result, 4 texels of the next level at a time
+inline void downsampleBox(const unsigned char* src, int width, int height, unsigned char* dst)
+{
+#ifdef MIPGEN_SSE2
+	int nextWidth = std::max(width / 2, 1), nextHeight = std::max(height / 2, 1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	for (int y = 0; y < nextHeight; y++)
+	{
+		const unsigned char* row0 = src + (size_t)std::min(y * 2, height - 1) * width * 4;
+		const unsigned char* row1 = src + (size_t)std::min(y * 2 + 1, height - 1) * width * 4;
+		unsigned char* out = dst + (size_t)y * nextWidth * 4;
+		int x = 0;
+		// 8 source texels per step, all of them inside the row
+		for (; x * 2 + 8 <= width; x += 4)
+		{
+			__m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+			__m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16));
+			__m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+			__m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16));
+			// vertical sums in 16 bits, two source texels per register
+			__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+			__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+			__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+			__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+			// horizontal: the texel in the upper half onto the one in the lower half
+			s0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8));
+			s1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+			s2 = _mm_add_epi16(s2, _mm_srli_si128(s2, 8));
+			s3 = _mm_add_epi16(s3, _mm_srli_si128(s3, 8));
+			__m128i t01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s0, s1), two), 2);
+			__m128i t23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s2, s3), two), 2);
+			_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(t01, t23));
+		}
+		for (; x < nextWidth; x++)
+		{
+			int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+			for (int c = 0; c < 4; c++)
+				out[x * 4 + c] = (unsigned char)((row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c] + 2) / 4);
+		}
+	}
+#else
+	downsampleBoxScalar(src, width, height, dst);
+#endif
+}
+#endif
@@ -12,17 +12,63 @@
 
 #include <../mesh.h>
 #include <../shader.h>
+#include "utils.h"
+#include "frustum.h"
+#include "render_queue.h"
+#include "atlas.h"
+#include "streamed_texture.h"
+#include "profiler.h"
+#include "jobsystem.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <vector>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
+// one node of the imported scene graph
+struct ModelNode {
+	string name;
+	// indices into Model::meshes
+	vector<unsigned int> meshes;
+	// indices into Model::nodes
+	vector<unsigned int> children;
+	AABB bounds;
+	BoundingSphere sphere;
+};
+
+// result of Model::atlasSmallTextures()
+struct AtlasStats {
+	unsigned int atlases = 0;
+	unsigned int texturesMerged = 0;
+	unsigned int meshesRemapped = 0;
+	// distinct texture sets of the meshes before and after, every set is a separate round of binds per frame
+	unsigned int materialsBefore = 0;
+	unsigned int materialsAfter = 0;
+	// mean fraction of the atlases covered by images
+	float occupancy = 0.0f;
+};
+
+// CPU side of one aiMesh, converted on a worker before its Mesh is created
+struct ImportedMesh {
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	vector<Meshlet> meshlets;
+};
+
+// skinning data of one bone
+struct BoneInfo {
+	// index of the bone's matrix in the palette
+	int id;
+	// transforms a vertex from model space into the bone's space
+	glm::mat4 offset;
+};
+
 class Model
 {
 public:
@@ -31,15 +77,40 @@ public:
 	vector<Mesh>    meshes;
 	string directory;
 	bool gammaCorrection;
+	// split every mesh into meshlets at load time, see meshlet.h
+	bool useMeshlets;
+	// cull meshlets in Draw(shader, meshIndices), with the view from setMeshletView()
+	bool meshletCulling = true;
+	MeshletCullStats meshletStats;
+	// bounds of the whole model, min_x...max_z mirror them
+	AABB bounds;
+	BoundingSphere sphere;
 	float max_x = 0.0f;
 	float max_y = 0.0f;
 	float max_z = 0.0f;
-	float min_x = 10000.0f;
-	float min_y = 10000.0f;
-	float min_z = 10000.0f;
+	float min_x = 0.0f;
+	float min_y = 0.0f;
+	float min_z = 0.0f;
+	// the assimp node hierarchy, nodes[0] is the root. a node's bounds cover its meshes and all its children
+	vector<ModelNode> nodes;
+	// bones of all meshes, ids are handed out in the order the bones are first met.
+	// for a single skinned mesh that's the aiMesh::mBones order, the same ids loadModel() in skeleton.h uses
+	map<string, BoneInfo> boneInfoMap;
+	int boneCounter = 0;
+	// meshes and triangles per detail level of the last Draw(shader, meshIndices)
+	LodStats lodStats;
+	// atlases built by atlasSmallTextures(), they own the GL textures the remapped meshes use
+	vector<shared_ptr<TextureAtlas>> atlases;
+	AtlasStats atlasStats;
+
+	// streams the textures' mip levels instead of loading them whole, null loads them with TextureFromFile
+	TextureStreamer* streamer;
+	// converts the meshes in parallel while loading, null converts them on the calling thread
+	JobSystem* jobs;
 
 	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	Model(string const &path, bool gamma = false, bool meshlets = false, TextureStreamer* streamer = nullptr, JobSystem* jobs = nullptr)
+		: gammaCorrection(gamma), useMeshlets(meshlets), streamer(streamer), jobs(jobs)
 	{
 		loadModel(path);
 	}
@@ -47,17 +118,455 @@ public:
 	// draws the model, and thus all its meshes
 	void Draw(Shader &shader)
 	{
+		PROFILE_SCOPE("Model::Draw");
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
 	}
 
+	// draws a subset of the meshes, e.g. the result of a BVH query, at the levels picked by selectLods()
+	void Draw(Shader &shader, const vector<unsigned int> &meshIndices)
+	{
+		PROFILE_SCOPE("Model::Draw");
+		lodStats = LodStats();
+		meshletStats = MeshletCullStats();
+		for (unsigned int i = 0; i < meshIndices.size(); i++)
+		{
+			unsigned int mesh = meshIndices[i];
+			unsigned int lod = selectedLod(mesh);
+			meshes[mesh].Draw(shader, lod, meshletCulling ? &meshletView : nullptr, &meshletStats);
+		}
+	}
+
+	// queues the same draws as Draw(shader, meshIndices), sorted front to back by their distance to the camera.
+	// with an arrayShader, meshes that have a texture array material are drawn with it instead, and with a
+	// virtualShader the virtual textured meshes are drawn with that one
+	void submit(RenderQueue &queue, Shader &shader, const vector<unsigned int> &meshIndices, const glm::mat4 &model, const glm::vec3 &cameraPosition, Shader *arrayShader = nullptr, Shader *virtualShader = nullptr)
+	{
+		PROFILE_SCOPE("Model::submit");
+		lodStats = LodStats();
+		meshletStats = MeshletCullStats();
+		for (unsigned int i = 0; i < meshIndices.size(); i++)
+		{
+			unsigned int mesh = meshIndices[i];
+			glm::vec3 center = glm::vec3(model * glm::vec4(meshes[mesh].sphere.center, 1.0f));
+			bool virtualTextured = virtualShader && meshes[mesh].virtualTextured;
+			bool arrays = !virtualTextured && arrayShader && meshes[mesh].arrayMaterial >= 0;
+			Shader &meshShader = virtualTextured ? *virtualShader : arrays ? *arrayShader : shader;
+			queue.submit(meshShader, meshes[mesh], glm::length(center - cameraPosition), selectedLod(mesh),
+				meshletCulling ? &meshletView : nullptr, &meshletStats, arrays ? meshes[mesh].arrayMaterial : -1);
+		}
+	}
+
+	// draws the virtual textured meshes among meshIndices at full detail, for the virtual texture feedback pass
+	void drawVirtualTextured(Shader &shader, const vector<unsigned int> &meshIndices)
+	{
+		for (unsigned int i = 0; i < meshIndices.size(); i++)
+		{
+			if (meshes[meshIndices[i]].virtualTextured)
+				meshes[meshIndices[i]].Draw(shader);
+		}
+	}
+
+	// makes every texture of a type (texture_diffuse, ...) sample through a sampler object, 0 goes back to the
+	// textures' own parameters. returns the number of textures changed
+	unsigned int setSampler(const string &type, unsigned int sampler)
+	{
+		unsigned int changed = 0;
+		for (Mesh &mesh : meshes)
+		{
+			for (Texture &texture : mesh.textures)
+			{
+				if (texture.type == type && texture.sampler != sampler)
+				{
+					texture.sampler = sampler;
+					changed++;
+				}
+			}
+		}
+		return changed;
+	}
+
+	// the diffuse map with the most texels, the one that gains the most from virtual texturing. null if none
+	const Texture* largestDiffuseTexture() const
+	{
+		const Texture* largest = nullptr;
+		int largestArea = 0;
+		for (const Texture& texture : textures_loaded)
+		{
+			if (texture.type != "texture_diffuse")
+				continue;
+			int width = 0, height = 0;
+			glBindTexture(GL_TEXTURE_2D, texture.id);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+			if (width * height > largestArea)
+			{
+				largest = &texture;
+				largestArea = width * height;
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return largest;
+	}
+
+	// marks the meshes whose first diffuse map is textureId as virtual textured, returns how many there are
+	unsigned int useVirtualTexture(unsigned int textureId)
+	{
+		unsigned int count = 0;
+		for (Mesh& mesh : meshes)
+		{
+			mesh.virtualTextured = false;
+			for (const Texture& texture : mesh.textures)
+			{
+				if (texture.type == "texture_diffuse")
+				{
+					mesh.virtualTextured = texture.id == textureId;
+					break;
+				}
+			}
+			count += mesh.virtualTextured ? 1 : 0;
+		}
+		return count;
+	}
+
+	// camera for the meshlet culling of the next draws, the model matrix brings it into mesh space
+	void setMeshletView(const glm::mat4 &model, const glm::mat4 &viewProjection, const glm::vec3 &cameraPosition)
+	{
+		meshletView.frustum = extractFrustum(viewProjection * model);
+		meshletView.cameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+	}
+
+	// builds the detail levels of every mesh, call once after loading
+	void generateLods(unsigned int maxLevels = 4)
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].generateLods(maxLevels);
+	}
+
+	// picks the coarsest level of every mesh whose simplification error stays below pixelError on screen
+	void selectLods(const glm::mat4 &model, const glm::vec3 &cameraPosition, const glm::mat4 &projection, float viewportHeight, float pixelError)
+	{
+		float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		meshLod.resize(meshes.size());
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			BoundingSphere world;
+			world.center = glm::vec3(model * glm::vec4(meshes[i].sphere.center, 1.0f));
+			world.radius = meshes[i].sphere.radius * scale;
+			meshLod[i] = selectLod(meshes[i].lods, world, scale, cameraPosition, projection, viewportHeight, pixelError);
+		}
+	}
+
+	// tells the streamer which level of every texture the visible meshes need: the level where a texel covers
+	// about a pixel, taking the mesh's screen size as the size of the whole texture (its uvs span [0, 1])
+	void requireTextureLevels(const vector<unsigned int> &meshIndices, const glm::mat4 &model, const glm::vec3 &cameraPosition, const glm::mat4 &projection, float viewportHeight)
+	{
+		if (!streamer)
+			return;
+		float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		for (unsigned int i = 0; i < meshIndices.size(); i++)
+		{
+			const Mesh& mesh = meshes[meshIndices[i]];
+			glm::vec3 center = glm::vec3(model * glm::vec4(mesh.sphere.center, 1.0f));
+			float radius = mesh.sphere.radius * scale;
+			float distance = glm::length(center - cameraPosition) - radius;
+			float pixels = distance > 0.0f ? 2.0f * radius / distance * projection[1][1] * 0.5f * viewportHeight : 1e9f;
+			for (const Texture& texture : mesh.textures)
+			{
+				glm::ivec2 size = streamer->size(texture.id);
+				float texels = (float)glm::max(size.x, size.y);
+				streamer->require(texture.id, texels > pixels ? (int)std::floor(std::log2(texels / glm::max(pixels, 1.0f))) : 0);
+			}
+		}
+	}
+
+	// packs the textures of meshes that only use small textures into atlases and remaps their texture
+	// coordinates, so meshes that had different textures end up with the same ones and draw without rebinding.
+	// a mesh qualifies when all its textures are at most maxSize and of one size, and its uvs stay in [0, 1]
+	// (the atlas can't repeat a region). meshes with the same texture types share atlases, one atlas layer per
+	// type. call once after loading, before anything else looks at the texture ids.
+	// with a bakedPrefix the atlases saveAtlases() wrote there are loaded instead, as long as they hold exactly
+	// the texture sets (by path and size) packing would put into them
+	void atlasSmallTextures(int maxSize = 1024, int atlasSize = 4096, const string &bakedPrefix = "")
+	{
+		int maxTextureSize = atlasSize;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+		atlasSize = std::min(atlasSize, maxTextureSize);
+
+		// texture sets of the qualifying meshes, grouped by their list of texture types
+		map<vector<unsigned int>, vector<unsigned int>> meshesOfSet;	// texture ids -> meshes
+		map<vector<unsigned int>, glm::ivec2> sizeOfSet;
+		map<vector<string>, vector<vector<unsigned int>>> setsOfTypes;
+		map<vector<unsigned int>, bool> allSets;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			vector<unsigned int> ids = textureIds(meshes[i]);
+			allSets[ids] = true;
+			glm::ivec2 size;
+			if (!atlasable(meshes[i], maxSize, size))
+				continue;
+			if (meshesOfSet[ids].empty())
+			{
+				vector<string> types;
+				for (const Texture& texture : meshes[i].textures)
+					types.push_back(texture.type);
+				setsOfTypes[types].push_back(ids);
+				sizeOfSet[ids] = size;
+			}
+			meshesOfSet[ids].push_back(i);
+		}
+
+		atlasStats = AtlasStats();
+		atlasStats.materialsBefore = (unsigned int)allSets.size();
+		map<unsigned int, bool> replaced;
+		vector<vector<unsigned char>> pixels;
+		vector<const unsigned char*> layers;
+		for (map<vector<string>, vector<vector<unsigned int>>>::iterator group = setsOfTypes.begin(); group != setsOfTypes.end(); ++group)
+		{
+			// a single texture set gains nothing from an atlas
+			const vector<vector<unsigned int>>& sets = group->second;
+			if (sets.size() < 2)
+				continue;
+			const vector<string>& types = group->first;
+			if (!bakedPrefix.empty() && loadBakedAtlases(bakedPrefix, types, sets, sizeOfSet, meshesOfSet, replaced))
+				continue;
+			shared_ptr<TextureAtlas> atlas;
+			unsigned int atlasesOfTypes = 0;
+			vector<pair<vector<unsigned int>, int>> placed;
+			for (unsigned int s = 0; s <= sets.size(); s++)
+			{
+				int region = -1;
+				if (s < sets.size())
+				{
+					glm::ivec2 size = sizeOfSet[sets[s]];
+					string name = setName(sets[s], meshesOfSet);
+					if (!atlas)
+					{
+						atlas = make_shared<TextureAtlas>(atlasSize, atlasSize, (int)types.size());
+						atlas->name = atlasName(types, atlasesOfTypes++);
+					}
+					readTextures(sets[s], size, pixels, layers);
+					region = atlas->add(layers, size.x, size.y, name);
+					if (region < 0 && !placed.empty())
+					{
+						// full, finish this atlas and retry the set in a new one
+						finishAtlas(atlas, types, placed, meshesOfSet, replaced);
+						placed.clear();
+						atlas = make_shared<TextureAtlas>(atlasSize, atlasSize, (int)types.size());
+						atlas->name = atlasName(types, atlasesOfTypes++);
+						region = atlas->add(layers, size.x, size.y, name);
+					}
+					if (region >= 0)
+						placed.push_back(make_pair(sets[s], region));
+				}
+				else if (!placed.empty())
+					finishAtlas(atlas, types, placed, meshesOfSet, replaced);
+			}
+		}
+
+		// originals no mesh uses anymore
+		allSets.clear();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			vector<unsigned int> ids = textureIds(meshes[i]);
+			allSets[ids] = true;
+			for (unsigned int id : ids)
+				replaced.erase(id);
+		}
+		for (map<unsigned int, bool>::iterator it = replaced.begin(); it != replaced.end(); ++it)
+			glDeleteTextures(1, &it->first);
+		for (unsigned int i = 0; i < textures_loaded.size(); )
+		{
+			if (replaced.count(textures_loaded[i].id))
+				textures_loaded.erase(textures_loaded.begin() + i);
+			else
+				i++;
+		}
+		atlasStats.materialsAfter = (unsigned int)allSets.size();
+		atlasStats.texturesMerged = (unsigned int)replaced.size();
+		for (const shared_ptr<TextureAtlas>& atlas : atlases)
+			atlasStats.occupancy += atlas->occupancy() / atlases.size();
+
+		std::cout << "Model::atlasSmallTextures() atlases=" << atlasStats.atlases << " (" << atlasSize << "x" << atlasSize
+			<< ", " << atlasStats.occupancy * 100.0f << "% occupied) textures merged=" << atlasStats.texturesMerged
+			<< " meshes remapped=" << atlasStats.meshesRemapped << " texture sets " << atlasStats.materialsBefore << " -> "
+			<< atlasStats.materialsAfter << " (" << atlasStats.materialsBefore - atlasStats.materialsAfter << " texture binds less per frame)" << std::endl;
+	}
+
+	// writes every atlas as prefix + its name, for atlasSmallTextures() to load next time
+	bool saveAtlases(const string &prefix) const
+	{
+		bool saved = true;
+		for (const shared_ptr<TextureAtlas>& atlas : atlases)
+		{
+			saved &= atlas->save(prefix + atlas->name);
+			std::cout << "Model::saveAtlases() " << prefix + atlas->name << " regions=" << atlas->regions.size() << std::endl;
+		}
+		return saved;
+	}
+
 private:
+	// level of every mesh from the last selectLods()
+	vector<unsigned int> meshLod;
+	MeshletView meshletView;
+
+	static vector<unsigned int> textureIds(const Mesh &mesh)
+	{
+		vector<unsigned int> ids;
+		for (const Texture& texture : mesh.textures)
+			ids.push_back(texture.id);
+		return ids;
+	}
+
+	// whether the textures of a mesh can go into an atlas, size is their common size
+	static bool atlasable(const Mesh &mesh, int maxSize, glm::ivec2 &size)
+	{
+		if (mesh.textures.empty())
+			return false;
+		for (unsigned int i = 0; i < mesh.textures.size(); i++)
+		{
+			glm::ivec2 textureSize(0);
+			glBindTexture(GL_TEXTURE_2D, mesh.textures[i].id);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &textureSize.x);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &textureSize.y);
+			if (textureSize.x <= 0 || textureSize.y <= 0 || textureSize.x > maxSize || textureSize.y > maxSize || (i > 0 && textureSize != size))
+				return false;
+			size = textureSize;
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		// a little slack for exporters that write 1.0001
+		const float epsilon = 1e-3f;
+		for (const Vertex& vertex : mesh.vertices)
+		{
+			if (vertex.TexCoords.x < -epsilon || vertex.TexCoords.x > 1.0f + epsilon || vertex.TexCoords.y < -epsilon || vertex.TexCoords.y > 1.0f + epsilon)
+				return false;
+		}
+		return true;
+	}
+
+	// level 0 of every texture of a set as RGBA8
+	static void readTextures(const vector<unsigned int> &ids, glm::ivec2 size, vector<vector<unsigned char>> &pixels, vector<const unsigned char*> &layers)
+	{
+		pixels.resize(ids.size());
+		layers.resize(ids.size());
+		for (unsigned int i = 0; i < ids.size(); i++)
+		{
+			pixels[i].resize((size_t)size.x * size.y * 4);
+			glBindTexture(GL_TEXTURE_2D, ids[i]);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[i][0]);
+			layers[i] = &pixels[i][0];
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// the k-th atlas of a list of texture types, e.g. texture_diffuse-texture_normal.0.atlas
+	static string atlasName(const vector<string> &types, unsigned int k)
+	{
+		string name;
+		for (const string& type : types)
+			name += (name.empty() ? "" : "-") + type;
+		return name + "." + std::to_string(k) + ".atlas";
+	}
+
+	// the texture paths of a set, the name of its region in an atlas
+	string setName(const vector<unsigned int> &set, map<vector<unsigned int>, vector<unsigned int>> &meshesOfSet) const
+	{
+		string name;
+		for (const Texture& texture : meshes[meshesOfSet[set][0]].textures)
+			name += (name.empty() ? "" : "|") + texture.path;
+		return name;
+	}
+
+	// loads the saved atlases of a group of sets. false, and nothing changed, unless every region belongs to one
+	// of the sets with the set's size and every set has a region
+	bool loadBakedAtlases(const string &prefix, const vector<string> &types, const vector<vector<unsigned int>> &sets, map<vector<unsigned int>, glm::ivec2> &sizeOfSet,
+		map<vector<unsigned int>, vector<unsigned int>> &meshesOfSet, map<unsigned int, bool> &replaced)
+	{
+		map<string, vector<unsigned int>> setOfName;
+		for (const vector<unsigned int>& set : sets)
+			setOfName[setName(set, meshesOfSet)] = set;
+		vector<shared_ptr<TextureAtlas>> loaded;
+		vector<vector<pair<vector<unsigned int>, int>>> placed;
+		map<string, bool> matched;
+		for (unsigned int k = 0; std::ifstream((prefix + atlasName(types, k)).c_str()); k++)
+		{
+			shared_ptr<TextureAtlas> atlas = make_shared<TextureAtlas>(0, 0, 0);
+			atlas->name = atlasName(types, k);
+			if (!atlas->load(prefix + atlas->name) || atlas->pixels.size() != types.size())
+				return false;
+			placed.push_back(vector<pair<vector<unsigned int>, int>>());
+			for (unsigned int r = 0; r < atlas->regions.size(); r++)
+			{
+				const AtlasRegion& region = atlas->regions[r];
+				map<string, vector<unsigned int>>::iterator set = setOfName.find(region.name);
+				if (set == setOfName.end() || matched.count(region.name) || sizeOfSet[set->second] != glm::ivec2(region.width, region.height))
+				{
+					std::cout << "Model::atlasSmallTextures() " << prefix + atlas->name << " is out of date, packing again" << std::endl;
+					return false;
+				}
+				matched[region.name] = true;
+				placed.back().push_back(make_pair(set->second, (int)r));
+			}
+			loaded.push_back(atlas);
+		}
+		if (loaded.empty())
+			return false;
+		if (matched.size() != sets.size())
+		{
+			std::cout << "Model::atlasSmallTextures() " << prefix + loaded[0]->name << " misses texture sets, packing again" << std::endl;
+			return false;
+		}
+		for (unsigned int i = 0; i < loaded.size(); i++)
+			finishAtlas(loaded[i], types, placed[i], meshesOfSet, replaced);
+		std::cout << "Model::atlasSmallTextures() loaded " << loaded.size() << " baked atlases of " << sets.size() << " texture sets" << std::endl;
+		return true;
+	}
+
+	// uploads an atlas and points the meshes of its texture sets at it
+	void finishAtlas(shared_ptr<TextureAtlas> &atlas, const vector<string> &types, const vector<pair<vector<unsigned int>, int>> &placed,
+		map<vector<unsigned int>, vector<unsigned int>> &meshesOfSet, map<unsigned int, bool> &replaced)
+	{
+		atlas->upload();
+		vector<Texture> textures(types.size());
+		for (unsigned int layer = 0; layer < types.size(); layer++)
+		{
+			textures[layer].id = atlas->textures[layer];
+			textures[layer].type = types[layer];
+			textures[layer].path = "atlas" + std::to_string(atlases.size()) + "_" + types[layer];
+		}
+		for (const pair<vector<unsigned int>, int>& set : placed)
+		{
+			const AtlasRegion& region = atlas->regions[set.second];
+			for (unsigned int mesh : meshesOfSet[set.first])
+			{
+				meshes[mesh].remapTexCoords(region.uvScale, region.uvOffset);
+				meshes[mesh].setTextures(textures);
+				atlasStats.meshesRemapped++;
+			}
+			for (unsigned int id : set.first)
+				replaced[id] = true;
+		}
+		atlases.push_back(atlas);
+		atlasStats.atlases++;
+	}
+
+	// level of a mesh from the last selectLods(), counted in lodStats
+	unsigned int selectedLod(unsigned int mesh)
+	{
+		unsigned int lod = mesh < meshLod.size() ? meshLod[mesh] : 0;
+		lodStats.meshes[lod]++;
+		lodStats.triangles[lod] += meshes[mesh].lods[lod].indexCount / 3;
+		return lod;
+	}
+
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 	void loadModel(string const &path)
 	{
+		PROFILE_SCOPE("Model::loadModel");
 		// read file via ASSIMP
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		// identical vertices are joined so triangles share them, the LOD simplifier can only collapse shared vertices
+		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
@@ -67,50 +576,90 @@ private:
 		// retrieve the directory path of the filepath
 		directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		// the node tree is walked first and only collects the meshes, they are converted in parallel into one slot each.
+		// everything that touches the model's shared state or GL runs on this thread, in the order of the meshes
+		vector<aiMesh*> meshJobs;
+		processNode(scene->mRootNode, scene, meshJobs);
+		for (aiMesh* mesh : meshJobs)
+			registerBones(mesh);
+		vector<ImportedMesh> imported(meshJobs.size());
+		auto convert = [&](unsigned int begin, unsigned int end) {
+			for (unsigned int i = begin; i < end; i++)
+				convertMesh(meshJobs[i], imported[i]);
+		};
+		if (jobs)
+			jobs->parallelFor((unsigned int)meshJobs.size(), 1, convert);
+		else
+			convert(0, (unsigned int)meshJobs.size());
+		createMeshes(meshJobs, imported, scene);
+		computeNodeBounds();
+
+		bounds = nodes[0].bounds;
+		sphere = nodes[0].sphere;
+		if (bounds.valid())
+		{
+			min_x = bounds.min.x; min_y = bounds.min.y; min_z = bounds.min.z;
+			max_x = bounds.max.x; max_y = bounds.max.y; max_z = bounds.max.z;
+		}
 	}
 
-	void processNode(aiNode *node, const aiScene *scene)
+	// returns the index of the node in nodes. a node's meshes get the next indices of meshJobs, which become
+	// their indices in meshes
+	unsigned int processNode(aiNode *node, const aiScene *scene, vector<aiMesh*> &meshJobs)
 	{
-		// process each mesh located at the current node
+		unsigned int index = (unsigned int)nodes.size();
+		nodes.push_back(ModelNode());
+		nodes[index].name = node->mName.C_Str();
+
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
-
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			nodes[index].meshes.push_back((unsigned int)meshJobs.size());
+			meshJobs.push_back(scene->mMeshes[node->mMeshes[i]]);
 		}
 		
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			// nodes may grow while the child is processed, so index instead of holding a reference
+			unsigned int child = processNode(node->mChildren[i], scene, meshJobs);
+			nodes[index].children.push_back(child);
 		}
+		return index;
+	}
 
+	// children come after their parent in nodes, so going backwards every child is done before its parent
+	void computeNodeBounds()
+	{
+		for (unsigned int i = (unsigned int)nodes.size(); i-- > 0; )
+		{
+			ModelNode& node = nodes[i];
+			node.bounds = AABB();
+			for (unsigned int mesh : node.meshes)
+				node.bounds.expand(meshes[mesh].bounds);
+			for (unsigned int child : node.children)
+				node.bounds.expand(nodes[child].bounds);
+			node.sphere = sphereFromAABB(node.bounds);
+		}
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// vertices, indices, bone weights and meshlets of a mesh. runs on any thread, only reads boneInfoMap
+	void convertMesh(const aiMesh *mesh, ImportedMesh &output)
 	{
-		// data to fill
-		vector<Vertex> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		PROFILE_SCOPE("Model::convertMesh");
+		vector<Vertex>& vertices = output.vertices;
+		vector<unsigned int>& indices = output.indices;
 
 		// walk through each of the mesh's vertices
+		vertices.resize(mesh->mNumVertices);
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 		{
-			Vertex vertex;
+			Vertex& vertex = vertices[i];
+			setVertexBoneDataToDefault(vertex);
 			glm::vec3 vector; 
 			// positions
 			vector.x = mesh->mVertices[i].x;
 			vector.y = mesh->mVertices[i].y;
 			vector.z = mesh->mVertices[i].z;
 			vertex.Position = vector;
-			if (glm::abs(vector.x) > max_x) max_x = glm::abs(vector.x);
-			if (glm::abs(vector.y) > max_y) max_y = glm::abs(vector.y);
-			if (glm::abs(vector.z) > max_z) max_z = glm::abs(vector.z);
-			if (glm::abs(vector.x) < min_x) min_x = glm::abs(vector.x);
-			if (glm::abs(vector.y) < min_y) min_y = glm::abs(vector.y);
-			if (glm::abs(vector.z) < min_z) min_z = glm::abs(vector.z);
 			// normals
 			if (mesh->HasNormals())
 			{
@@ -139,35 +688,126 @@ private:
 			}
 			else
 				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-
-			vertices.push_back(vertex);
 		}
 		// now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+		indices.reserve((size_t)mesh->mNumFaces * 3);
 		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i];
+			const aiFace& face = mesh->mFaces[i];
 			// retrieve all indices of the face and store them in the indices vector
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
 				indices.push_back(face.mIndices[j]);
 		}
-		// process materials
-		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+		// bone ids and weights for the skinning shader
+		extractBoneWeightForVertices(vertices, mesh);
+
+		// regroup the triangles into meshlets, the reordered list is still the mesh's full index list
+		if (useMeshlets && !vertices.empty())
+			indices = buildMeshlets(&vertices[0].Position, vertices.size(), sizeof(Vertex), indices, output.meshlets);
+	}
+
+	// the GL side of the converted meshes: their textures and buffers, in the order of meshJobs
+	void createMeshes(const vector<aiMesh*> &meshJobs, vector<ImportedMesh> &imported, const aiScene *scene)
+	{
+		PROFILE_SCOPE("Model::createMeshes");
+		meshes.reserve(meshes.size() + meshJobs.size());
+		for (unsigned int i = 0; i < meshJobs.size(); i++)
+		{
+			// process materials
+			aiMaterial* material = scene->mMaterials[meshJobs[i]->mMaterialIndex];
+			vector<Texture> textures;
+
+			// 1. diffuse maps
+			vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+			textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+			// 2. specular maps
+			vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+			// 3. normal maps
+			std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+			textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+			// 4. height maps
+			std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
+			textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+
+			// the converted data moves into the mesh, it isn't needed anywhere else
+			meshes.push_back(Mesh(std::move(imported[i].vertices), std::move(imported[i].indices), textures));
+			meshes.back().meshlets = std::move(imported[i].meshlets);
+		}
+	}
+
+	static void setVertexBoneDataToDefault(Vertex& vertex)
+	{
+		for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+		{
+			vertex.m_BoneIDs[i] = -1;
+			vertex.m_Weights[i] = 0.0f;
+		}
+	}
+
+	// stores the bone in the first free influence slot of the vertex, influences past MAX_BONE_INFLUENCE are dropped
+	static void setVertexBoneData(Vertex& vertex, int boneID, float weight)
+	{
+		for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+		{
+			if (vertex.m_BoneIDs[i] < 0)
+			{
+				vertex.m_Weights[i] = weight;
+				vertex.m_BoneIDs[i] = boneID;
+				break;
+			}
+		}
+	}
+
+	// hands out the ids of the mesh's bones not met before. runs on the loading thread, mesh by mesh,
+	// so the ids don't depend on which worker converts which mesh
+	void registerBones(const aiMesh* mesh)
+	{
+		for (unsigned int boneIndex = 0; boneIndex < mesh->mNumBones; boneIndex++)
+		{
+			aiBone* bone = mesh->mBones[boneIndex];
+			string boneName = bone->mName.C_Str();
+			if (boneInfoMap.find(boneName) == boneInfoMap.end())
+			{
+				BoneInfo newBoneInfo;
+				newBoneInfo.id = boneCounter++;
+				newBoneInfo.offset = assimpToGlmMatrix(bone->mOffsetMatrix);
+				boneInfoMap[boneName] = newBoneInfo;
+			}
+		}
+	}
+
+	// the bones were registered by registerBones(), boneInfoMap is only read here
+	void extractBoneWeightForVertices(vector<Vertex>& vertices, const aiMesh* mesh) const
+	{
+		for (unsigned int boneIndex = 0; boneIndex < mesh->mNumBones; boneIndex++)
+		{
+			aiBone* bone = mesh->mBones[boneIndex];
+			map<string, BoneInfo>::const_iterator info = boneInfoMap.find(bone->mName.C_Str());
+			if (info == boneInfoMap.end())
+				continue;
+			int boneID = info->second.id;
 
-		// 1. diffuse maps
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-		// 2. specular maps
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+			for (unsigned int weightIndex = 0; weightIndex < bone->mNumWeights; weightIndex++)
+			{
+				unsigned int vertexId = bone->mWeights[weightIndex].mVertexId;
+				if (vertexId < vertices.size())
+					setVertexBoneData(vertices[vertexId], boneID, bone->mWeights[weightIndex].mWeight);
+			}
+		}
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// make the weights of every skinned vertex sum up to 1, dropped influences would shrink it otherwise
+		if (mesh->mNumBones == 0)
+			return;
+		for (unsigned int i = 0; i < vertices.size(); i++)
+		{
+			float total = 0.0f;
+			for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+				total += vertices[i].m_Weights[j];
+			if (total > 0.0f)
+				for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+					vertices[i].m_Weights[j] /= total;
+		}
 	}
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -193,7 +833,9 @@ private:
 			if (!skip)
 			{   // if texture hasn't been loaded already, load it
 				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
+				texture.id = streamer ? streamer->load(this->directory + '/' + str.C_Str()) : 0;
+				if (!texture.id)
+					texture.id = TextureFromFile(str.C_Str(), this->directory);
 				texture.type = typeName;
 				texture.path = str.C_Str();
 				textures.push_back(texture);
@@ -207,6 +849,7 @@ private:
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
+	PROFILE_SCOPE("TextureFromFile");
 	string filename = string(path);
 	filename = directory + '/' + filename;
 
@@ -231,8 +874,8 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 		//wrapping method
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		//filtering methods for mipmap
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
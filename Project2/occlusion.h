@@ -0,0 +1,390 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "frustum.h"
+#include "jobsystem.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Occlusion culling against a software depth buffer. A few big occluder meshes are rasterized on the CPU into
+// a small depth buffer, split into tiles that the JobSystem workers fill in parallel (4 pixels at a time with
+// SSE). A max-depth pyramid (Hi-Z) on top of it lets a box be tested with a handful of reads: the box is hidden
+// when its nearest point is behind the farthest depth of every texel it covers. Nothing here touches OpenGL,
+// so it can run and be checked without a GPU (see benchmarkOcclusion()).
+
+struct OcclusionStats {
+	unsigned int occluderTriangles = 0;
+	unsigned int tested = 0;
+	unsigned int occluded = 0;
+};
+
+class OcclusionCuller
+{
+public:
+	static const unsigned int TILE_WIDTH = 32;
+	static const unsigned int TILE_HEIGHT = 16;
+
+	// triangles beyond this are dropped by addOccluder(), occluders should be cheap compared to what they hide
+	unsigned int triangleBudget = 100000;
+	OcclusionStats stats;
+
+	// width is rounded up to a multiple of 4, the SIMD loop fills 4 pixels at once
+	OcclusionCuller(unsigned int width = 320, unsigned int height = 240)
+		: width((width + 3) & ~3u), height(height)
+	{
+		tilesX = (this->width + TILE_WIDTH - 1) / TILE_WIDTH;
+		tilesY = (this->height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+		bins.resize(tilesX * tilesY);
+		depth.resize(this->width * this->height, 1.0f);
+
+		// pyramid level 0 is the depth buffer itself, every next level halves the size down to 1x1
+		unsigned int w = this->width, h = this->height;
+		while (w > 1 || h > 1)
+		{
+			w = std::max(1u, (w + 1) / 2);
+			h = std::max(1u, (h + 1) / 2);
+			levelWidth.push_back(w);
+			levelHeight.push_back(h);
+			hiZ.push_back(std::vector<float>(w * h, 1.0f));
+		}
+	}
+
+	// starts a new frame, viewProjection is the matrix the occluders and the boxes are projected with
+	void begin(const glm::mat4& viewProjection)
+	{
+		this->viewProjection = viewProjection;
+		triangles.clear();
+		for (std::vector<unsigned int>& bin : bins)
+			bin.clear();
+		stats = OcclusionStats();
+	}
+
+	// projects and bins the triangles of an indexed mesh. positions are read like computeAABB() does, so
+	// vector<Vertex> can be passed directly with stride sizeof(Vertex). returns false if the mesh doesn't fit
+	// into what is left of the triangle budget, nothing of it is added then
+	bool addOccluder(const void* positions, size_t stride, const unsigned int* indices, size_t indexCount, const glm::mat4& model)
+	{
+		if (stats.occluderTriangles + indexCount / 3 > triangleBudget)
+			return false;
+		glm::mat4 clip = viewProjection * model;
+		const char* p = (const char*)positions;
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			ScreenTriangle tri;
+			bool behind = false;
+			for (int k = 0; k < 3; k++)
+			{
+				glm::vec4 c = clip * glm::vec4(*(const glm::vec3*)(p + indices[i + k] * stride), 1.0f);
+				// triangles crossing the near plane are skipped instead of clipped, which only makes the
+				// occluder smaller and so never hides something visible
+				if (c.w < 1e-4f)
+				{
+					behind = true;
+					break;
+				}
+				tri.x[k] = (c.x / c.w * 0.5f + 0.5f) * width;
+				tri.y[k] = (c.y / c.w * 0.5f + 0.5f) * height;
+				tri.z[k] = c.z / c.w * 0.5f + 0.5f;
+			}
+			if (behind)
+				continue;
+			binTriangle(tri);
+		}
+		stats.occluderTriangles += (unsigned int)(indexCount / 3);
+		return true;
+	}
+
+	// rasterizes the binned triangles, one tile per job, then builds the Hi-Z pyramid
+	void render(JobSystem& jobs)
+	{
+		std::fill(depth.begin(), depth.end(), 1.0f);
+		jobs.parallelFor(tilesX * tilesY, 1, [this](unsigned int begin, unsigned int end) {
+			for (unsigned int tile = begin; tile < end; tile++)
+				rasterizeTile(tile);
+		});
+		buildHiZ();
+	}
+
+	// true if the world space box is completely behind the occluders
+	bool isOccluded(const AABB& box)
+	{
+		stats.tested++;
+		if (!box.valid())
+			return false;
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+			glm::vec4 c = viewProjection * glm::vec4(corner, 1.0f);
+			// the box reaches the camera, it can't be behind anything
+			if (c.w < 1e-4f)
+				return false;
+			float x = (c.x / c.w * 0.5f + 0.5f) * width;
+			float y = (c.y / c.w * 0.5f + 0.5f) * height;
+			minX = std::min(minX, x); maxX = std::max(maxX, x);
+			minY = std::min(minY, y); maxY = std::max(maxY, y);
+			nearest = std::min(nearest, c.z / c.w * 0.5f + 0.5f);
+		}
+		// outside the buffer is the frustum culler's job
+		if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+			return false;
+		int x0 = std::max(0, (int)minX), y0 = std::max(0, (int)minY);
+		int x1 = std::min((int)width - 1, (int)maxX), y1 = std::min((int)height - 1, (int)maxY);
+
+		// the level where the rectangle is about two texels wide, so at most 3x3 reads
+		unsigned int size = (unsigned int)std::max(x1 - x0, y1 - y0);
+		unsigned int level = 0;
+		while ((size >> level) > 2 && level < hiZ.size())
+			level++;
+		const float* data = level == 0 ? depth.data() : hiZ[level - 1].data();
+		unsigned int w = level == 0 ? width : levelWidth[level - 1];
+		for (int y = y0 >> level; y <= (y1 >> level); y++)
+		{
+			for (int x = x0 >> level; x <= (x1 >> level); x++)
+			{
+				if (nearest <= data[y * w + x])
+					return false;
+			}
+		}
+		stats.occluded++;
+		return true;
+	}
+
+	// removes the occluded entries from a list of indices into boxes, returns how many were removed
+	unsigned int cull(const std::vector<AABB>& boxes, std::vector<unsigned int>& visible)
+	{
+		unsigned int kept = 0;
+		for (unsigned int i = 0; i < visible.size(); i++)
+		{
+			if (!isOccluded(boxes[visible[i]]))
+				visible[kept++] = visible[i];
+		}
+		unsigned int removed = (unsigned int)visible.size() - kept;
+		visible.resize(kept);
+		return removed;
+	}
+
+	unsigned int getWidth() const { return width; }
+	unsigned int getHeight() const { return height; }
+	// depth in [0,1] of pixel x,y (origin bottom left), 1 where no occluder was drawn
+	float depthAt(unsigned int x, unsigned int y) const { return depth[y * width + x]; }
+
+private:
+	struct ScreenTriangle {
+		float x[3], y[3], z[3];
+	};
+
+	unsigned int width, height;
+	unsigned int tilesX, tilesY;
+	glm::mat4 viewProjection;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<std::vector<unsigned int>> bins;	// triangle indices per tile
+	std::vector<float> depth;
+	std::vector<std::vector<float>> hiZ;			// level 1 and up, every texel is the max of the 2x2 below it
+	std::vector<unsigned int> levelWidth, levelHeight;
+
+	// makes the triangle counter-clockwise (occluders are drawn from both sides) and adds it to every tile
+	// its bounding rectangle touches
+	void binTriangle(ScreenTriangle tri)
+	{
+		float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+		if (area == 0.0f)
+			return;
+		if (area < 0.0f)
+		{
+			std::swap(tri.x[1], tri.x[2]);
+			std::swap(tri.y[1], tri.y[2]);
+			std::swap(tri.z[1], tri.z[2]);
+		}
+		float minX = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+		float maxX = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+		float minY = std::min(tri.y[0], std::min(tri.y[1], tri.y[2]));
+		float maxY = std::max(tri.y[0], std::max(tri.y[1], tri.y[2]));
+		if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+			return;
+		int tx0 = std::max(0, (int)minX) / TILE_WIDTH, tx1 = std::min((int)width - 1, (int)maxX) / TILE_WIDTH;
+		int ty0 = std::max(0, (int)minY) / TILE_HEIGHT, ty1 = std::min((int)height - 1, (int)maxY) / TILE_HEIGHT;
+		unsigned int index = (unsigned int)triangles.size();
+		triangles.push_back(tri);
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++)
+				bins[ty * tilesX + tx].push_back(index);
+	}
+
+	void rasterizeTile(unsigned int tile)
+	{
+		int tileX0 = (tile % tilesX) * TILE_WIDTH, tileY0 = (tile / tilesX) * TILE_HEIGHT;
+		int tileX1 = std::min(tileX0 + (int)TILE_WIDTH, (int)width) - 1;
+		int tileY1 = std::min(tileY0 + (int)TILE_HEIGHT, (int)height) - 1;
+		for (unsigned int index : bins[tile])
+		{
+			const ScreenTriangle& t = triangles[index];
+			int x0 = std::max(tileX0, (int)std::floor(std::min(t.x[0], std::min(t.x[1], t.x[2]))));
+			int x1 = std::min(tileX1, (int)std::ceil(std::max(t.x[0], std::max(t.x[1], t.x[2]))));
+			int y0 = std::max(tileY0, (int)std::floor(std::min(t.y[0], std::min(t.y[1], t.y[2]))));
+			int y1 = std::min(tileY1, (int)std::ceil(std::max(t.y[0], std::max(t.y[1], t.y[2]))));
+			if (x0 > x1 || y0 > y1)
+				continue;
+			x0 &= ~3;
+
+			// edge functions e(x,y) = a*x + b*y + c, positive inside. the depth is interpolated with the
+			// barycentrics e/area, which is exact because z/w is linear in screen space
+			float a[3], b[3], c[3];
+			for (int e = 0; e < 3; e++)
+			{
+				int i = (e + 1) % 3, j = (e + 2) % 3;
+				a[e] = -(t.y[j] - t.y[i]);
+				b[e] = t.x[j] - t.x[i];
+				c[e] = -(a[e] * t.x[i] + b[e] * t.y[i]);
+			}
+			float invArea = 1.0f / (a[2] * t.x[2] + b[2] * t.y[2] + c[2]);
+			float za = (a[0] * t.z[0] + a[1] * t.z[1] + a[2] * t.z[2]) * invArea;
+			float zb = (b[0] * t.z[0] + b[1] * t.z[1] + b[2] * t.z[2]) * invArea;
+			float zc = (c[0] * t.z[0] + c[1] * t.z[1] + c[2] * t.z[2]) * invArea;
+
+			for (int y = y0; y <= y1; y++)
+			{
+				float py = y + 0.5f;
+				float* row = &depth[y * width];
+#ifdef BOUNDS_USE_SSE
+				__m128 px = _mm_add_ps(_mm_set1_ps(x0 + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+				__m128 step = _mm_set1_ps(4.0f);
+				__m128 zero = _mm_setzero_ps();
+				__m128 a0 = _mm_set1_ps(a[0]), a1 = _mm_set1_ps(a[1]), a2 = _mm_set1_ps(a[2]), az = _mm_set1_ps(za);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), _mm_set1_ps(b[0] * py + c[0]));
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), _mm_set1_ps(b[1] * py + c[1]));
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), _mm_set1_ps(b[2] * py + c[2]));
+				__m128 z = _mm_add_ps(_mm_mul_ps(az, px), _mm_set1_ps(zb * py + zc));
+				__m128 e0Step = _mm_mul_ps(a0, step), e1Step = _mm_mul_ps(a1, step), e2Step = _mm_mul_ps(a2, step), zStep = _mm_mul_ps(az, step);
+				for (int x = x0; x <= x1; x += 4)
+				{
+					__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+					if (_mm_movemask_ps(inside))
+					{
+						__m128 old = _mm_loadu_ps(row + x);
+						__m128 closer = _mm_min_ps(old, z);
+						_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+					}
+					e0 = _mm_add_ps(e0, e0Step);
+					e1 = _mm_add_ps(e1, e1Step);
+					e2 = _mm_add_ps(e2, e2Step);
+					z = _mm_add_ps(z, zStep);
+				}
+#else
+				for (int x = x0; x <= x1; x++)
+				{
+					float px = x + 0.5f;
+					if (a[0] * px + b[0] * py + c[0] >= 0.0f && a[1] * px + b[1] * py + c[1] >= 0.0f && a[2] * px + b[2] * py + c[2] >= 0.0f)
+						row[x] = std::min(row[x], za * px + zb * py + zc);
+				}
+#endif
+			}
+		}
+	}
+
+	void buildHiZ()
+	{
+		const float* source = depth.data();
+		unsigned int sourceWidth = width, sourceHeight = height;
+		for (unsigned int level = 0; level < hiZ.size(); level++)
+		{
+			float* target = hiZ[level].data();
+			for (unsigned int y = 0; y < levelHeight[level]; y++)
+			{
+				unsigned int sy0 = y * 2, sy1 = std::min(y * 2 + 1, sourceHeight - 1);
+				for (unsigned int x = 0; x < levelWidth[level]; x++)
+				{
+					unsigned int sx0 = x * 2, sx1 = std::min(x * 2 + 1, sourceWidth - 1);
+					target[y * levelWidth[level] + x] = std::max(
+						std::max(source[sy0 * sourceWidth + sx0], source[sy0 * sourceWidth + sx1]),
+						std::max(source[sy1 * sourceWidth + sx0], source[sy1 * sourceWidth + sx1]));
+				}
+			}
+			source = target;
+			sourceWidth = levelWidth[level];
+			sourceHeight = levelHeight[level];
+		}
+	}
+};
+
+// checks the culler on a scene with a known answer and times it: a wall across the view hides a grid of boxes
+// behind it, a second grid in front of the wall must stay visible. runs without a window or GL context
+inline bool benchmarkOcclusion(unsigned int iterations = 100)
+{
+	glm::mat4 projection = glm::perspective(75.0f, 4.0f / 3.0f, 0.1f, 500.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 viewProjection = projection * view;
+
+	// wall at z = -20, 200 x 200, split into a grid of quads so the binning has some work to do
+	const unsigned int cells = 64;
+	std::vector<glm::vec3> wall;
+	std::vector<unsigned int> wallIndices;
+	for (unsigned int y = 0; y <= cells; y++)
+		for (unsigned int x = 0; x <= cells; x++)
+			wall.push_back(glm::vec3(-100.0f + 200.0f * x / cells, -100.0f + 200.0f * y / cells, -20.0f));
+	for (unsigned int y = 0; y < cells; y++)
+	{
+		for (unsigned int x = 0; x < cells; x++)
+		{
+			unsigned int i = y * (cells + 1) + x;
+			unsigned int quad[6] = { i, i + 1, i + cells + 2, i, i + cells + 2, i + cells + 1 };
+			wallIndices.insert(wallIndices.end(), quad, quad + 6);
+		}
+	}
+
+	std::vector<AABB> boxes;
+	for (int y = -5; y <= 5; y++)
+	{
+		for (int x = -5; x <= 5; x++)
+		{
+			for (int layer = 0; layer < 2; layer++)
+			{
+				// layer 0 at z = -40 (hidden), layer 1 at z = -10 (in front of the wall)
+				glm::vec3 c(x * 1.5f, y * 1.5f, layer == 0 ? -40.0f : -10.0f);
+				AABB box;
+				box.min = c - glm::vec3(0.5f);
+				box.max = c + glm::vec3(0.5f);
+				boxes.push_back(box);
+			}
+		}
+	}
+
+	JobSystem jobs;
+	OcclusionCuller culler(320, 240);
+	double rasterMs = 0.0, testMs = 0.0;
+	unsigned int errors = 0;
+	for (unsigned int it = 0; it < iterations; it++)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		culler.begin(viewProjection);
+		culler.addOccluder(wall.data(), sizeof(glm::vec3), wallIndices.data(), wallIndices.size(), glm::mat4(1.0f));
+		culler.render(jobs);
+		auto mid = std::chrono::high_resolution_clock::now();
+		errors = 0;
+		for (unsigned int i = 0; i < boxes.size(); i++)
+		{
+			bool hidden = boxes[i].max.z < -20.0f;
+			if (culler.isOccluded(boxes[i]) != hidden)
+				errors++;
+		}
+		auto stop = std::chrono::high_resolution_clock::now();
+		rasterMs += std::chrono::duration<double, std::milli>(mid - start).count();
+		testMs += std::chrono::duration<double, std::milli>(stop - mid).count();
+	}
+
+	std::cout << "benchmarkOcclusion() " << culler.getWidth() << "x" << culler.getHeight() << " threads=" << jobs.threadCount()
+		<< " occluder triangles=" << culler.stats.occluderTriangles << std::endl;
+	std::cout << "  rasterize + Hi-Z: " << rasterMs / iterations << " ms, " << boxes.size() << " box tests: " << testMs / iterations << " ms" << std::endl;
+	std::cout << "  occluded " << culler.stats.occluded << "/" << culler.stats.tested << ", wrong results: " << errors << std::endl;
+	if (errors > 0)
+		std::cout << "ERROR::OCCLUSION:: " << errors << " boxes classified wrong" << std::endl;
+	return errors == 0;
+}
+#endif
@@ -0,0 +1,121 @@
+#ifndef PALETTE_BUFFER_H
+#define PALETTE_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <../shader.h>
+
+#include <vector>
+
+// Bone matrices for the skinning shader, stored in a texture buffer so one buffer can hold the palettes of many
+// characters (a uniform block is capped at 16KB-64KB, i.e. a few hundred matrices). Every character draws with
+// paletteOffset set to the first matrix of its palette, see skinning.vs.
+// In matrix mode a bone takes four RGBA32F texels (the columns), in dual quaternion mode two (real and dual part).
+class BonePaletteBuffer
+{
+public:
+	unsigned int buffer = 0;
+	unsigned int texture = 0;
+	bool dualQuaternion = false;
+
+	// capacity is the number of bones all palettes together hold
+	BonePaletteBuffer(unsigned int capacity)
+	{
+		glGenBuffers(1, &buffer);
+		glGenTextures(1, &texture);
+		reserve(capacity);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// owns GL objects, so it can't be copied
+	BonePaletteBuffer(const BonePaletteBuffer&) = delete;
+	BonePaletteBuffer& operator=(const BonePaletteBuffer&) = delete;
+
+	~BonePaletteBuffer()
+	{
+		release();
+	}
+
+	// deletes the buffer while the context is still alive, the destructor then has nothing left to do
+	void release()
+	{
+		if (texture)
+			glDeleteTextures(1, &texture);
+		if (buffer)
+			glDeleteBuffers(1, &buffer);
+		texture = buffer = 0;
+	}
+
+	// uploads count matrices starting at bone first. when dualQuaternion is set they're converted first,
+	// which only works for palettes without scale or shear
+	void upload(const glm::mat4* palette, unsigned int count, unsigned int first = 0)
+	{
+		if (first + count > capacity)
+			reserve(first + count);
+
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		if (dualQuaternion)
+		{
+			scratch.resize(count * 2);
+			for (unsigned int i = 0; i < count; i++)
+				toDualQuaternion(palette[i], scratch[i * 2], scratch[i * 2 + 1]);
+			glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)first * texelsPerBone() * sizeof(glm::vec4), count * 2 * sizeof(glm::vec4), scratch.data());
+		}
+		else
+		{
+			glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)first * sizeof(glm::mat4), count * sizeof(glm::mat4), palette);
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	void upload(const std::vector<glm::mat4>& palette)
+	{
+		if (!palette.empty())
+			upload(palette.data(), (unsigned int)palette.size());
+	}
+
+	// binds the palette to a texture unit and points the shader's bonePalette sampler at it
+	void bind(Shader& shader, unsigned int unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		shader.setInt("bonePalette", unit);
+		shader.setBool("dualQuaternion", dualQuaternion);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// splits a rigid transform into the real (rotation) and dual (translation) part of a unit dual quaternion
+	static void toDualQuaternion(const glm::mat4& m, glm::vec4& real, glm::vec4& dual)
+	{
+		glm::quat r = glm::normalize(glm::quat_cast(glm::mat3(m)));
+		glm::vec3 t = glm::vec3(m[3]);
+		// dual = 0.5 * (0, t) * r
+		glm::quat d = glm::quat(0.0f, t.x, t.y, t.z) * r * 0.5f;
+		real = glm::vec4(r.x, r.y, r.z, r.w);
+		dual = glm::vec4(d.x, d.y, d.z, d.w);
+	}
+
+private:
+	unsigned int capacity = 0;
+	std::vector<glm::vec4> scratch;
+
+	unsigned int texelsPerBone() const
+	{
+		return dualQuaternion ? 2 : 4;
+	}
+
+	// (re)allocates storage for bones matrices, the old content is lost
+	void reserve(unsigned int bones)
+	{
+		capacity = bones;
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)bones * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+};
+#endif
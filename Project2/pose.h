@@ -0,0 +1,208 @@
+#ifndef POSE_H
+#define POSE_H
+
+#include "skeleton.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// getPose() walks the Bone tree recursively and looks every bone's track up by name on every call.
+// For evaluating many characters the skeleton is flattened once into parent-before-child order
+// and every clip is bound to it, so sampling a pose is a linear walk over plain arrays.
+
+// a skinned mesh with its skeleton and first animation, as loadModel() and loadAnimation() read them
+struct AnimatedModel {
+	std::vector<SkinnedVertex> vertices = {};
+	std::vector<uint> indices = {};
+	Bone skeleton;
+	uint boneCount = 0;
+	Animation animation;
+	glm::mat4 globalInverseTransform = glm::mat4(1.0f);
+};
+
+// loads the first mesh and first animation of a file, returns false if it has neither
+inline bool loadAnimatedModel(const std::string& path, AnimatedModel& output)
+{
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals);
+	if (!scene || !scene->mRootNode || scene->mNumMeshes == 0 || scene->mNumAnimations == 0)
+	{
+		std::cout << "ERROR::ANIMATION:: can't load an animated mesh from " << path << std::endl;
+		return false;
+	}
+	loadModel(scene, scene->mMeshes[0], output.vertices, output.indices, output.skeleton, output.boneCount);
+	loadAnimation(scene, output.animation);
+	output.globalInverseTransform = glm::inverse(assimpToGlmMatrix(scene->mRootNode->mTransformation));
+	return true;
+}
+
+// one bone of a flattened skeleton
+struct FlatBone {
+	int id = 0;							// position of the bone in the final upload array (Bone::id)
+	int parent = -1;					// index of the parent in FlatSkeleton::bones, -1 for the root
+	glm::mat4 offset = glm::mat4(1.0f);
+	std::string name = "";
+};
+
+struct FlatSkeleton {
+	std::vector<FlatBone> bones = {};
+	unsigned int paletteSize = 0;		// number of matrices a palette for this skeleton needs
+};
+
+// local transform of one bone
+struct BoneLocal {
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
+};
+
+// an Animation bound to a FlatSkeleton: one track pointer per bone, resolved once
+struct ClipBinding {
+	float duration = 0.0f;
+	float ticksPerSecond = 1.0f;
+	std::vector<const BoneTransformTrack*> tracks = {};
+	// getPose() stops at a bone without keys and skips its whole subtree, active mirrors that
+	std::vector<unsigned char> active = {};
+};
+
+inline void flattenBone(const Bone& bone, int parent, FlatSkeleton& output)
+{
+	FlatBone flat;
+	flat.id = bone.id;
+	flat.parent = parent;
+	flat.offset = bone.offset;
+	flat.name = bone.name;
+	output.bones.push_back(flat);
+	output.paletteSize = std::max(output.paletteSize, (unsigned int)bone.id + 1);
+
+	int self = (int)output.bones.size() - 1;
+	for (const Bone& child : bone.children)
+		flattenBone(child, self, output);
+}
+
+inline void flattenSkeleton(const Bone& root, FlatSkeleton& output)
+{
+	output.bones = {};
+	output.paletteSize = 0;
+	flattenBone(root, -1, output);
+}
+
+// the animation has to outlive the binding, it keeps pointers into animation.boneTransforms
+inline void bindClip(const Animation& animation, const FlatSkeleton& skeleton, ClipBinding& output)
+{
+	output.duration = animation.duration;
+	output.ticksPerSecond = animation.ticksPerSecond;
+	output.tracks.assign(skeleton.bones.size(), nullptr);
+	output.active.assign(skeleton.bones.size(), 0);
+	for (unsigned int i = 0; i < skeleton.bones.size(); i++)
+	{
+		const FlatBone& bone = skeleton.bones[i];
+		auto it = animation.boneTransforms.find(bone.name);
+		if (it != animation.boneTransforms.end())
+			output.tracks[i] = &it->second;
+
+		const BoneTransformTrack* track = output.tracks[i];
+		bool hasKeys = track && track->positions.size() > 0 && track->rotations.size() > 0 && track->scales.size() > 0;
+		bool parentActive = bone.parent < 0 || output.active[bone.parent];
+		output.active[i] = hasKeys && parentActive ? 1 : 0;
+	}
+}
+
+// finds the key segment for time t with a binary search. unlike getTimeFraction() it clamps
+// before the first and after the last key instead of reading out of bounds
+inline void findKey(const std::vector<float>& times, float t, unsigned int& segment, float& frac)
+{
+	if (times.size() < 2)
+	{
+		segment = 0;
+		frac = 0.0f;
+		return;
+	}
+	unsigned int upper = (unsigned int)(std::lower_bound(times.begin(), times.end(), t) - times.begin());
+	segment = std::min(std::max(upper, 1u), (unsigned int)times.size() - 1);
+	float start = times[segment - 1];
+	float end = times[segment];
+	frac = end > start ? glm::clamp((t - start) / (end - start), 0.0f, 1.0f) : 0.0f;
+}
+
+template <typename T>
+inline T sampleKeys(const std::vector<float>& times, const std::vector<T>& values, float t)
+{
+	if (values.size() == 1)
+		return values[0];
+	unsigned int segment;
+	float frac;
+	findKey(times, t, segment, frac);
+	return glm::mix(values[segment - 1], values[segment], frac);
+}
+
+template <>
+inline glm::quat sampleKeys<glm::quat>(const std::vector<float>& times, const std::vector<glm::quat>& values, float t)
+{
+	if (values.size() == 1)
+		return values[0];
+	unsigned int segment;
+	float frac;
+	findKey(times, t, segment, frac);
+	return glm::slerp(values[segment - 1], values[segment], frac);
+}
+
+// samples the local transform of every active bone at time t (same units as getPose's dt).
+// bones flagged in skip keep whatever output already holds for them
+inline void samplePose(const ClipBinding& clip, float t, std::vector<BoneLocal>& output, const std::vector<unsigned char>* skip = nullptr)
+{
+	output.resize(clip.tracks.size());
+	if (clip.duration > 0.0f)
+		t = fmod(t, clip.duration);
+	for (unsigned int i = 0; i < clip.tracks.size(); i++)
+	{
+		if (!clip.active[i] || (skip && (*skip)[i]))
+			continue;
+		const BoneTransformTrack& btt = *clip.tracks[i];
+		output[i].position = sampleKeys(btt.positionTimestamps, btt.positions, t);
+		output[i].rotation = sampleKeys(btt.rotationTimestamps, btt.rotations, t);
+		output[i].scale = sampleKeys(btt.scaleTimestamps, btt.scales, t);
+	}
+}
+
+// blends pose b over pose a by weight, result goes to output (may alias a)
+inline void blendPoses(const std::vector<BoneLocal>& a, const std::vector<BoneLocal>& b, float weight, std::vector<BoneLocal>& output)
+{
+	output.resize(a.size());
+	for (unsigned int i = 0; i < a.size(); i++)
+	{
+		output[i].position = glm::mix(a[i].position, b[i].position, weight);
+		output[i].rotation = glm::slerp(a[i].rotation, b[i].rotation, weight);
+		output[i].scale = glm::mix(a[i].scale, b[i].scale, weight);
+	}
+}
+
+// turns local transforms into skinning matrices, the same product getPose() writes:
+// globalInverseTransform * globalTransform * offset. palette must hold skeleton.paletteSize matrices,
+// entries of inactive bones are left untouched. globals is scratch space.
+// bones flagged in skip (leaf bones like fingers) aren't evaluated, they take their parent's global and
+// skinning matrix and so follow it rigidly in their bind pose
+inline void buildPalette(const FlatSkeleton& skeleton, const ClipBinding& clip, const std::vector<BoneLocal>& local,
+	const glm::mat4& globalInverseTransform, glm::mat4* palette, std::vector<glm::mat4>& globals, const std::vector<unsigned char>* skip = nullptr)
+{
+	globals.resize(skeleton.bones.size());
+	for (unsigned int i = 0; i < skeleton.bones.size(); i++)
+	{
+		if (!clip.active[i])
+			continue;
+		const FlatBone& bone = skeleton.bones[i];
+		if (skip && (*skip)[i] && bone.parent >= 0)
+		{
+			globals[i] = globals[bone.parent];
+			palette[bone.id] = palette[skeleton.bones[bone.parent].id];
+			continue;
+		}
+		const BoneLocal& l = local[i];
+		glm::mat4 localTransform = glm::translate(glm::mat4(1.0f), l.position) * glm::toMat4(l.rotation) * glm::scale(glm::mat4(1.0f), l.scale);
+		globals[i] = bone.parent < 0 ? localTransform : globals[bone.parent] * localTransform;
+		palette[bone.id] = globalInverseTransform * globals[i] * bone.offset;
+	}
+}
+#endif
@@ -0,0 +1,267 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "json_escape.h"
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILER_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_TSC
+#endif
+
+// CPU profiler of nested scopes. PROFILE_SCOPE("name") times the rest of the scope; the zone is written when the
+// scope ends into a ring buffer of the thread it ran on, so recording never takes a lock and never allocates.
+// Only the first zone of a thread registers its buffer with the profiler (under a mutex).
+// The buffers keep the last PROFILER_RING_SIZE zones of every thread. They can be written as a Chrome trace
+// (chrome://tracing, ui.perfetto.dev) and the zones of the last frame are drawn by drawProfilerWindow().
+// Readers don't stop the writers: zones read while a thread laps the ring can be torn, the newest are fine.
+// Zone names must be string literals or live as long as the profiler.
+// Zones are timed with the time stamp counter where there is one, reading it costs a fraction of a clock call. The
+// ticks are turned into nanoseconds when they are read, with the rate measured against the steady clock.
+// Defining PROFILER_DISABLED compiles the zones out.
+
+#define PROFILER_RING_SIZE (1 << 16)
+
+struct ProfileEvent {
+	const char* name;
+	long long start;	// ticks, see Profiler::nanoseconds()
+	long long end;
+	int depth;			// zones open on the thread when this one started
+};
+
+struct ProfileThreadBuffer {
+	unsigned int index = 0;
+	std::string name;
+	// zones written so far, the last one is at (written - 1) % PROFILER_RING_SIZE
+	std::atomic<unsigned int> written;
+	int depth = 0;
+	ProfileEvent events[PROFILER_RING_SIZE];
+
+	ProfileThreadBuffer() : written(0) {}
+
+	void record(const char* name, long long start, long long end, int depth)
+	{
+		unsigned int slot = written.load(std::memory_order_relaxed);
+		ProfileEvent& event = events[slot & (PROFILER_RING_SIZE - 1)];
+		event.name = name;
+		event.start = start;
+		event.end = end;
+		event.depth = depth;
+		written.store(slot + 1, std::memory_order_release);
+	}
+
+	// the zones still in the ring, oldest first
+	void copyEvents(std::vector<ProfileEvent>& out) const
+	{
+		unsigned int count = written.load(std::memory_order_acquire);
+		unsigned int first = count > PROFILER_RING_SIZE ? count - PROFILER_RING_SIZE : 0;
+		for (unsigned int i = first; i < count; i++)
+			out.push_back(events[i & (PROFILER_RING_SIZE - 1)]);
+	}
+};
+
+class Profiler
+{
+public:
+	std::atomic<bool> enabled;
+
+	static Profiler& instance()
+	{
+		static Profiler profiler;
+		return profiler;
+	}
+
+	static long long ticks()
+	{
+#ifdef PROFILER_TSC
+		return (long long)__rdtsc();
+#else
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	}
+
+	// nanoseconds from the start of the profiler to a tick count
+	double nanoseconds(long long tick) const
+	{
+		return (tick - epochTicks) * nanosecondsPerTick();
+	}
+
+	double nanosecondsPerTick() const
+	{
+		long long elapsedTicks = ticks() - epochTicks;
+		double elapsed = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+		return elapsedTicks > 0 ? elapsed / elapsedTicks : 1.0;
+	}
+
+	// the buffer of the calling thread, registered the first time
+	ProfileThreadBuffer& threadBuffer()
+	{
+		thread_local ProfileThreadBuffer* buffer = registerThread();
+		return *buffer;
+	}
+
+	// shows up as the thread's name in the trace
+	void setThreadName(const std::string& name)
+	{
+		ProfileThreadBuffer& buffer = threadBuffer();
+		std::lock_guard<std::mutex> lock(mutex);
+		buffer.name = name;
+	}
+
+	// zones of every thread, oldest first per thread. threads[i] are the zones of thread i
+	void snapshot(std::vector<std::vector<ProfileEvent>>& threads, std::vector<std::string>& names)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		threads.assign(buffers.size(), std::vector<ProfileEvent>());
+		names.clear();
+		for (unsigned int i = 0; i < buffers.size(); i++)
+		{
+			buffers[i]->copyEvents(threads[i]);
+			names.push_back(buffers[i]->name);
+		}
+	}
+
+	// the zones of the calling thread inside its last finished top level zone (depth 0), e.g. the last frame
+	void lastTopLevelZone(std::vector<ProfileEvent>& out)
+	{
+		out.clear();
+		std::vector<ProfileEvent> events;
+		threadBuffer().copyEvents(events);
+		int root = -1;
+		for (int i = (int)events.size() - 1; i >= 0 && root < 0; i--)
+		{
+			if (events[i].depth == 0)
+				root = i;
+		}
+		if (root < 0)
+			return;
+		// children end before their parent, so they were written before it
+		for (int i = 0; i <= root; i++)
+		{
+			if (events[i].start >= events[root].start && events[i].end <= events[root].end)
+				out.push_back(events[i]);
+		}
+	}
+
+	// complete events ("ph":"X") with microsecond timestamps
+	bool writeChromeTrace(const std::string& path)
+	{
+		std::vector<std::vector<ProfileEvent>> threads;
+		std::vector<std::string> names;
+		snapshot(threads, names);
+		double perTick = nanosecondsPerTick();
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+		{
+			std::cout << "ERROR::PROFILER::FILE_NOT_WRITTEN " << path << std::endl;
+			return false;
+		}
+		fprintf(file, "{\"traceEvents\":[\n");
+		bool first = true;
+		size_t zones = 0;
+		for (unsigned int t = 0; t < threads.size(); t++)
+		{
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", t, jsonEscaped(names[t]).c_str());
+			first = false;
+			for (const ProfileEvent& event : threads[t])
+			{
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", jsonEscaped(event.name).c_str(), t,
+					nanoseconds(event.start) / 1000.0, (event.end - event.start) * perTick / 1000.0);
+				zones++;
+			}
+		}
+		fprintf(file, "\n]}\n");
+		fclose(file);
+		std::cout << "Profiler: " << zones << " zones of " << threads.size() << " threads written to " << path << std::endl;
+		return true;
+	}
+
+private:
+	std::chrono::steady_clock::time_point epoch;
+	long long epochTicks;
+	std::mutex mutex;
+	// never freed, the zones of threads that ended stay in the trace
+	std::vector<std::unique_ptr<ProfileThreadBuffer>> buffers;
+
+	Profiler() : enabled(true), epoch(std::chrono::steady_clock::now()), epochTicks(ticks()) {}
+
+	ProfileThreadBuffer* registerThread()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		buffers.push_back(std::unique_ptr<ProfileThreadBuffer>(new ProfileThreadBuffer()));
+		ProfileThreadBuffer* buffer = buffers.back().get();
+		buffer->index = (unsigned int)buffers.size() - 1;
+		buffer->name = "thread " + std::to_string(buffer->index);
+		return buffer;
+	}
+};
+
+// times its scope, see PROFILE_SCOPE
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char* name) : name(name), buffer(nullptr)
+	{
+		Profiler& profiler = Profiler::instance();
+		if (!profiler.enabled.load(std::memory_order_relaxed))
+			return;
+		buffer = &profiler.threadBuffer();
+		depth = buffer->depth++;
+		start = Profiler::ticks();
+	}
+
+	~ProfileZone()
+	{
+		if (!buffer)
+			return;
+		long long end = Profiler::ticks();
+		buffer->depth--;
+		buffer->record(name, start, end, depth);
+	}
+
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+	const char* name;
+	ProfileThreadBuffer* buffer;
+	long long start = 0;
+	int depth = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#ifndef PROFILER_DISABLED
+#define PROFILE_SCOPE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#endif
+
+// cost of an empty zone in nanoseconds, averaged over many
+inline double measureProfilerOverhead(unsigned int zones = 1000000)
+{
+	// the first zone of the thread registers its buffer, that isn't part of the cost
+	{
+		ProfileZone warmup("overhead");
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < zones; i++)
+	{
+		ProfileZone zone("overhead");
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / zones;
+}
+#endif
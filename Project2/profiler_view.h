@@ -0,0 +1,79 @@
+#ifndef PROFILER_VIEW_H
+#define PROFILER_VIEW_H
+
+#include "imGui/imgui.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// flame view of the zones of the calling thread's last top level zone (the main loop's "frame"): one row per
+// depth, time from left to right, hovering a zone shows its time. paused keeps showing the same frame
+
+// same color for the same name in every frame
+inline ImU32 profilerZoneColor(const char* name)
+{
+	unsigned int hash = 2166136261u;
+	for (const char* c = name; *c; c++)
+		hash = (hash ^ (unsigned char)*c) * 16777619u;
+	return IM_COL32(80 + hash % 120, 80 + (hash >> 8) % 120, 80 + (hash >> 16) % 120, 255);
+}
+
+inline void drawProfilerWindow(const std::string& traceFile)
+{
+	static std::vector<ProfileEvent> events;
+	static bool paused = false;
+	Profiler& profiler = Profiler::instance();
+
+	ImGui::Begin("Profiler");
+	bool enabled = profiler.enabled.load();
+	if (ImGui::Checkbox("Enabled", &enabled))
+		profiler.enabled.store(enabled);
+	ImGui::SameLine();
+	ImGui::Checkbox("Pause", &paused);
+	ImGui::SameLine();
+	if (ImGui::Button("Write Chrome trace"))
+		profiler.writeChromeTrace(traceFile);
+	if (!paused)
+		profiler.lastTopLevelZone(events);
+	if (events.empty())
+	{
+		ImGui::TextUnformatted("No zones recorded yet");
+		ImGui::End();
+		return;
+	}
+
+	// the top level zone ends last, so it was written last
+	const ProfileEvent& root = events.back();
+	double perTick = profiler.nanosecondsPerTick();
+	ImGui::Text("%s: %.3f ms, %u zones", root.name, (root.end - root.start) * perTick / 1000000.0, (unsigned int)events.size());
+
+	ImDrawList* drawList = ImGui::GetWindowDrawList();
+	ImVec2 origin = ImGui::GetCursorScreenPos();
+	float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+	float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+	double scale = width / (double)std::max(root.end - root.start, 1LL);
+	int rows = 1;
+	for (const ProfileEvent& event : events)
+	{
+		float x0 = origin.x + (float)((event.start - root.start) * scale);
+		float x1 = std::max(origin.x + (float)((event.end - root.start) * scale), x0 + 1.0f);
+		float y0 = origin.y + (event.depth - root.depth) * rowHeight;
+		float y1 = y0 + rowHeight - 1.0f;
+		rows = std::max(rows, event.depth - root.depth + 1);
+		drawList->AddRectFilled(ImVec2(x0, y0), ImVec2(x1, y1), profilerZoneColor(event.name));
+		// names are clipped to their zone, narrow zones only have a tooltip
+		if (x1 - x0 > 20.0f)
+		{
+			drawList->PushClipRect(ImVec2(x0, y0), ImVec2(x1, y1), true);
+			drawList->AddText(ImVec2(x0 + 2.0f, y0), IM_COL32(255, 255, 255, 255), event.name);
+			drawList->PopClipRect();
+		}
+		if (ImGui::IsMouseHoveringRect(ImVec2(x0, y0), ImVec2(x1, y1)))
+			ImGui::SetTooltip("%s: %.3f ms", event.name, (event.end - event.start) * perTick / 1000000.0);
+	}
+	ImGui::Dummy(ImVec2(width, rows * rowHeight));
+	ImGui::End();
+}
+#endif
@@ -0,0 +1,97 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "mesh.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// Collects the draws of a frame and issues them sorted by a 64 bit key, so draws that share a shader, then a
+// material, then a VAO end up next to each other and the state cache can skip most binds:
+//   bits 63-56 shader | 55-40 material | 39-24 VAO | 23-0 depth (front to back)
+// Shaders, materials (the set of texture ids of a mesh) and VAOs get small ids in the order they are first seen.
+// Draws with a texture array material only set the material index uniform instead of binding textures.
+
+struct RenderItem {
+	unsigned long long key;
+	Shader* shader;
+	Mesh* mesh;
+	unsigned int lod;
+	const MeshletView* view;
+	MeshletCullStats* stats;
+	int material;				// texture array material, -1 to bind the mesh's own textures
+};
+
+class RenderQueue
+{
+public:
+	// depths beyond this share the last depth bucket
+	float maxDepth = 1500.0f;
+
+	void submit(Shader& shader, Mesh& mesh, float depth, unsigned int lod = 0, const MeshletView* view = nullptr, MeshletCullStats* stats = nullptr, int material = -1)
+	{
+		unsigned long long shaderBits = idOf(shaderIds, shader.ID) & 0xff;
+		unsigned long long materialBits = materialOf(mesh) & 0xffff;
+		unsigned long long vaoBits = idOf(vaoIds, mesh.VAO) & 0xffff;
+		float normalized = std::min(std::max(depth / maxDepth, 0.0f), 1.0f);
+		unsigned long long depthBits = (unsigned long long)(normalized * 0xffffff);
+
+		RenderItem item;
+		item.key = (shaderBits << 56) | (materialBits << 40) | (vaoBits << 24) | depthBits;
+		item.shader = &shader;
+		item.mesh = &mesh;
+		item.lod = lod;
+		item.view = view;
+		item.stats = stats;
+		item.material = material;
+		items.push_back(item);
+	}
+
+	// sorts and draws everything submitted since the last flush
+	void flush(GLStateCache& state)
+	{
+		std::sort(items.begin(), items.end(), [](const RenderItem& a, const RenderItem& b) { return a.key < b.key; });
+		for (const RenderItem& item : items)
+		{
+			state.useProgram(item.shader->ID);
+			if (item.material >= 0)
+				state.setInt(item.shader->ID, "materialIndex", item.material);
+			item.mesh->Draw(state, *item.shader, item.lod, item.view, item.stats, item.material < 0);
+		}
+		items.clear();
+	}
+
+	unsigned int size() const
+	{
+		return (unsigned int)items.size();
+	}
+
+private:
+	std::vector<RenderItem> items;
+	std::map<unsigned int, unsigned int> shaderIds;
+	std::map<unsigned int, unsigned int> vaoIds;
+	std::map<std::vector<unsigned int>, unsigned int> materialIds;
+	std::vector<unsigned int> textureIds;
+
+	static unsigned int idOf(std::map<unsigned int, unsigned int>& ids, unsigned int glName)
+	{
+		std::map<unsigned int, unsigned int>::iterator it = ids.find(glName);
+		if (it == ids.end())
+			it = ids.insert(std::make_pair(glName, (unsigned int)ids.size())).first;
+		return it->second;
+	}
+
+	unsigned int materialOf(const Mesh& mesh)
+	{
+		textureIds.clear();
+		for (const Texture& texture : mesh.textures)
+			textureIds.push_back(texture.id);
+		std::map<std::vector<unsigned int>, unsigned int>::iterator it = materialIds.find(textureIds);
+		if (it == materialIds.end())
+			it = materialIds.insert(std::make_pair(textureIds, (unsigned int)materialIds.size())).first;
+		return it->second;
+	}
+};
+#endif
@@ -0,0 +1,127 @@
+#ifndef SAMPLER_CACHE_H
+#define SAMPLER_CACHE_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+
+// EXT_texture_filter_anisotropic, every desktop driver has it but the glad loader here wasn't generated with it
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT 0x84FE
+#endif
+#ifndef GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
+#endif
+
+// Sampling state of a texture, kept apart from the texels in a GL sampler object. A sampler bound to a texture
+// unit overrides the filtering of whatever texture is bound there, so it can be changed without touching the
+// textures. BASE_LEVEL and MAX_LEVEL are texture state and keep working, MIN_LOD is sampler state: the lod fade of
+// the TextureStreamer doesn't apply while a sampler is bound.
+
+enum SamplerFilter {
+	SAMPLER_NEAREST,		// nearest texel of the nearest level
+	SAMPLER_BILINEAR,		// 4 texels of the nearest level
+	SAMPLER_TRILINEAR		// 4 texels of the 2 nearest levels
+};
+
+struct SamplerDesc {
+	SamplerFilter filter = SAMPLER_TRILINEAR;
+	GLenum wrap = GL_REPEAT;
+	float anisotropy = 1.0f;	// 1 is off
+	float lodBias = 0.0f;
+
+	bool operator<(const SamplerDesc& other) const
+	{
+		if (filter != other.filter)
+			return filter < other.filter;
+		if (wrap != other.wrap)
+			return wrap < other.wrap;
+		if (anisotropy != other.anisotropy)
+			return anisotropy < other.anisotropy;
+		return lodBias < other.lodBias;
+	}
+};
+
+// hands out one sampler object per distinct descriptor
+class SamplerCache
+{
+public:
+	~SamplerCache()
+	{
+		clear();
+	}
+
+	// the sampler of a descriptor, created the first time it is asked for. 0 if sampler objects aren't supported
+	unsigned int get(SamplerDesc desc)
+	{
+		desc.anisotropy = std::max(1.0f, std::min(desc.anisotropy, maxAnisotropy()));
+		std::map<SamplerDesc, unsigned int>::iterator it = samplers.find(desc);
+		if (it != samplers.end())
+			return it->second;
+		if (!glGenSamplers)
+		{
+			std::cout << "ERROR::SAMPLER_CACHE::SAMPLER_OBJECTS_NOT_SUPPORTED" << std::endl;
+			return 0;
+		}
+
+		unsigned int sampler;
+		glGenSamplers(1, &sampler);
+		GLenum minFilter = desc.filter == SAMPLER_NEAREST ? GL_NEAREST_MIPMAP_NEAREST : desc.filter == SAMPLER_BILINEAR ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR;
+		glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, minFilter);
+		glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, desc.filter == SAMPLER_NEAREST ? GL_NEAREST : GL_LINEAR);
+		glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, desc.wrap);
+		glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, desc.wrap);
+		glSamplerParameterf(sampler, GL_TEXTURE_LOD_BIAS, desc.lodBias);
+		if (maxAnisotropy() > 1.0f)
+			glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, desc.anisotropy);
+		samplers[desc] = sampler;
+		return sampler;
+	}
+
+	// number of sampler objects created
+	unsigned int size() const
+	{
+		return (unsigned int)samplers.size();
+	}
+
+	// largest anisotropy the driver supports, 1 without the extension
+	float maxAnisotropy()
+	{
+		if (maxSupportedAnisotropy == 0.0f)
+		{
+			maxSupportedAnisotropy = 1.0f;
+			if (anisotropySupported())
+				glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxSupportedAnisotropy);
+		}
+		return maxSupportedAnisotropy;
+	}
+
+	void clear()
+	{
+		for (std::map<SamplerDesc, unsigned int>::iterator it = samplers.begin(); it != samplers.end(); ++it)
+			glDeleteSamplers(1, &it->second);
+		samplers.clear();
+	}
+
+private:
+	std::map<SamplerDesc, unsigned int> samplers;
+	float maxSupportedAnisotropy = 0.0f;
+
+	// the loader has no flag for the extension, look it up in the extension list
+	static bool anisotropySupported()
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name && (std::string(name) == "GL_EXT_texture_filter_anisotropic" || std::string(name) == "GL_ARB_texture_filter_anisotropic"))
+				return true;
+		}
+		return false;
+	}
+};
+#endif
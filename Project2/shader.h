@@ -9,6 +9,8 @@
 #include <sstream>
 #include <iostream>
 
+#include "profiler.h"
+
 class Shader
 {
 public:
@@ -19,6 +21,7 @@ public:
 	// ------------------------------------------------------------------------
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
 	{
+		PROFILE_SCOPE("Shader::Shader");
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
 		std::string fragmentCode;
@@ -1,6 +1,10 @@
+#ifndef SKELETON_H
+#define SKELETON_H
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "utils.h"
+#include "profiler.h"
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assimp/Importer.hpp>
@@ -10,7 +14,7 @@
 
 #include "stb_image.h"
 // vertex of an animated model
-struct Vertex {
+struct SkinnedVertex {
 	glm::vec3 position;							//
 	glm::vec3 normal;							//
 	glm::vec2 uv;								//
@@ -75,14 +79,14 @@ bool readSkeleton(Bone& boneOutput, aiNode* node, std::unordered_map<std::string
 	return false;
 }
 
-void loadModel(const aiScene* scene, aiMesh* mesh, std::vector<Vertex>& verticesOutput, std::vector<uint>& indicesOutput, Bone& skeletonOutput, uint& nBoneCount) {
+void loadModel(const aiScene* scene, aiMesh* mesh, std::vector<SkinnedVertex>& verticesOutput, std::vector<uint>& indicesOutput, Bone& skeletonOutput, uint& nBoneCount) {
 
 	verticesOutput = {};
 	indicesOutput = {};
 	//load position, normal, uv
 	for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
 		//process position 
-		Vertex vertex;
+		SkinnedVertex vertex;
 		glm::vec3 vector;
 		vector.x = mesh->mVertices[i].x;
 		vector.y = mesh->mVertices[i].y;
@@ -262,7 +266,7 @@ void loadAnimation(const aiScene* scene, Animation& animation) {
 	}
 }
 
-unsigned int createVertexArray(std::vector<Vertex>& vertices, std::vector<uint> indices) {
+unsigned int createVertexArray(std::vector<SkinnedVertex>& vertices, std::vector<uint> indices) {
 	uint
 		vao = 0,
 		vbo = 0,
@@ -274,17 +278,17 @@ unsigned int createVertexArray(std::vector<Vertex>& vertices, std::vector<uint>
 
 	glBindVertexArray(vao);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(SkinnedVertex) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, position));
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (GLvoid*)offsetof(SkinnedVertex, position));
 	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, normal));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (GLvoid*)offsetof(SkinnedVertex, normal));
 	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, uv));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (GLvoid*)offsetof(SkinnedVertex, uv));
 	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, boneIds));
+	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (GLvoid*)offsetof(SkinnedVertex, boneIds));
 	glEnableVertexAttribArray(4);
-	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, boneWeights));
+	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (GLvoid*)offsetof(SkinnedVertex, boneWeights));
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint), &indices[0], GL_STATIC_DRAW);
@@ -335,6 +339,7 @@ std::pair<uint, float> getTimeFraction(std::vector<float>& times, float& dt) {
 
 
 void getPose(Animation& animation, Bone& skeletion, float dt, std::vector<glm::mat4>& output, glm::mat4& parentTransform, glm::mat4& globalInverseTransform) {
+	PROFILE_SCOPE("getPose");
 	BoneTransformTrack& btt = animation.boneTransforms[skeletion.name];//ݹ"mixamorig:Hips" bttûҵϢ! ǳµص㣬ȴǰֳ
 	//Ϊ(bone)붯(animation)Ϣһһϵ
 	//ͺ: 
@@ -398,4 +403,4 @@ void getPose(Animation& animation, Bone& skeletion, float dt, std::vector<glm::m
 	}
 	//std::cout << dt << " => " << position.x << ":" << position.y << ":" << position.z << ":" << std::endl;
 }
-
+#endif
@@ -0,0 +1,122 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 texCoords;
+layout (location = 3) in vec3 tangent;
+layout (location = 4) in vec3 bitangent;
+layout (location = 5) in ivec4 boneIds;
+layout (location = 6) in vec4 weights;
+
+out VS_OUT {
+    vec3 FragPos;
+    vec2 TexCoords;
+    vec3 TangentLightPos;
+    vec3 TangentViewPos;
+    vec3 TangentFragPos;
+} vs_out;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+uniform vec3 lightPos;
+uniform vec3 viewPos;
+
+//bone palettes of all characters, see BonePaletteBuffer
+uniform samplerBuffer bonePalette;
+//first bone of this character's palette
+uniform int paletteOffset;
+uniform bool dualQuaternion;
+
+const int MAX_BONE_INFLUENCE = 4;
+
+mat4 fetchBoneMatrix(int bone)
+{
+    int texel = (paletteOffset + bone) * 4;
+    return mat4(texelFetch(bonePalette, texel),
+                texelFetch(bonePalette, texel + 1),
+                texelFetch(bonePalette, texel + 2),
+                texelFetch(bonePalette, texel + 3));
+}
+
+//linear blend skinning
+mat4 blendMatrices()
+{
+    mat4 skin = mat4(0.0);
+    float total = 0.0;
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+    {
+        if (boneIds[i] < 0)
+            continue;
+        skin += fetchBoneMatrix(boneIds[i]) * weights[i];
+        total += weights[i];
+    }
+    //vertices without bones stay where they are
+    return total > 0.0 ? skin : mat4(1.0);
+}
+
+//dual quaternion skinning, keeps the volume at twisted joints
+mat4 blendDualQuaternions()
+{
+    vec4 real = vec4(0.0);
+    vec4 dual = vec4(0.0);
+    vec4 firstReal = vec4(0.0);
+    bool first = true;
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+    {
+        if (boneIds[i] < 0)
+            continue;
+        int texel = (paletteOffset + boneIds[i]) * 2;
+        vec4 r = texelFetch(bonePalette, texel);
+        vec4 d = texelFetch(bonePalette, texel + 1);
+        if (first)
+        {
+            firstReal = r;
+            first = false;
+        }
+        //q and -q are the same rotation, blend along the shortest path
+        float w = dot(firstReal, r) < 0.0 ? -weights[i] : weights[i];
+        real += r * w;
+        dual += d * w;
+    }
+    if (first)
+        return mat4(1.0);
+
+    float len = length(real);
+    real /= len;
+    dual /= len;
+
+    //rotation part (quaternion stored as x, y, z, w)
+    float x = real.x, y = real.y, z = real.z, w = real.w;
+    mat4 m = mat4(
+        1.0 - 2.0 * (y * y + z * z), 2.0 * (x * y + w * z), 2.0 * (x * z - w * y), 0.0,
+        2.0 * (x * y - w * z), 1.0 - 2.0 * (x * x + z * z), 2.0 * (y * z + w * x), 0.0,
+        2.0 * (x * z + w * y), 2.0 * (y * z - w * x), 1.0 - 2.0 * (x * x + y * y), 0.0,
+        0.0, 0.0, 0.0, 1.0);
+    //translation = 2 * dual * conjugate(real)
+    vec3 t = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+    m[3] = vec4(t, 1.0);
+    return m;
+}
+
+void main()
+{
+    mat4 skin = dualQuaternion ? blendDualQuaternions() : blendMatrices();
+    mat4 skinnedModel = model * skin;
+
+    gl_Position = projection * view * skinnedModel * vec4(position, 1.0f);
+    vs_out.FragPos = vec3(skinnedModel * vec4(position, 1.0));
+    vs_out.TexCoords = texCoords;
+
+	//construct TBN matrix in tangent space
+    mat3 normalMatrix = transpose(inverse(mat3(skinnedModel)));
+    vec3 T = normalize(normalMatrix * tangent);
+    vec3 B = normalize(normalMatrix * bitangent);
+    vec3 N = normalize(normalMatrix * normal);
+    mat3 TBN = transpose(mat3(T, B, N));
+
+	//transform all vector into tangent space
+    vs_out.TangentLightPos = TBN * lightPos;
+    vs_out.TangentViewPos  = TBN * viewPos;
+    vs_out.TangentFragPos  = TBN * vs_out.FragPos;
+}
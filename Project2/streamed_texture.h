@@ -0,0 +1,397 @@
+#ifndef STREAMED_TEXTURE_H
+#define STREAMED_TEXTURE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stb_image.h>
+
+#include "mipgen.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Textures whose mip levels are loaded coarse to fine instead of all at once. An image is baked once into a
+// .mips container that has its whole mip chain, smallest level first. load() reads the levels up to
+// initialSize from the front of the file, which takes a few milliseconds, and gives the texture out right away.
+// GL_TEXTURE_BASE_LEVEL is the finest resident level, so sampling never touches a level that isn't there, and
+// every frame the renderer tells require() which level the screen needs. A reader thread then loads the next
+// finer level of the textures that lack the most detail first, update() uploads them on the GL thread.
+// When a level arrives GL_TEXTURE_MIN_LOD starts at 1 and fades to 0, so the new detail blends in instead of
+// popping. Levels finer than what the screen asks for are never read, memory follows what is visible.
+
+#define MIP_CONTAINER_MAX_LEVELS 16
+
+struct MipContainerHeader {
+	char magic[4];
+	int width;
+	int height;
+	int levels;
+};
+
+// level l is max(width >> l, 1) x max(height >> l, 1) RGBA8 texels
+struct MipContainerLevel {
+	long long offset;
+	int width;
+	int height;
+};
+
+// writes the mip chain of an image, box filtered like glGenerateMipmap, into a .mips container
+inline bool bakeMipContainer(const std::string& imagePath, const std::string& outputPath)
+{
+	int width, height, components;
+	unsigned char* data = stbi_load(imagePath.c_str(), &width, &height, &components, 4);
+	if (!data)
+	{
+		std::cout << "ERROR::STREAMED_TEXTURE::IMAGE_NOT_LOADED: " << imagePath << std::endl;
+		return false;
+	}
+	std::vector<std::vector<unsigned char>> chain(1, std::vector<unsigned char>(data, data + (size_t)width * height * 4));
+	stbi_image_free(data);
+	std::vector<MipContainerLevel> levels(1, MipContainerLevel{ 0, width, height });
+	while ((levels.back().width > 1 || levels.back().height > 1) && levels.size() < MIP_CONTAINER_MAX_LEVELS)
+	{
+		const MipContainerLevel& source = levels.back();
+		const std::vector<unsigned char>& texels = chain.back();
+		MipContainerLevel level = { 0, std::max(source.width / 2, 1), std::max(source.height / 2, 1) };
+		std::vector<unsigned char> next((size_t)level.width * level.height * 4);
+		downsampleBox(&texels[0], source.width, source.height, &next[0]);
+		levels.push_back(level);
+		chain.push_back(next);
+	}
+
+	// smallest level first, the levels load() needs right away are one contiguous read
+	long long offset = sizeof(MipContainerHeader) + levels.size() * sizeof(MipContainerLevel);
+	for (int l = (int)levels.size() - 1; l >= 0; l--)
+	{
+		levels[l].offset = offset;
+		offset += (long long)chain[l].size();
+	}
+	std::ofstream file(outputPath.c_str(), std::ios::binary);
+	if (!file)
+	{
+		std::cout << "ERROR::STREAMED_TEXTURE::FILE_NOT_WRITTEN: " << outputPath << std::endl;
+		return false;
+	}
+	MipContainerHeader header = { { 'M', 'I', 'P', '1' }, width, height, (int)levels.size() };
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&levels[0], levels.size() * sizeof(MipContainerLevel));
+	for (int l = (int)levels.size() - 1; l >= 0; l--)
+		file.write((const char*)&chain[l][0], chain[l].size());
+	return (bool)file;
+}
+
+struct StreamedTexture {
+	unsigned int id = 0;
+	std::string path;			// the .mips container
+	std::vector<MipContainerLevel> levels;
+	int residentLevel = 0;		// finest level on the GPU, the base level
+	int requiredLevel = 0;		// finest level the screen asked for since the last update()
+	bool loading = false;		// a level is with the reader thread
+	float minLod = 0.0f;		// fades from 1 to 0 after a level arrived
+};
+
+struct StreamingStats {
+	unsigned int textures = 0;
+	unsigned int uploads = 0;		// levels uploaded by the last update()
+	unsigned int pending = 0;		// textures that need finer levels than they have
+	size_t residentBytes = 0;
+	size_t fullBytes = 0;			// every texture with all its levels
+};
+
+class TextureStreamer
+{
+public:
+	// levels up to this size are loaded by load() itself
+	int initialSize = 64;
+	// bytes uploaded per update() at most, bounds the frame time spent on uploads
+	size_t uploadBudget = 4 * 1024 * 1024;
+	// how long a new level takes to blend in
+	float fadeSeconds = 0.25f;
+	std::vector<StreamedTexture> textures;
+	StreamingStats stats;
+
+	TextureStreamer()
+	{
+		reader = std::thread(&TextureStreamer::readerLoop, this);
+	}
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	~TextureStreamer()
+	{
+		release();
+	}
+
+	// stops the reader thread and deletes the textures, while the context is still alive. the destructor
+	// calls it too, nothing can be streamed afterwards
+	void release()
+	{
+		if (reader.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			reader.join();
+		}
+		for (const StreamedTexture& texture : textures)
+			glDeleteTextures(1, &texture.id);
+		textures.clear();
+		indices.clear();
+	}
+
+	// creates a texture with only its coarse levels, baking imagePath.mips first if there is none.
+	// returns the GL texture, 0 if the image can't be loaded
+	unsigned int load(const std::string& imagePath)
+	{
+		StreamedTexture texture;
+		texture.path = imagePath + ".mips";
+		std::ifstream file(texture.path.c_str(), std::ios::binary);
+		if (!file && bakeMipContainer(imagePath, texture.path))
+			file.open(texture.path.c_str(), std::ios::binary);
+		MipContainerHeader header;
+		file.read((char*)&header, sizeof(header));
+		if (!file || std::string(header.magic, 4) != "MIP1" || header.levels < 1 || header.levels > MIP_CONTAINER_MAX_LEVELS)
+		{
+			std::cout << "ERROR::STREAMED_TEXTURE::FILE_NOT_READ: " << texture.path << std::endl;
+			return 0;
+		}
+		texture.levels.resize(header.levels);
+		file.read((char*)&texture.levels[0], header.levels * sizeof(MipContainerLevel));
+
+		glGenTextures(1, &texture.id);
+		glBindTexture(GL_TEXTURE_2D, texture.id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		std::vector<unsigned char> texels;
+		texture.residentLevel = header.levels;
+		for (int l = header.levels - 1; l >= 0; l--)
+		{
+			const MipContainerLevel& level = texture.levels[l];
+			// the smallest level always, finer ones up to initialSize
+			if (l < header.levels - 1 && std::max(level.width, level.height) > initialSize)
+				break;
+			texels.resize((size_t)level.width * level.height * 4);
+			file.seekg(level.offset);
+			file.read((char*)&texels[0], texels.size());
+			uploadLevel(texture, l, texels);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		texture.requiredLevel = texture.residentLevel;
+		// the reader thread looks into textures
+		std::lock_guard<std::mutex> lock(mutex);
+		indices[texture.id] = (unsigned int)textures.size();
+		textures.push_back(texture);
+		return texture.id;
+	}
+
+	bool streamed(unsigned int id) const
+	{
+		return indices.count(id) > 0;
+	}
+
+	// full size of a texture, the size of level 0 whether it is resident or not
+	glm::ivec2 size(unsigned int id) const
+	{
+		std::map<unsigned int, unsigned int>::const_iterator it = indices.find(id);
+		if (it == indices.end())
+			return glm::ivec2(0);
+		return glm::ivec2(textures[it->second].levels[0].width, textures[it->second].levels[0].height);
+	}
+
+	// finest level of a texture on the GPU, -1 if it isn't streamed
+	int residentLevel(unsigned int id) const
+	{
+		std::map<unsigned int, unsigned int>::const_iterator it = indices.find(id);
+		return it == indices.end() ? -1 : textures[it->second].residentLevel;
+	}
+
+	// frees the levels of a texture finer than level. they are streamed in again once they are required
+	void evict(unsigned int id, int level)
+	{
+		std::map<unsigned int, unsigned int>::iterator it = indices.find(id);
+		if (it == indices.end())
+			return;
+		StreamedTexture& texture = textures[it->second];
+		level = std::min(level, (int)texture.levels.size() - 1);
+		if (level <= texture.residentLevel)
+			return;
+		glBindTexture(GL_TEXTURE_2D, texture.id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+		// empty levels free their memory, below the base level they don't make the texture incomplete
+		for (int l = texture.residentLevel; l < level; l++)
+			glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		texture.minLod = 0.0f;
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 0.0f);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		// a level the reader is still loading no longer sits right below the base, update() drops it
+		texture.residentLevel = level;
+	}
+
+	// asks for a level of a texture this frame, the finest level asked for since the last update() wins
+	void require(unsigned int id, int level)
+	{
+		std::map<unsigned int, unsigned int>::iterator it = indices.find(id);
+		if (it == indices.end())
+			return;
+		StreamedTexture& texture = textures[it->second];
+		texture.requiredLevel = std::min(texture.requiredLevel, std::max(level, 0));
+	}
+
+	// GL thread, once per frame: uploads the levels the reader finished, fades them in and hands the reader
+	// the next level of every texture that is coarser than required, the ones missing the most levels first
+	void update(float deltaTime)
+	{
+		std::vector<LevelData> finished;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t bytes = 0;
+			while (!ready.empty() && bytes < uploadBudget)
+			{
+				bytes += ready.back().texels.size();
+				finished.push_back(std::move(ready.back()));
+				ready.pop_back();
+			}
+		}
+		stats.uploads = 0;
+		for (LevelData& data : finished)
+		{
+			StreamedTexture& texture = textures[data.texture];
+			texture.loading = false;
+			// only the level right below the base keeps the chain complete
+			if (data.level != texture.residentLevel - 1)
+				continue;
+			glBindTexture(GL_TEXTURE_2D, texture.id);
+			uploadLevel(texture, data.level, data.texels);
+			texture.minLod = 1.0f;
+			stats.uploads++;
+		}
+
+		std::vector<Request> requests;
+		unsigned int uploads = stats.uploads;
+		stats = StreamingStats();
+		stats.textures = (unsigned int)textures.size();
+		stats.uploads = uploads;
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			StreamedTexture& texture = textures[i];
+			if (texture.minLod > 0.0f)
+			{
+				texture.minLod = std::max(texture.minLod - deltaTime / fadeSeconds, 0.0f);
+				glBindTexture(GL_TEXTURE_2D, texture.id);
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, texture.minLod);
+			}
+			if (texture.requiredLevel < texture.residentLevel)
+			{
+				stats.pending++;
+				if (!texture.loading)
+				{
+					requests.push_back(Request{ i, texture.residentLevel - 1, texture.residentLevel - texture.requiredLevel });
+					texture.loading = true;
+				}
+			}
+			for (unsigned int l = 0; l < texture.levels.size(); l++)
+			{
+				size_t bytes = (size_t)texture.levels[l].width * texture.levels[l].height * 4;
+				stats.fullBytes += bytes;
+				if ((int)l >= texture.residentLevel)
+					stats.residentBytes += bytes;
+			}
+			texture.requiredLevel = (int)texture.levels.size() - 1;
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		if (!requests.empty())
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.insert(queue.end(), requests.begin(), requests.end());
+			// the reader takes from the back, the most missing levels go last
+			std::stable_sort(queue.begin(), queue.end(), [](const Request& a, const Request& b) { return a.missing < b.missing; });
+		}
+		wake.notify_one();
+	}
+
+private:
+	struct Request {
+		unsigned int texture;
+		int level;
+		int missing;		// levels between the resident and the required one, the priority
+	};
+	struct LevelData {
+		unsigned int texture;
+		int level;
+		std::vector<unsigned char> texels;
+	};
+
+	std::map<unsigned int, unsigned int> indices;	// GL texture -> textures index
+	std::thread reader;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<Request> queue;
+	std::vector<LevelData> ready;
+	bool stopping = false;
+
+	// texture must be bound
+	void uploadLevel(StreamedTexture& texture, int level, const std::vector<unsigned char>& texels)
+	{
+		const MipContainerLevel& info = texture.levels[level];
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, info.width, info.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		texture.residentLevel = level;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	}
+
+	// reads the requested levels from the containers, no GL calls on this thread
+	void readerLoop()
+	{
+		std::map<std::string, std::ifstream> files;
+		for (;;)
+		{
+			Request request;
+			std::string path;
+			MipContainerLevel level;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (stopping)
+					return;
+				request = queue.back();
+				queue.pop_back();
+				path = textures[request.texture].path;
+				level = textures[request.texture].levels[request.level];
+			}
+			std::ifstream& file = files[path];
+			if (!file.is_open())
+				file.open(path.c_str(), std::ios::binary);
+			LevelData data;
+			data.texture = request.texture;
+			data.level = request.level;
+			data.texels.resize((size_t)level.width * level.height * 4);
+			file.clear();
+			file.seekg(level.offset);
+			file.read((char*)&data.texels[0], data.texels.size());
+			// the texture stays marked as loading, it keeps the levels it has and isn't asked for again
+			if (!file)
+			{
+				std::cout << "ERROR::STREAMED_TEXTURE::LEVEL_NOT_READ: " << path << " level " << request.level << std::endl;
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			ready.push_back(std::move(data));
+		}
+	}
+};
+#endif
@@ -0,0 +1,265 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "gl_state.h"
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Packs the textures of loaded meshes into GL_TEXTURE_2D_ARRAYs, one array per texture size and mip count (a
+// bucket), every layer with as many levels as its source had: atlases stop early so their regions don't bleed.
+// A material is then just four ints (diffuse array/layer, normal array/layer) in a uniform buffer: all arrays
+// stay bound for the whole frame and a draw only sets its material index, so meshes with different textures
+// render without a single texture bind. effect_array.fs is the matching shader.
+// GLSL 3.30 can only index sampler arrays with constants, the shader picks the array in a switch.
+// Once copied, the storage of the source textures is released unless a mesh still draws with them, so a texture
+// isn't resident twice. Their names stay reserved: meshes, the mip feedback and the budget know them by id.
+
+#define TEXTURE_ARRAY_MAX_ARRAYS 8
+#define TEXTURE_ARRAY_MAX_MATERIALS 256
+
+struct TextureArrayBucket {
+	unsigned int texture = 0;
+	int width = 0;
+	int height = 0;
+	int layers = 0;
+	// GL_TEXTURE_MAX_LEVEL of the sources, the finest level is 0
+	int maxLevel = 0;
+};
+
+// where a source texture went
+struct TextureArrayPlacement {
+	int array = -1;
+	int layer = -1;
+	// the source texture's own levels were freed after the copy
+	bool released = false;
+};
+
+class TextureArrayLibrary
+{
+public:
+	std::vector<TextureArrayBucket> arrays;
+	// texture id -> array and layer, for every diffuse and normal map build() saw. array is -1 if it didn't fit
+	std::map<unsigned int, TextureArrayPlacement> placement;
+	// x/y: array and layer of the diffuse map, z/w: of the normal map, -1 if the material has none
+	std::vector<glm::ivec4> materials;
+	unsigned int materialBuffer = 0;
+
+	TextureArrayLibrary() {}
+	TextureArrayLibrary(const TextureArrayLibrary&) = delete;
+	TextureArrayLibrary& operator=(const TextureArrayLibrary&) = delete;
+
+	~TextureArrayLibrary()
+	{
+		release();
+	}
+
+	// copies the diffuse and normal maps of the meshes into arrays and gives every mesh its material index.
+	// meshes whose textures don't fit (more than TEXTURE_ARRAY_MAX_ARRAYS sizes, too many materials) keep
+	// arrayMaterial = -1 and are drawn with their own textures. virtualTextured has to be set on the meshes
+	// before, their diffuse maps aren't kept for them
+	void build(std::vector<Mesh>& meshes)
+	{
+		release();
+
+		// every distinct texture once, grouped by size and last mip level
+		std::map<std::pair<std::pair<int, int>, int>, std::vector<unsigned int>> bySize;
+		for (const Mesh& mesh : meshes)
+		{
+			for (const Texture& texture : mesh.textures)
+			{
+				if (texture.type != "texture_diffuse" && texture.type != "texture_normal")
+					continue;
+				if (placement.count(texture.id))
+					continue;
+				placement[texture.id] = TextureArrayPlacement();
+				int width = 0, height = 0, maxLevel = 1000;
+				glBindTexture(GL_TEXTURE_2D, texture.id);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+				glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+				// the default of 1000 means the full chain
+				int lastLevel = 0;
+				while ((std::max(width, height) >> (lastLevel + 1)) > 0)
+					lastLevel++;
+				if (width > 0 && height > 0)
+					bySize[std::make_pair(std::make_pair(width, height), std::min(maxLevel, lastLevel))].push_back(texture.id);
+			}
+		}
+
+		int maxLayers = 256;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		std::vector<unsigned char> pixels;
+		for (std::map<std::pair<std::pair<int, int>, int>, std::vector<unsigned int>>::iterator it = bySize.begin(); it != bySize.end(); ++it)
+		{
+			const std::vector<unsigned int>& ids = it->second;
+			for (size_t first = 0; first < ids.size() && arrays.size() < TEXTURE_ARRAY_MAX_ARRAYS; first += maxLayers)
+			{
+				TextureArrayBucket bucket;
+				bucket.width = it->first.first.first;
+				bucket.height = it->first.first.second;
+				bucket.maxLevel = it->first.second;
+				bucket.layers = (int)std::min(ids.size() - first, (size_t)maxLayers);
+				glGenTextures(1, &bucket.texture);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, bucket.texture);
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, bucket.width, bucket.height, bucket.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+				// level 0 of every source texture is read back and copied into its layer
+				pixels.resize((size_t)bucket.width * bucket.height * 4);
+				for (int layer = 0; layer < bucket.layers; layer++)
+				{
+					unsigned int id = ids[first + layer];
+					glBindTexture(GL_TEXTURE_2D, id);
+					glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, bucket.width, bucket.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+					placement[id].array = (int)arrays.size();
+					placement[id].layer = layer;
+				}
+				// mips are filtered per layer, layers never bleed into each other. regions inside a layer (an atlas)
+				// do below the sources' last level, so the array stops there too
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, bucket.maxLevel);
+				glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				arrays.push_back(bucket);
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// materials: the first diffuse and normal map of a mesh
+		std::map<std::pair<std::pair<int, int>, std::pair<int, int>>, int> materialIds;
+		unsigned int unplaced = 0;
+		for (Mesh& mesh : meshes)
+		{
+			glm::ivec4 material(-1);
+			bool placed = true;
+			bool hasDiffuse = false, hasNormal = false;
+			for (const Texture& texture : mesh.textures)
+			{
+				bool diffuse = texture.type == "texture_diffuse" && !hasDiffuse;
+				bool normal = texture.type == "texture_normal" && !hasNormal;
+				if (!diffuse && !normal)
+					continue;
+				const TextureArrayPlacement& where = placement[texture.id];
+				placed = placed && where.array >= 0;
+				if (diffuse)
+				{
+					material.x = where.array; material.y = where.layer;
+					hasDiffuse = true;
+				}
+				else
+				{
+					material.z = where.array; material.w = where.layer;
+					hasNormal = true;
+				}
+			}
+			mesh.arrayMaterial = -1;
+			std::pair<std::pair<int, int>, std::pair<int, int>> key(std::make_pair(material.x, material.y), std::make_pair(material.z, material.w));
+			std::map<std::pair<std::pair<int, int>, std::pair<int, int>>, int>::iterator found = materialIds.find(key);
+			if (found != materialIds.end())
+				mesh.arrayMaterial = found->second;
+			else if (placed && materials.size() < TEXTURE_ARRAY_MAX_MATERIALS)
+			{
+				mesh.arrayMaterial = (int)materials.size();
+				materialIds[key] = mesh.arrayMaterial;
+				materials.push_back(material);
+			}
+			if (mesh.arrayMaterial < 0)
+				unplaced++;
+		}
+
+		// std140: an ivec4 array has a 16 byte stride, the same as the C++ layout
+		glGenBuffers(1, &materialBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, materialBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, TEXTURE_ARRAY_MAX_MATERIALS * sizeof(glm::ivec4), NULL, GL_STATIC_DRAW);
+		if (!materials.empty())
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, materials.size() * sizeof(glm::ivec4), &materials[0]);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		// the originals stay for the meshes that still draw with them: the ones without a material, and virtual
+		// textured ones for everything but the diffuse map, that comes from the virtual texture
+		std::set<unsigned int> keep;
+		for (const Mesh& mesh : meshes)
+		{
+			for (const Texture& texture : mesh.textures)
+			{
+				if (mesh.arrayMaterial < 0 || (mesh.virtualTextured && texture.type != "texture_diffuse"))
+					keep.insert(texture.id);
+			}
+		}
+		unsigned int released = 0;
+		for (std::map<unsigned int, TextureArrayPlacement>::iterator it = placement.begin(); it != placement.end(); ++it)
+		{
+			if (it->second.array < 0 || keep.count(it->first))
+				continue;
+			const TextureArrayBucket& bucket = arrays[it->second.array];
+			releaseStorage(it->first, bucket.width, bucket.height);
+			it->second.released = true;
+			released++;
+		}
+
+		std::cout << "TextureArrayLibrary::build() textures=" << placement.size() << " arrays=" << arrays.size()
+			<< " materials=" << materials.size() << " meshes without a material=" << unplaced << " originals released=" << released << std::endl;
+	}
+
+	// points the shader's textureArrays[i] samplers at units firstUnit + i and its Materials block at
+	// bindingPoint. program state, so once after loading the shader is enough
+	void setupShader(Shader& shader, unsigned int firstUnit, unsigned int bindingPoint = 0)
+	{
+		shader.use();
+		for (unsigned int i = 0; i < TEXTURE_ARRAY_MAX_ARRAYS; i++)
+			shader.setInt("textureArrays[" + std::to_string(i) + "]", firstUnit + i);
+		unsigned int block = glGetUniformBlockIndex(shader.ID, "Materials");
+		if (block != GL_INVALID_INDEX)
+			glUniformBlockBinding(shader.ID, block, bindingPoint);
+	}
+
+	// binds every array and the material buffer, once per frame. the units start above the ones Mesh::Draw
+	// binds its own textures to, so meshes without a material can be drawn in between. sampler goes on every
+	// array unit, 0 samples with the arrays' own parameters
+	void bind(GLStateCache& state, unsigned int firstUnit, unsigned int bindingPoint = 0, unsigned int sampler = 0)
+	{
+		for (unsigned int i = 0; i < TEXTURE_ARRAY_MAX_ARRAYS; i++)
+		{
+			state.bindTexture(firstUnit + i, GL_TEXTURE_2D_ARRAY, i < arrays.size() ? arrays[i].texture : 0);
+			state.bindSampler(firstUnit + i, sampler);
+		}
+		glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, materialBuffer);
+	}
+
+	// deletes the arrays and the material buffer. called by the destructor, and before that while the context
+	// is still alive when the library outlives it
+	void release()
+	{
+		for (const TextureArrayBucket& bucket : arrays)
+			glDeleteTextures(1, &bucket.texture);
+		arrays.clear();
+		placement.clear();
+		materials.clear();
+		if (materialBuffer)
+			glDeleteBuffers(1, &materialBuffer);
+		materialBuffer = 0;
+	}
+
+private:
+	// redefines every level of a 2D texture as 0x0, which frees its memory but keeps the name
+	static void releaseStorage(unsigned int id, int width, int height)
+	{
+		glBindTexture(GL_TEXTURE_2D, id);
+		for (int level = 0; (std::max(width, height) >> level) > 0; level++)
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+};
+#endif
@@ -0,0 +1,308 @@
+#ifndef TEXTURE_BUDGET_H
+#define TEXTURE_BUDGET_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "mip_feedback.h"
+#include "streamed_texture.h"
+#include "texture_array.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+
+// Keeps the textures of the meshes within a video memory budget. Every texture's bytes are counted per mip level.
+// When the resident bytes go over the budget, the finest levels are evicted, in this order:
+//  1. levels finer than what the mip feedback says the screen needs, least recently visible texture first
+//  2. levels of textures that aren't visible, least recently visible first
+//  3. levels the visible textures need, as a last resort
+// When the screen needs a level again it is restored, as long as it fits. An evicted level of a streamed texture
+// is dropped and streamed in again by the TextureStreamer, the levels of other textures are parked in system
+// memory and uploaded from there. GL_TEXTURE_BASE_LEVEL always points at the finest resident level.
+// Texture arrays are budgeted like one texture with all their layers: a level is needed if any layer's source
+// texture needs it, and it's evicted and restored for all layers together.
+
+struct TextureBudgetStats {
+	unsigned int textures = 0;
+	size_t residentBytes = 0;
+	size_t fullBytes = 0;			// every texture with all its levels
+	size_t parkedBytes = 0;			// evicted levels kept in system memory
+	unsigned int evictions = 0;		// levels evicted by the last update()
+	unsigned int restores = 0;		// levels restored by the last update()
+	unsigned int totalEvictions = 0;
+	unsigned int totalRestores = 0;
+	bool overBudget = false;		// even the coarsest levels don't fit
+};
+
+class TextureBudget
+{
+public:
+	size_t budgetBytes = 128 * 1024 * 1024;
+	TextureBudgetStats stats;
+
+	// starts tracking the textures of the meshes, streamed ones are evicted and restored through the streamer.
+	// sources the arrays released have no levels left and are only tracked through their array
+	void track(const std::vector<Mesh>& meshes, TextureStreamer* streamer = nullptr, const TextureArrayLibrary* arrays = nullptr)
+	{
+		this->streamer = streamer;
+		for (const Mesh& mesh : meshes)
+			for (const Texture& texture : mesh.textures)
+				if (!indices.count(texture.id))
+					add(texture.id);
+		unsigned int arrayCount = 0;
+		for (unsigned int i = 0; arrays && i < arrays->arrays.size(); i++)
+		{
+			std::vector<unsigned int> sources;
+			for (std::map<unsigned int, TextureArrayPlacement>::const_iterator it = arrays->placement.begin(); it != arrays->placement.end(); ++it)
+			{
+				if (it->second.array == (int)i)
+					sources.push_back(it->first);
+			}
+			addArray(arrays->arrays[i], sources);
+			arrayCount++;
+		}
+		std::cout << "TextureBudget::track() textures=" << textures.size() << " of them arrays=" << arrayCount << std::endl;
+	}
+
+	// evicts and restores levels with the usage of the last mip feedback, once per frame after it was reduced
+	void update(const MipFeedback& feedback)
+	{
+		stats.evictions = 0;
+		stats.restores = 0;
+		for (BudgetedTexture& texture : textures)
+		{
+			// an array needs the finest level any of its layers does
+			texture.neededLevel = (int)texture.levelBytes.size() - 1;
+			for (unsigned int source : texture.sources)
+			{
+				std::map<unsigned int, TextureMipUsage>::const_iterator usage = feedback.usage.find(source);
+				if (usage == feedback.usage.end() || usage->second.lastSeen != feedback.frame)
+					continue;
+				texture.lastVisible = feedback.frame;
+				texture.neededLevel = std::min(texture.neededLevel, usage->second.requiredLevel);
+			}
+			if (texture.streamed)
+				texture.residentLevel = streamer->residentLevel(texture.id);
+		}
+		size_t resident = residentBytes();
+
+		// under pressure: the cheapest levels to lose go first
+		for (int pass = 0; pass < 3 && resident > budgetBytes; pass++)
+		{
+			std::vector<BudgetedTexture*> candidates;
+			for (BudgetedTexture& texture : textures)
+			{
+				bool visible = texture.lastVisible == feedback.frame;
+				bool eligible = pass == 0 ? texture.residentLevel < texture.neededLevel : pass == 1 ? !visible : true;
+				if (eligible && texture.residentLevel < (int)texture.levelBytes.size() - 1)
+					candidates.push_back(&texture);
+			}
+			std::sort(candidates.begin(), candidates.end(), [](const BudgetedTexture* a, const BudgetedTexture* b) { return a->lastVisible < b->lastVisible; });
+			for (BudgetedTexture* texture : candidates)
+			{
+				int limit = pass == 0 ? texture->neededLevel : (int)texture->levelBytes.size() - 1;
+				while (resident > budgetBytes && texture->residentLevel < limit)
+					resident -= evict(*texture);
+			}
+		}
+		stats.overBudget = resident > budgetBytes;
+
+		// restore what the screen needs, the most recently visible first, one level per texture and frame
+		std::vector<BudgetedTexture*> wanting;
+		for (BudgetedTexture& texture : textures)
+		{
+			if (texture.neededLevel < texture.residentLevel)
+				wanting.push_back(&texture);
+		}
+		std::sort(wanting.begin(), wanting.end(), [](const BudgetedTexture* a, const BudgetedTexture* b) { return a->lastVisible > b->lastVisible; });
+		for (BudgetedTexture* texture : wanting)
+		{
+			size_t bytes = texture->levelBytes[texture->residentLevel - 1];
+			if (resident + bytes > budgetBytes)
+				continue;
+			if (texture->streamed)
+			{
+				// the streamer loads it over the next frames, the bytes count once it is resident
+				streamer->require(texture->id, texture->residentLevel - 1);
+				resident += bytes;
+				continue;
+			}
+			restore(*texture);
+			resident += bytes;
+		}
+
+		stats.textures = (unsigned int)textures.size();
+		stats.residentBytes = residentBytes();
+		stats.fullBytes = 0;
+		stats.parkedBytes = 0;
+		for (const BudgetedTexture& texture : textures)
+		{
+			for (unsigned int l = 0; l < texture.levelBytes.size(); l++)
+				stats.fullBytes += texture.levelBytes[l];
+			for (const std::vector<unsigned char>& level : texture.parked)
+				stats.parkedBytes += level.size();
+		}
+		stats.totalEvictions += stats.evictions;
+		stats.totalRestores += stats.restores;
+	}
+
+	// finest level of a texture on the GPU, -1 if it isn't tracked. for a released array source the array's
+	int residentLevel(unsigned int id) const
+	{
+		std::map<unsigned int, unsigned int>::const_iterator it = indices.find(id);
+		return it == indices.end() ? -1 : textures[it->second].residentLevel;
+	}
+
+private:
+	struct BudgetedTexture {
+		unsigned int id = 0;
+		GLenum target = GL_TEXTURE_2D;
+		int layers = 1;
+		// textures whose mip feedback decides the needed level: the texture itself, or an array's layers
+		std::vector<unsigned int> sources;
+		bool streamed = false;
+		std::vector<size_t> levelBytes;
+		std::vector<glm::ivec2> levelSizes;
+		int residentLevel = 0;		// finest level on the GPU
+		int neededLevel = 0;		// finest level the screen needs
+		unsigned int lastVisible = 0;
+		// GL formats of the levels, to read them back and upload them in the same format
+		GLint internalFormat = GL_RGBA8;
+		GLenum format = GL_RGBA;
+		// texels of the evicted levels, by level
+		std::vector<std::vector<unsigned char>> parked;
+	};
+
+	TextureStreamer* streamer = nullptr;
+	std::vector<BudgetedTexture> textures;
+	std::map<unsigned int, unsigned int> indices;
+
+	void add(unsigned int id)
+	{
+		BudgetedTexture texture;
+		texture.id = id;
+		texture.streamed = streamer && streamer->streamed(id);
+		glm::ivec2 size = texture.streamed ? streamer->size(id) : glm::ivec2(0);
+		glBindTexture(GL_TEXTURE_2D, id);
+		if (!texture.streamed)
+		{
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &size.x);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &size.y);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &texture.internalFormat);
+		}
+		if (size.x <= 0 || size.y <= 0)
+		{
+			glBindTexture(GL_TEXTURE_2D, 0);
+			return;
+		}
+		int bytesPerTexel = 4;
+		if (texture.internalFormat == GL_RED || texture.internalFormat == GL_R8)
+		{
+			texture.format = GL_RED;
+			bytesPerTexel = 1;
+		}
+		else if (texture.internalFormat == GL_RGB || texture.internalFormat == GL_RGB8)
+			texture.format = GL_RGB;	// drivers pad it to 4 bytes
+		int maxLevel = 1000;
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		for (int l = 0; l <= maxLevel; l++)
+		{
+			glm::ivec2 level(std::max(size.x >> l, 1), std::max(size.y >> l, 1));
+			texture.levelSizes.push_back(level);
+			texture.levelBytes.push_back((size_t)level.x * level.y * bytesPerTexel);
+			if (level.x == 1 && level.y == 1)
+				break;
+		}
+		texture.parked.resize(texture.levelBytes.size());
+		texture.sources.push_back(id);
+		texture.residentLevel = texture.streamed ? streamer->residentLevel(id) : 0;
+		texture.neededLevel = texture.residentLevel;
+		indices[id] = (unsigned int)textures.size();
+		textures.push_back(texture);
+	}
+
+	// an array of RGBA8 layers, as TextureArrayLibrary builds them. the sources that don't have a 2D texture of
+	// their own any more are looked up through it
+	void addArray(const TextureArrayBucket& bucket, const std::vector<unsigned int>& sources)
+	{
+		BudgetedTexture texture;
+		texture.id = bucket.texture;
+		texture.target = GL_TEXTURE_2D_ARRAY;
+		texture.layers = bucket.layers;
+		texture.sources = sources;
+		for (int l = 0; l <= bucket.maxLevel; l++)
+		{
+			glm::ivec2 level(std::max(bucket.width >> l, 1), std::max(bucket.height >> l, 1));
+			texture.levelSizes.push_back(level);
+			texture.levelBytes.push_back((size_t)level.x * level.y * 4 * bucket.layers);
+		}
+		texture.parked.resize(texture.levelBytes.size());
+		unsigned int index = (unsigned int)textures.size();
+		indices[bucket.texture] = index;
+		for (unsigned int source : sources)
+		{
+			if (!indices.count(source))
+				indices[source] = index;
+		}
+		textures.push_back(texture);
+	}
+
+	size_t residentBytes() const
+	{
+		size_t bytes = 0;
+		for (const BudgetedTexture& texture : textures)
+			for (unsigned int l = std::max(texture.residentLevel, 0); l < texture.levelBytes.size(); l++)
+				bytes += texture.levelBytes[l];
+		return bytes;
+	}
+
+	// drops the finest resident level, returns its bytes
+	size_t evict(BudgetedTexture& texture)
+	{
+		int level = texture.residentLevel;
+		if (texture.streamed)
+			streamer->evict(texture.id, level + 1);
+		else
+		{
+			texture.parked[level].resize(texture.levelBytes[level]);
+			glBindTexture(texture.target, texture.id);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glGetTexImage(texture.target, level, texture.format, GL_UNSIGNED_BYTE, &texture.parked[level][0]);
+			glPixelStorei(GL_PACK_ALIGNMENT, 4);
+			glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, level + 1);
+			// an empty level frees its memory, below the base level it doesn't make the texture incomplete
+			if (texture.target == GL_TEXTURE_2D_ARRAY)
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, texture.internalFormat, 0, 0, 0, 0, texture.format, GL_UNSIGNED_BYTE, NULL);
+			else
+				glTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, 0, 0, 0, texture.format, GL_UNSIGNED_BYTE, NULL);
+			glBindTexture(texture.target, 0);
+		}
+		texture.residentLevel = level + 1;
+		stats.evictions++;
+		return texture.levelBytes[level];
+	}
+
+	// uploads the parked level right below the resident ones again
+	void restore(BudgetedTexture& texture)
+	{
+		int level = texture.residentLevel - 1;
+		glm::ivec2 size = texture.levelSizes[level];
+		glBindTexture(texture.target, texture.id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		if (texture.target == GL_TEXTURE_2D_ARRAY)
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, texture.internalFormat, size.x, size.y, texture.layers, 0, texture.format, GL_UNSIGNED_BYTE, &texture.parked[level][0]);
+		else
+			glTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, size.x, size.y, 0, texture.format, GL_UNSIGNED_BYTE, &texture.parked[level][0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, level);
+		glBindTexture(texture.target, 0);
+		std::vector<unsigned char>().swap(texture.parked[level]);
+		texture.residentLevel = level;
+		stats.restores++;
+	}
+};
+#endif
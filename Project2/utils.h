@@ -1,3 +1,6 @@
+#ifndef UTILS_H
+#define UTILS_H
+
 
 #include "glad.h"
 #include <iostream>
@@ -107,7 +110,7 @@ unsigned int loadTexture(char const * path)
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		//filter method for mipmap
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		//filter method for non-mipmap
 		/*glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);*/
@@ -121,4 +124,5 @@ unsigned int loadTexture(char const * path)
 	}
 
 	return textureID;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
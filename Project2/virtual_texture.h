@@ -0,0 +1,583 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stb_image.h>
+
+#include <../shader.h>
+#include "gl_state.h"
+#include "mipgen.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Sparse virtual texturing. A texture is baked offline into a tile file: every mip level cut into square tiles
+// with a border of wrapped texels, so bilinear filtering inside a tile never needs its neighbours.
+// At runtime only the tiles the screen needs are resident, in the slots of one physical cache texture:
+//  - a feedback pass renders the virtual textured meshes at a fraction of the screen resolution and writes the
+//    tile and mip every pixel wants (vt_feedback.fs), it is read back one frame later through a PBO
+//  - update() loads the missing tiles from the tile file (a few per frame, coarse mips first), evicting the
+//    least recently used ones, and rewrites the page table
+//  - the page table has a texel per tile and mip (RGBA8UI, mipmapped like the virtual texture) holding the slot
+//    of the tile, or of its closest resident parent, and the mip that slot actually has. effect_vt.fs samples
+//    through it. the coarsest mip is always resident, so every lookup finds something
+// Video memory is the cache plus the page table, set by the cache size instead of the texture size.
+// Texture sizes are resampled up to powers of two when baking, so tile (x, y) of mip m has the parent
+// (x / 2, y / 2) of mip m + 1.
+
+#define VT_MAX_LEVELS 16
+
+struct VirtualTextureStats {
+	unsigned int requested = 0;		// distinct tiles in the last feedback, parents included
+	unsigned int resident = 0;
+	unsigned int uploads = 0;		// tiles loaded by the last update()
+	unsigned int evictions = 0;
+	unsigned int pending = 0;		// requested tiles left for the next frames
+	size_t cacheBytes = 0;			// physical cache + page table
+	size_t fullBytes = 0;			// the whole texture with all its mips
+};
+
+// header of a .vtex file, followed by the tiles of every level, row by row, level 0 first.
+// a tile is (tileSize + 2 * border)^2 RGBA8 texels
+struct VirtualTextureHeader {
+	char magic[4];
+	int width;
+	int height;
+	int tileSize;
+	int border;
+	int levels;
+};
+
+// tiles of one level in x and y
+inline glm::ivec2 virtualLevelTiles(const VirtualTextureHeader& header, int level)
+{
+	return glm::max(glm::ivec2(header.width >> level, header.height >> level) / header.tileSize, glm::ivec2(1));
+}
+
+// cuts an image into a tile file. the image is resampled to power of two dimensions and mips are box filtered
+// down to the level that fits into a single tile
+inline bool bakeVirtualTexture(const std::string& imagePath, const std::string& outputPath, int tileSize = 128, int border = 4)
+{
+	int sourceWidth, sourceHeight, components;
+	unsigned char* data = stbi_load(imagePath.c_str(), &sourceWidth, &sourceHeight, &components, 4);
+	if (!data)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::IMAGE_NOT_LOADED: " << imagePath << std::endl;
+		return false;
+	}
+	int width = tileSize, height = tileSize;
+	while (width < sourceWidth)
+		width *= 2;
+	while (height < sourceHeight)
+		height *= 2;
+	if (width / tileSize > 256 || height / tileSize > 256)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::TOO_LARGE: " << imagePath << " needs more than 256 tiles per row" << std::endl;
+		stbi_image_free(data);
+		return false;
+	}
+
+	// bilinear resample to the baked size, wrapping like GL_REPEAT
+	std::vector<unsigned char> level((size_t)width * height * 4);
+	for (int y = 0; y < height; y++)
+	{
+		float sy = ((float)y + 0.5f) * sourceHeight / height - 0.5f;
+		int y0 = (int)std::floor(sy);
+		float fy = sy - y0;
+		for (int x = 0; x < width; x++)
+		{
+			float sx = ((float)x + 0.5f) * sourceWidth / width - 0.5f;
+			int x0 = (int)std::floor(sx);
+			float fx = sx - x0;
+			for (int c = 0; c < 4; c++)
+			{
+				float value = 0.0f;
+				for (int j = 0; j < 2; j++)
+					for (int i = 0; i < 2; i++)
+					{
+						int px = ((x0 + i) % sourceWidth + sourceWidth) % sourceWidth;
+						int py = ((y0 + j) % sourceHeight + sourceHeight) % sourceHeight;
+						value += data[((size_t)py * sourceWidth + px) * 4 + c] * (i ? fx : 1.0f - fx) * (j ? fy : 1.0f - fy);
+					}
+				level[((size_t)y * width + x) * 4 + c] = (unsigned char)std::min(value + 0.5f, 255.0f);
+			}
+		}
+	}
+	stbi_image_free(data);
+
+	VirtualTextureHeader header = { { 'V', 'T', 'X', '1' }, width, height, tileSize, border, 1 };
+	while (header.levels < VT_MAX_LEVELS && ((width >> (header.levels - 1)) > tileSize || (height >> (header.levels - 1)) > tileSize))
+		header.levels++;
+
+	std::ofstream file(outputPath.c_str(), std::ios::binary);
+	if (!file)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::FILE_NOT_WRITTEN: " << outputPath << std::endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	int slot = tileSize + 2 * border;
+	std::vector<unsigned char> tile((size_t)slot * slot * 4);
+	int levelWidth = width, levelHeight = height;
+	for (int l = 0; l < header.levels; l++)
+	{
+		glm::ivec2 tiles = virtualLevelTiles(header, l);
+		for (int ty = 0; ty < tiles.y; ty++)
+			for (int tx = 0; tx < tiles.x; tx++)
+			{
+				for (int y = 0; y < slot; y++)
+				{
+					int sy = ((ty * tileSize + y - border) % levelHeight + levelHeight) % levelHeight;
+					for (int x = 0; x < slot; x++)
+					{
+						int sx = ((tx * tileSize + x - border) % levelWidth + levelWidth) % levelWidth;
+						for (int c = 0; c < 4; c++)
+							tile[((size_t)y * slot + x) * 4 + c] = level[((size_t)sy * levelWidth + sx) * 4 + c];
+					}
+				}
+				file.write((const char*)&tile[0], tile.size());
+			}
+
+		// box filter into the next level
+		int nextWidth = std::max(levelWidth / 2, 1), nextHeight = std::max(levelHeight / 2, 1);
+		std::vector<unsigned char> next((size_t)nextWidth * nextHeight * 4);
+		downsampleBox(&level[0], levelWidth, levelHeight, &next[0]);
+		level.swap(next);
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+	}
+	std::cout << "bakeVirtualTexture() " << imagePath << " " << sourceWidth << "x" << sourceHeight << " -> " << outputPath
+		<< " " << width << "x" << height << " levels=" << header.levels << " tile=" << tileSize << "+" << border << std::endl;
+	return (bool)file;
+}
+
+// residency of the tiles in the cache slots, the CPU side of VirtualTexture without any GL calls
+class TileCache
+{
+public:
+	// a page table texel: slot x, slot y, the mip the slot holds, 255 if mapped
+	struct Entry {
+		unsigned char x, y, mip, mapped;
+	};
+
+	VirtualTextureHeader header;
+	int slotsPerRow = 0;
+	// page table texels of every level, levels[l] is tiles(l).x * tiles(l).y
+	std::vector<std::vector<Entry>> pageTable;
+
+	void reset(const VirtualTextureHeader& header, int slotsPerRow)
+	{
+		this->header = header;
+		this->slotsPerRow = std::min(slotsPerRow, 256);
+		slots.assign(this->slotsPerRow * this->slotsPerRow, Slot());
+		resident.clear();
+		pageTable.assign(header.levels, std::vector<Entry>());
+		for (int l = 0; l < header.levels; l++)
+		{
+			glm::ivec2 tiles = virtualLevelTiles(header, l);
+			pageTable[l].assign(tiles.x * tiles.y, Entry());
+		}
+		frame = 0;
+	}
+
+	static unsigned int key(int level, int x, int y)
+	{
+		return ((unsigned int)level << 16) | ((unsigned int)y << 8) | (unsigned int)x;
+	}
+
+	// adds a tile to this frame's requests, with all its parents
+	void request(int level, int x, int y, std::map<unsigned int, bool>& requests) const
+	{
+		for (; level < header.levels; level++, x /= 2, y /= 2)
+		{
+			glm::ivec2 tiles = virtualLevelTiles(header, level);
+			if (x >= tiles.x || y >= tiles.y)
+				return;
+			if (!requests.insert(std::make_pair(key(level, x, y), true)).second)
+				return;
+		}
+	}
+
+	// marks the requested resident tiles as used and returns the missing ones, coarsest first
+	std::vector<unsigned int> missing(const std::map<unsigned int, bool>& requests)
+	{
+		frame++;
+		std::vector<unsigned int> result;
+		for (std::map<unsigned int, bool>::const_iterator it = requests.begin(); it != requests.end(); ++it)
+		{
+			std::map<unsigned int, int>::iterator found = resident.find(it->first);
+			if (found != resident.end())
+				slots[found->second].lastUsed = frame;
+			else
+				result.push_back(it->first);
+		}
+		std::sort(result.begin(), result.end(), [](unsigned int a, unsigned int b) { return a > b; });
+		return result;
+	}
+
+	// slot for a new tile: a free one, else the least recently used tile that wasn't requested this frame.
+	// -1 if every slot is in use this frame
+	int allocate(unsigned int tile, bool pinned, unsigned int& evicted)
+	{
+		int best = -1;
+		for (int i = 0; i < (int)slots.size(); i++)
+		{
+			if (!slots[i].used)
+			{
+				best = i;
+				break;
+			}
+			if (slots[i].pinned || slots[i].lastUsed == frame)
+				continue;
+			if (best < 0 || slots[i].lastUsed < slots[best].lastUsed)
+				best = i;
+		}
+		if (best < 0)
+			return -1;
+		if (slots[best].used)
+		{
+			resident.erase(slots[best].tile);
+			evicted++;
+		}
+		slots[best].used = true;
+		slots[best].pinned = pinned;
+		slots[best].tile = tile;
+		slots[best].lastUsed = frame;
+		resident[tile] = best;
+		return best;
+	}
+
+	// points every page table texel at its tile's slot, or at the slot of the closest resident parent
+	void updatePageTable()
+	{
+		for (int l = header.levels - 1; l >= 0; l--)
+		{
+			glm::ivec2 tiles = virtualLevelTiles(header, l);
+			glm::ivec2 parentTiles = virtualLevelTiles(header, std::min(l + 1, header.levels - 1));
+			for (int y = 0; y < tiles.y; y++)
+				for (int x = 0; x < tiles.x; x++)
+				{
+					Entry entry = Entry();
+					std::map<unsigned int, int>::const_iterator found = resident.find(key(l, x, y));
+					if (found != resident.end())
+					{
+						entry.x = (unsigned char)(found->second % slotsPerRow);
+						entry.y = (unsigned char)(found->second / slotsPerRow);
+						entry.mip = (unsigned char)l;
+						entry.mapped = 255;
+					}
+					else if (l + 1 < header.levels)
+						entry = pageTable[l + 1][std::min(y / 2, parentTiles.y - 1) * parentTiles.x + std::min(x / 2, parentTiles.x - 1)];
+					pageTable[l][y * tiles.x + x] = entry;
+				}
+		}
+	}
+
+	unsigned int residentCount() const
+	{
+		return (unsigned int)resident.size();
+	}
+
+private:
+	struct Slot {
+		bool used = false;
+		bool pinned = false;
+		unsigned int tile = 0;
+		unsigned int lastUsed = 0;
+	};
+	std::vector<Slot> slots;
+	std::map<unsigned int, int> resident;	// tile key -> slot
+	unsigned int frame = 0;
+};
+
+class VirtualTexture
+{
+public:
+	// resolution of the feedback pass is the screen's divided by this
+	int feedbackDivisor = 8;
+	// tiles read from disk and uploaded per update(), bounds the hitch of a camera cut
+	unsigned int maxUploadsPerFrame = 8;
+	VirtualTextureStats stats;
+
+	VirtualTexture() {}
+	VirtualTexture(const VirtualTexture&) = delete;
+	VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+	~VirtualTexture()
+	{
+		release();
+	}
+
+	bool loaded() const
+	{
+		return cacheTexture != 0;
+	}
+
+	// opens a tile file and creates the cache (slotsPerRow^2 tiles), the page table and the feedback target.
+	// the coarsest level is loaded right away and stays resident
+	bool open(const std::string& path, int slotsPerRow, int screenWidth, int screenHeight)
+	{
+		release();
+		file.open(path.c_str(), std::ios::binary);
+		VirtualTextureHeader header;
+		file.read((char*)&header, sizeof(header));
+		if (!file || std::string(header.magic, 4) != "VTX1" || header.levels < 1 || header.levels > VT_MAX_LEVELS || header.tileSize <= 0)
+		{
+			std::cout << "ERROR::VIRTUAL_TEXTURE::FILE_NOT_READ: " << path << std::endl;
+			file.close();
+			return false;
+		}
+		cache.reset(header, slotsPerRow);
+		slotSize = header.tileSize + 2 * header.border;
+		tileBytes = (size_t)slotSize * slotSize * 4;
+		levelOffsets.clear();
+		std::streamoff offset = sizeof(header);
+		for (int l = 0; l < header.levels; l++)
+		{
+			levelOffsets.push_back(offset);
+			glm::ivec2 tiles = virtualLevelTiles(header, l);
+			offset += (std::streamoff)tiles.x * tiles.y * tileBytes;
+		}
+
+		int cacheSize = cache.slotsPerRow * slotSize;
+		glGenTextures(1, &cacheTexture);
+		glBindTexture(GL_TEXTURE_2D, cacheTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheSize, cacheSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glGenTextures(1, &pageTableTexture);
+		glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+		for (int l = 0; l < header.levels; l++)
+		{
+			glm::ivec2 tiles = virtualLevelTiles(header, l);
+			glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8UI, tiles.x, tiles.y, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		createFeedbackTarget(screenWidth, screenHeight);
+
+		// the coarsest level is the fallback of every lookup
+		glm::ivec2 tiles = virtualLevelTiles(header, header.levels - 1);
+		for (int y = 0; y < tiles.y; y++)
+			for (int x = 0; x < tiles.x; x++)
+				loadTile(TileCache::key(header.levels - 1, x, y), true);
+		uploadPageTable();
+
+		stats = VirtualTextureStats();
+		stats.cacheBytes = (size_t)cacheSize * cacheSize * 4;
+		stats.fullBytes = 0;
+		for (int l = 0; l < header.levels; l++)
+		{
+			glm::ivec2 level = virtualLevelTiles(header, l);
+			stats.cacheBytes += (size_t)level.x * level.y * 4;
+		}
+		for (int l = 0; (header.width >> l) > 0 || (header.height >> l) > 0; l++)
+			stats.fullBytes += (size_t)std::max(header.width >> l, 1) * std::max(header.height >> l, 1) * 4;
+		std::cout << "VirtualTexture::open() " << path << " " << header.width << "x" << header.height << " levels=" << header.levels
+			<< " cache=" << cacheSize << "x" << cacheSize << " (" << stats.cacheBytes / 1024 << " KB, full texture "
+			<< stats.fullBytes / 1024 << " KB)" << std::endl;
+		return true;
+	}
+
+	// the uniforms and units of a shader that samples the virtual texture (effect_vt.fs, vt_feedback.fs)
+	void setupShader(Shader& shader, unsigned int cacheUnit, unsigned int pageTableUnit)
+	{
+		shader.use();
+		shader.setInt("vtCache", cacheUnit);
+		shader.setInt("vtPageTable", pageTableUnit);
+		shader.setVec2("vtSize", glm::vec2((float)cache.header.width, (float)cache.header.height));
+		shader.setFloat("vtTileSize", (float)cache.header.tileSize);
+		shader.setFloat("vtBorder", (float)cache.header.border);
+		shader.setFloat("vtCacheSize", (float)(cache.slotsPerRow * slotSize));
+		shader.setFloat("vtLevels", (float)cache.header.levels);
+		shader.setFloat("vtLodBias", 0.0f);
+	}
+
+	// cacheSampler filters the cache, it has to clamp or the pages bleed into each other at the cache's edges.
+	// the page table is only read with texelFetch and never takes a sampler
+	void bind(GLStateCache& state, unsigned int cacheUnit, unsigned int pageTableUnit, unsigned int cacheSampler = 0)
+	{
+		state.bindTexture2D(cacheUnit, cacheTexture);
+		state.bindSampler(cacheUnit, cacheSampler);
+		state.bindTexture2D(pageTableUnit, pageTableTexture);
+		state.bindSampler(pageTableUnit, 0);
+	}
+
+	// binds and clears the feedback target. draw the virtual textured meshes with vt_feedback.fs in between,
+	// its mip bias is -log2(feedbackDivisor) so the mips match the full resolution
+	void beginFeedback(Shader& feedbackShader)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+		glViewport(0, 0, feedbackWidth, feedbackHeight);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		feedbackShader.use();
+		feedbackShader.setFloat("vtLodBias", -std::log2((float)feedbackDivisor));
+	}
+
+	// starts the readback of this frame's feedback into one of two PBOs
+	void endFeedback()
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[feedbackFrame % 2]);
+		glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		feedbackFrame++;
+	}
+
+	// reads the feedback of two frames ago, which the GPU has long finished, so mapping it never stalls.
+	// then streams in missing tiles and updates the page table
+	void update()
+	{
+		stats.uploads = 0;
+		if (!loaded() || feedbackFrame < 2)
+			return;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[feedbackFrame % 2]);
+		const unsigned char* texels = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		requests.clear();
+		if (texels)
+		{
+			for (int i = 0; i < feedbackWidth * feedbackHeight; i++)
+			{
+				const unsigned char* texel = texels + i * 4;
+				if (texel[3])
+					cache.request(texel[2], texel[0], texel[1], requests);
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		std::vector<unsigned int> tiles = cache.missing(requests);
+		for (unsigned int i = 0; i < tiles.size() && stats.uploads < maxUploadsPerFrame; i++)
+		{
+			if (!loadTile(tiles[i], false))
+				break;
+			stats.uploads++;
+		}
+		if (stats.uploads)
+			uploadPageTable();
+		stats.requested = (unsigned int)requests.size();
+		stats.resident = cache.residentCount();
+		stats.pending = (unsigned int)tiles.size() - stats.uploads;
+	}
+
+	// deletes the GL objects and closes the tile file. the destructor calls it too, main does before the
+	// context goes away
+	void release()
+	{
+		if (cacheTexture)
+			glDeleteTextures(1, &cacheTexture);
+		if (pageTableTexture)
+			glDeleteTextures(1, &pageTableTexture);
+		if (feedbackColor)
+			glDeleteTextures(1, &feedbackColor);
+		if (feedbackDepth)
+			glDeleteRenderbuffers(1, &feedbackDepth);
+		if (feedbackFramebuffer)
+			glDeleteFramebuffers(1, &feedbackFramebuffer);
+		if (feedbackBuffers[0])
+			glDeleteBuffers(2, feedbackBuffers);
+		cacheTexture = pageTableTexture = feedbackColor = feedbackDepth = feedbackFramebuffer = 0;
+		feedbackBuffers[0] = feedbackBuffers[1] = 0;
+		if (file.is_open())
+			file.close();
+	}
+
+private:
+	TileCache cache;
+	std::ifstream file;
+	std::vector<std::streamoff> levelOffsets;
+	int slotSize = 0;
+	size_t tileBytes = 0;
+	std::vector<unsigned char> tilePixels;
+	std::map<unsigned int, bool> requests;
+
+	unsigned int cacheTexture = 0;
+	unsigned int pageTableTexture = 0;
+	unsigned int feedbackFramebuffer = 0;
+	unsigned int feedbackColor = 0;
+	unsigned int feedbackDepth = 0;
+	unsigned int feedbackBuffers[2] = { 0, 0 };
+	int feedbackWidth = 0, feedbackHeight = 0;
+	unsigned int feedbackFrame = 0;
+
+	void createFeedbackTarget(int screenWidth, int screenHeight)
+	{
+		feedbackWidth = std::max(screenWidth / feedbackDivisor, 1);
+		feedbackHeight = std::max(screenHeight / feedbackDivisor, 1);
+		glGenTextures(1, &feedbackColor);
+		glBindTexture(GL_TEXTURE_2D, feedbackColor);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, feedbackWidth, feedbackHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenRenderbuffers(1, &feedbackDepth);
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glGenFramebuffers(1, &feedbackFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::VIRTUAL_TEXTURE::FRAMEBUFFER_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glGenBuffers(2, feedbackBuffers);
+		for (int i = 0; i < 2; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)feedbackWidth * feedbackHeight * 4, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		feedbackFrame = 0;
+	}
+
+	// reads a tile from the file into a free (or the least recently used) slot. false if no slot is free
+	bool loadTile(unsigned int tile, bool pinned)
+	{
+		int level = tile >> 16, y = (tile >> 8) & 0xff, x = tile & 0xff;
+		int slot = cache.allocate(tile, pinned, stats.evictions);
+		if (slot < 0)
+			return false;
+		glm::ivec2 tiles = virtualLevelTiles(cache.header, level);
+		tilePixels.resize(tileBytes);
+		file.clear();
+		file.seekg(levelOffsets[level] + (std::streamoff)(y * tiles.x + x) * tileBytes);
+		file.read((char*)&tilePixels[0], tileBytes);
+		if (!file)
+			std::cout << "ERROR::VIRTUAL_TEXTURE::TILE_NOT_READ: level " << level << " tile " << x << "," << y << std::endl;
+		glBindTexture(GL_TEXTURE_2D, cacheTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cache.slotsPerRow) * slotSize, (slot / cache.slotsPerRow) * slotSize,
+			slotSize, slotSize, GL_RGBA, GL_UNSIGNED_BYTE, &tilePixels[0]);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return true;
+	}
+
+	void uploadPageTable()
+	{
+		cache.updatePageTable();
+		glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int l = 0; l < cache.header.levels; l++)
+		{
+			glm::ivec2 tiles = virtualLevelTiles(cache.header, l);
+			glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, tiles.x, tiles.y, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &cache.pageTable[l][0]);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+};
+#endif
@@ -0,0 +1,28 @@
+#version 330 core
+out vec4 FragColor;
+
+in VS_OUT {
+    vec3 FragPos;
+    vec2 TexCoords;
+    vec3 TangentLightPos;
+    vec3 TangentViewPos;
+    vec3 TangentFragPos;
+} fs_in;
+
+// writes the virtual texture tile and mip this pixel needs: r/g tile x/y, b mip, a 1 (0 where nothing is drawn).
+// vtLodBias makes up for the lower resolution of the feedback target, see virtual_texture.h
+uniform usampler2D vtPageTable;
+uniform vec2 vtSize;
+uniform float vtLevels;
+uniform float vtLodBias;
+
+void main()
+{
+    vec2 dx = dFdx(fs_in.TexCoords * vtSize);
+    vec2 dy = dFdy(fs_in.TexCoords * vtSize);
+    float d = max(dot(dx, dx), dot(dy, dy));
+    int level = int(clamp(0.5 * log2(max(d, 1e-8)) + vtLodBias, 0.0, vtLevels - 1.0));
+    ivec2 tiles = textureSize(vtPageTable, level);
+    ivec2 tile = min(ivec2(fract(fs_in.TexCoords) * vec2(tiles)), tiles - 1);
+    FragColor = vec4(vec2(tile) / 255.0, float(level) / 255.0, 1.0);
+}